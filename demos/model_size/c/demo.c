@@ -16,6 +16,31 @@ void print_fsize(const char *filename) {
 }
 
 
+// Bytes taken in memory by the TA states (TA ids for stateless) and the inference indexes derived from them
+// (include masks, posting lists, trie), weights and scratch buffers excluded
+void print_ta_memory(const char *name, size_t bytes) {
+	printf("%s TA memory: %zu\n", name, bytes);
+}
+
+size_t posting_lists_memory(const uint32_t *posting_offsets, uint32_t num_literals, uint32_t num_clauses) {
+    if (posting_offsets == NULL) {
+        return 0;
+    }
+    // Offsets, postings and positive literal counts per clause
+    return ((size_t)2 * num_literals + 1 + posting_offsets[2 * num_literals] + num_clauses) * sizeof(uint32_t);
+}
+
+size_t stateless_ta_memory(const struct StatelessTsetlinMachine *sltm) {
+    size_t bytes = (sltm->num_clauses + 1) * sizeof(uint32_t) + (size_t)sltm->clause_offsets[sltm->num_clauses] * sltm->ta_id_size;
+    bytes += posting_lists_memory(sltm->posting_offsets, sltm->num_literals, sltm->num_clauses);
+    if (sltm->trie_nodes != NULL) {
+        bytes += (sltm->num_trie_nodes + 1) * sizeof(struct StatelessTrieNode);
+        bytes += sltm->trie_nodes[sltm->num_trie_nodes].clause_start * sizeof(uint32_t);
+    }
+    return bytes;
+}
+
+
 int main() {
     const char *file_path = "data/models/mnist_tm.bin";
     print_fsize(file_path);
@@ -26,6 +51,9 @@ int main() {
 		return 1;
 	}
     tm_save(tm, "build/dense.bin");
+    size_t dense_bytes = (size_t)tm->num_clauses * 2 * tm->ta_plane_size * sizeof(int8_t);
+    dense_bytes += (size_t)tm->num_clauses * 2 * tm->mask_row_size * sizeof(uint64_t);
+    print_ta_memory("dense", dense_bytes);
     tm_free(tm);
     print_fsize("build/dense.bin");
 
@@ -35,6 +63,12 @@ int main() {
 		return 1;
 	}
     stm_save(stm, "build/sparse.bin");
+    size_t sparse_bytes = stm->num_clauses * sizeof(struct TAStateList);
+    for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
+        sparse_bytes += stm->ta_state[clause_id].capacity * stm->node_size;
+    }
+    sparse_bytes += posting_lists_memory(stm->posting_offsets, stm->num_literals, stm->num_clauses);
+    print_ta_memory("sparse", sparse_bytes);
     stm_free(stm);
     print_fsize("build/sparse.bin");
 
@@ -44,8 +78,20 @@ int main() {
 		return 1;
 	}
     sltm_save(sltm, "build/stateless.bin");
-    sltm_free(sltm);
+    print_ta_memory("stateless", stateless_ta_memory(sltm));
     print_fsize("build/stateless.bin");
 
+    uint32_t num_clauses = sltm->num_clauses;
+    sltm_compact(sltm);
+    printf("stateless compacted clauses: %u -> %u\n", num_clauses, sltm->num_clauses);
+    sltm_save(sltm, "build/stateless_compact.bin");
+    print_ta_memory("stateless compacted", stateless_ta_memory(sltm));
+    print_fsize("build/stateless_compact.bin");
+
+    // The trie is opt-in, this is what it adds
+    sltm_update_trie(sltm);
+    print_ta_memory("stateless compacted with trie", stateless_ta_memory(sltm));
+    sltm_free(sltm);
+
     return 0;
 }
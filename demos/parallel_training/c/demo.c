@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../../mnist/c/mnist_util.h"
+
+
+// Parameters like in the MNIST training demo
+#define NUM_CLASSES 10
+#define THRESHOLD 1200
+#define NUM_LITERALS 784
+#define NUM_CLAUSES 1000
+#define MAX_STATE 127
+#define MIN_STATE -127
+#define BOOST_TRUE_POSITIVE_FEEDBACK 1
+#define S 20.0f
+#define SEED 42
+
+#define TRAIN_ROWS 60000
+#define TEST_ROWS 10000
+#define EPOCHS 1
+
+
+// Wall clock, clock() would add up the CPU time of all threads
+static double wall_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static struct TsetlinMachine *create_tm(void) {
+    return tm_create(NUM_CLASSES, THRESHOLD, NUM_LITERALS, NUM_CLAUSES, MAX_STATE, MIN_STATE,
+        BOOST_TRUE_POSITIVE_FEEDBACK, 1, sizeof(int32_t), S, SEED);
+}
+
+static struct SparseTsetlinMachine *create_stm(void) {
+    return stm_create(NUM_CLASSES, THRESHOLD, NUM_LITERALS, NUM_CLAUSES, MAX_STATE, MIN_STATE,
+        BOOST_TRUE_POSITIVE_FEEDBACK, 1, sizeof(int32_t), S, SEED);
+}
+
+
+int main(int argc, char **argv) {
+    // Optional argument: number of threads (default 0 - one per online CPU core)
+    uint32_t num_threads = argc > 1 ? (uint32_t)atoi(argv[1]) : 0;
+
+    uint8_t *x_data = malloc((TRAIN_ROWS + TEST_ROWS) * NUM_LITERALS * sizeof(uint8_t));
+    int32_t *y_data = malloc((TRAIN_ROWS + TEST_ROWS) * sizeof(int32_t));
+    if (x_data == NULL || y_data == NULL) {
+        fprintf(stderr, "Failed to allocate memory for x_data or y_data\n");
+        return 1;
+    }
+    printf("Loading MNIST data\n");
+    load_mnist_data(x_data, y_data);
+
+    uint8_t *x_train = x_data;
+    int32_t *y_train = y_data;
+    uint8_t *x_test = x_data + TRAIN_ROWS * NUM_LITERALS;
+    int32_t *y_test = y_data + TRAIN_ROWS;
+    double start;
+
+    // Dense: serial, hogwild (rows split across threads), clause-parallel (clauses split across threads)
+    for (int mode = 0; mode < 3; mode++) {
+        struct TsetlinMachine *tm = create_tm();
+        if (tm == NULL) {
+            perror("tm_create failed");
+            return 1;
+        }
+
+        start = wall_time();
+        if (mode == 0) {
+            printf("\nTsetlin Machine, tm_train\n");
+            tm_train(tm, x_train, y_train, TRAIN_ROWS, EPOCHS);
+        }
+        else if (mode == 1) {
+            printf("\nTsetlin Machine, tm_train_parallel\n");
+            tm_train_parallel(tm, x_train, y_train, TRAIN_ROWS, EPOCHS, num_threads);
+        }
+        else {
+            printf("\nTsetlin Machine, tm_train_clause_parallel\n");
+            tm_train_clause_parallel(tm, x_train, y_train, TRAIN_ROWS, EPOCHS, num_threads);
+        }
+        printf("Training time: %f[s]\n", wall_time() - start);
+        tm_evaluate(tm, x_test, y_test, TEST_ROWS);
+        tm_free(tm);
+    }
+
+    // Sparse: serial, hogwild
+    for (int mode = 0; mode < 2; mode++) {
+        struct SparseTsetlinMachine *stm = create_stm();
+        if (stm == NULL) {
+            perror("stm_create failed");
+            return 1;
+        }
+
+        start = wall_time();
+        if (mode == 0) {
+            printf("\nSparse Tsetlin Machine, stm_train\n");
+            stm_train(stm, x_train, y_train, TRAIN_ROWS, EPOCHS);
+        }
+        else {
+            printf("\nSparse Tsetlin Machine, stm_train_parallel\n");
+            stm_train_parallel(stm, x_train, y_train, TRAIN_ROWS, EPOCHS, num_threads);
+        }
+        printf("Training time: %f[s]\n", wall_time() - start);
+        stm_evaluate(stm, x_test, y_test, TEST_ROWS);
+        stm_free(stm);
+    }
+
+    free(x_data);
+    free(y_data);
+    return 0;
+}
@@ -4,6 +4,7 @@
 
 
 // A very fast, simple PRNG using xorshift32
+// All state lives in the struct (no globals), so threads with their own FastPRNG never touch shared memory
 struct FastPRNG {
 	uint32_t state;
 };
@@ -16,3 +17,29 @@ uint32_t prng_next_uint32(struct FastPRNG* prng);
 
 // Generate a pseudo-random float [0, 1)
 float prng_next_float(struct FastPRNG* prng);
+
+// Generate 64 pseudo-random bits, each set with probability (threshold + 1) / 2^32
+// Same as 64 comparisons prng_next_uint32() <= threshold, but far fewer random words are drawn
+uint64_t prng_next_mask(struct FastPRNG* prng, uint32_t threshold);
+
+// Threshold for prng_next_mask, so that each bit is set with probability p (clamped to [0, 1])
+uint32_t prng_mask_threshold(float p);
+
+// Generate the number of failures before the first success, for independent trials with success probability p
+// Used to jump straight to the next rare event instead of drawing a number per trial
+// scale comes from prng_geometric_scale(p), UINT32_MAX if p is 0
+uint32_t prng_next_geometric(struct FastPRNG* prng, float scale);
+
+// Scale for prng_next_geometric == 1 / log2(1 - p)
+float prng_geometric_scale(float p);
+
+// Index of the next success at or after position, for trials with success probability p (scale from prng_geometric_scale)
+// Saturates at UINT32_MAX, so loops can step with prng_next_event(prng, scale, position + 1) until they pass their end
+uint32_t prng_next_event(struct FastPRNG* prng, float scale, uint32_t position);
+
+// Below this probability, drawing the gaps between events (prng_next_event) is cheaper than one draw per trial
+#define PRNG_SKIP_SAMPLING_MAX_P 0.0625f
+
+// Shuffle array in place (Fisher-Yates), every permutation equally likely up to the PRNG quality
+// array shape: (size)
+void prng_shuffle(struct FastPRNG* prng, uint32_t *array, uint32_t size);
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+// --- Parallel jobs ---
+// Every *_parallel function splits its work into independent jobs and runs them here, one worker thread per job
+
+// Call run(job) for each of the num_jobs jobs laid out every job_size bytes from jobs, each on its own thread
+// The calling thread takes the first job itself, jobs whose thread can't be started run on the calling thread,
+// and if memory allocation fails, all jobs run one after another on the calling thread
+// Returns once every job is done
+void run_parallel_jobs(void (*run)(void *job), void *jobs, size_t job_size, uint32_t num_jobs);
+
+// Call run(arg, clause_start, clause_end) on ranges covering clauses 0 .. num_clauses - 1,
+// split evenly across num_threads worker threads (0 - one per online CPU core)
+// Model conversions (stm_from_dense, sltm_from_sparse, etc.) work on each clause independently, so they run this way
+// If memory allocation fails, run is called once with all clauses
+void run_clause_ranges(
+    void (*run)(void *arg, uint32_t clause_start, uint32_t clause_end), void *arg, uint32_t num_clauses, uint32_t num_threads
+);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+// --- Posting lists ---
+// Literal -> clause inverted index of the included TAs, for inference on rows with few literals set (e.g., bag-of-words)
+// Clauses including TA ta_id (2 * literal_id, + 1 if negated) are posting_clauses[posting_offsets[ta_id] .. posting_offsets[ta_id + 1] - 1]
+// A clause is then evaluated only through the postings of the literals set in the row, instead of walking its own literals
+
+// A row goes through the posting lists if they are estimated to cost at most 1 / POSTING_MAX_COST_FRACTION of walking
+// the literals of every clause (all postings, since clause walks rarely stop early on sparse rows)
+// Posting list cost: scan the row 8 literals at a time + postings of its literals + a pass over the clauses
+#define POSTING_MAX_COST_FRACTION 2
+
+// Estimated cost of evaluating a row (with no literal set) through the posting lists
+size_t posting_base_cost(uint32_t num_literals, uint32_t num_clauses);
+
+// Ids of the literals set in X_row (in order), returns how many there are
+uint32_t collect_row_literals(const uint8_t *X_row, uint32_t num_literals, uint32_t *row_literals);
+
+// Same as collect_row_literals, but only while the postings of the collected literals' TAs (positive and negated)
+// add up to at most max_postings
+// Returns 0 as soon as they don't (row_literals is then incomplete), 1 otherwise
+// *num_postings is increased by the postings of the collected literals
+uint8_t collect_row_literals_budget(
+    const uint8_t *X_row, uint32_t num_literals, const uint32_t *posting_offsets, size_t max_postings,
+    uint32_t *row_literals, uint32_t *num_row_literals, size_t *num_postings
+);
+
+// clause_hits[clause_id] = number of included positive literals of the clause set in the row,
+// or UINT32_MAX if any of its included negated literals is set
+// A non-empty clause is active iff its clause_hits equals its number of included positive literals
+// clause_hits shape: (num_clauses)
+void count_posting_hits(
+    const uint32_t *posting_offsets, const uint32_t *posting_clauses, const uint32_t *row_literals, uint32_t num_row_literals,
+    uint32_t num_clauses, uint32_t *clause_hits
+);
+
+// Turn per-TA posting counts into offsets: counts come in posting_offsets[ta_id + 1], posting_offsets[0] must be 0
+void posting_counts_to_offsets(uint32_t *posting_offsets, uint32_t num_tas);
+
+// After posting_clauses[posting_offsets[ta_id]++] = clause_id was used to fill the lists, shift the offsets back
+void posting_offsets_restore(uint32_t *posting_offsets, uint32_t num_tas);
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+
+
+// --- SIMD kernels ---
+// Hot loops shared by the Tsetlin Machine variants, with a scalar fallback and AVX2 / AVX-512 versions
+// The best version supported by the CPU is picked once at startup (CPUID), so one binary runs everywhere
+
+enum SimdLevel {
+    SIMD_SCALAR = 0,
+    SIMD_AVX2 = 1,
+    SIMD_AVX512 = 2,
+};
+
+struct SimdKernels {
+    enum SimdLevel level;
+
+    // Clause outputs from packed include masks and a packed input row (see tm_predict)
+    // include, include_negated shape: flat (num_clauses, mask_row_size)
+    // include_count shape: (num_clauses) - included TAs per clause, clauses with 0 are skipped as empty
+    // X_packed shape: (mask_row_size)
+    // clause_output shape: ((num_clauses - 1) / 64 + 1) bitmap, bit clause_id % 64 of word clause_id / 64
+    // is set if the clause is non-empty and no included literal is falsified, padding bits are 0
+    void (*packed_clause_output)(
+        const uint64_t *include, const uint64_t *include_negated, const uint32_t *include_count, const uint64_t *X_packed,
+        uint32_t num_clauses, uint32_t mask_row_size, uint64_t *clause_output
+    );
+
+    // Clause outputs from the included TA ids of each clause and an unpacked input row (see sltm_predict)
+    // A clause stops at its first falsified TA (ta_id % 2 == X[ta_id / 2])
+    // ta_ids shape: (clause_offsets[num_clauses]) of id_size bytes - sizeof(uint16_t) or sizeof(uint32_t),
+    // the TAs of clause clause_id are ta_ids[clause_offsets[clause_id] .. clause_offsets[clause_id + 1] - 1]
+    // X shape: (num_literals), every ta_id / 2 must be below num_literals
+    // clause_output shape: ((num_clauses - 1) / 64 + 1) bitmap, same as packed_clause_output (empty clauses are 0)
+    void (*id_clause_output)(
+        const void *ta_ids, uint8_t id_size, const uint32_t *clause_offsets, uint32_t num_clauses,
+        const uint8_t *X, uint32_t num_literals, uint64_t *clause_output
+    );
+
+    // Output of one clause given as a contiguous list of packed 32 bit TA nodes (see stm_predict),
+    // ta_id in bits 0 .. 23 and int8 ta_state in bits 24 .. 31
+    // Returns 0 at the first falsified TA among the included ones (ta_state >= mid_state), 1 if there is none
+    // nodes shape: (num_nodes) of 4 bytes
+    uint8_t (*node_clause_output)(const void *nodes, uint32_t num_nodes, const uint8_t *X, uint32_t num_literals, int8_t mid_state);
+
+    // Sum up the weights of active clauses for each class, then clip the votes to [-threshold, threshold]
+    // Returns the index of the first class with the highest vote (same as the *_oa_class_idx functions)
+    // clause_output shape: (num_clauses)
+    // weights shape: flat (num_clauses, num_classes)
+    // votes shape: (num_classes)
+    uint32_t (*sum_votes)(
+        const uint8_t *clause_output, const int16_t *weights,
+        uint32_t num_clauses, uint32_t num_classes, int32_t threshold, int32_t *votes
+    );
+
+    // Same as sum_votes, but only visits the set bits of a clause_output bitmap
+    // clause_output shape: ((num_clauses - 1) / 64 + 1) bitmap, padding bits must be 0
+    uint32_t (*sum_votes_bitmap)(
+        const uint64_t *clause_output, const int16_t *weights,
+        uint32_t num_clauses, uint32_t num_classes, int32_t threshold, int32_t *votes
+    );
+
+    // Add one clause's weight row to votes (no clipping)
+    // clause_weights, votes shape: (num_classes)
+    void (*add_weights)(int32_t *votes, const int16_t *clause_weights, uint32_t num_classes);
+
+    // Clip votes in place to [-threshold, threshold], returns the index of the first class with the highest vote
+    // votes shape: (num_classes)
+    uint32_t (*clip_votes)(int32_t *votes, uint32_t num_classes, int32_t threshold);
+
+    // One feedback step on the TAs of a clause, driven by bitmaps (bit ta_id % 64 of word ta_id / 64)
+    // ta_state[ta_id] += 1 if its increment bit is set and ta_state[ta_id] < increment_below
+    // ta_state[ta_id] -= 1 if its decrement bit is set and ta_state[ta_id] > decrement_above
+    // Returns the number of TAs with action 1 (state >= mid_state) afterwards
+    // If flipped is not NULL, bit ta_id is set there if the action of TA ta_id changed, so callers can patch derived masks
+    // ta_state shape: (num_tas)
+    // increment, decrement, flipped shape: ((num_tas - 1) / 64 + 1) - bits must not overlap, NULL if none are set
+    uint32_t (*update_states)(
+        int8_t *ta_state, const uint64_t *increment, const uint64_t *decrement, uint32_t num_tas,
+        int8_t increment_below, int8_t decrement_above, int8_t mid_state, uint64_t *flipped
+    );
+};
+
+// Currently selected kernels, use these instead of calling a specific implementation
+extern struct SimdKernels simd_kernels;
+
+// Highest SIMD level supported by this CPU
+enum SimdLevel simd_detect_level(void);
+
+// Force a SIMD level (e.g., for testing or benchmarking)
+// Returns 0 and keeps the current kernels if the CPU does not support it, 1 otherwise
+uint8_t simd_set_level(enum SimdLevel level);
@@ -1,19 +1,63 @@
 #pragma once
 
 #include <stdint.h>
+#include <pthread.h>
 #include "fast_prng.h"
+#include "tsetlin_machine.h"
 
 
 // --- Sparse Tsetlin Machine ---
 
-// Linked list node for Tsetlin Automaton states
+// Tsetlin Automaton state, only TAs at or above sparse_min_state are stored
+// ta_id and ta_state share one 32 bit word (4 bytes per node instead of 8), so ta_id is limited to STM_MAX_TA_ID
+#define STM_MAX_TA_ID ((1u << 24) - 1)
 struct TAStateNode {
-	uint32_t ta_id;
+    uint32_t ta_id : 24;
     int8_t ta_state;
-    struct TAStateNode *next;
 };
-void ta_state_insert(struct TAStateNode **head_ptr, struct TAStateNode *prev, uint32_t ta_id, uint8_t ta_state, struct TAStateNode **result);
-void ta_state_remove(struct TAStateNode **head_ptr, struct TAStateNode *prev, struct TAStateNode **result);
+
+// Node of models with more than (STM_MAX_TA_ID + 1) / 2 literals (8 bytes), also the unpacked form of any node
+struct TAStateNodeWide {
+    uint32_t ta_id;
+    int8_t ta_state;
+};
+
+// TA states of one clause, sorted by ta_id
+// Nodes are contiguous, so clauses are walked linearly instead of chasing pointers,
+// and capacity grows geometrically, so inserts rarely allocate and removals never free
+// All lists of a model hold the same node type, node_size picked by stm_create from num_literals:
+// sizeof(struct TAStateNode) or sizeof(struct TAStateNodeWide)
+struct TAStateList {
+    void *nodes;  // shape: (capacity) of node_size bytes, nodes 0 .. size - 1 are used
+    uint32_t size, capacity;
+};
+
+// Make room for at least capacity nodes
+// Returns 0 (list unchanged) if memory allocation failed, 1 otherwise
+uint8_t ta_state_reserve(struct TAStateList *list, uint32_t capacity, uint8_t node_size);
+// Insert a new node at position (0 .. size), nodes from position on move one place up
+void ta_state_insert(struct TAStateList *list, uint32_t position, uint32_t ta_id, int8_t ta_state, uint8_t node_size);
+// Remove the node at position, nodes after it move one place down
+void ta_state_remove(struct TAStateList *list, uint32_t position, uint8_t node_size);
+
+// Read node node_id of list, of either node type
+static inline struct TAStateNodeWide ta_state_get(const struct TAStateList *list, uint32_t node_id, uint8_t node_size) {
+    if (node_size == sizeof(struct TAStateNode)) {
+        struct TAStateNode node = ((const struct TAStateNode *)list->nodes)[node_id];
+        return (struct TAStateNodeWide){.ta_id = node.ta_id, .ta_state = node.ta_state};
+    }
+    return ((const struct TAStateNodeWide *)list->nodes)[node_id];
+}
+
+// Write node node_id of list, of either node type
+static inline void ta_state_set(struct TAStateList *list, uint32_t node_id, struct TAStateNodeWide node, uint8_t node_size) {
+    if (node_size == sizeof(struct TAStateNode)) {
+        ((struct TAStateNode *)list->nodes)[node_id] = (struct TAStateNode){.ta_id = node.ta_id, .ta_state = node.ta_state};
+    }
+    else {
+        ((struct TAStateNodeWide *)list->nodes)[node_id] = node;
+    }
+}
 
 // Don't create, modify or free this struct directly, use stm_create, stm_free, etc.
 struct SparseTsetlinMachine {
@@ -31,18 +75,50 @@ struct SparseTsetlinMachine {
     void (*calculate_feedback)(struct SparseTsetlinMachine *stm, const uint8_t *X, const void *y);
 
     int8_t mid_state;
-    uint8_t al_row_size;  // binary num_literals + padding == (num_literals - 1) / 8 + 1
+    uint32_t al_row_size;  // binary num_literals + padding == (num_literals - 1) / 8 + 1
     float s_inv, s_min1_inv;
-    struct TAStateNode **ta_state;  // shape: (num_clauses) linked list pointers
+    float s_inv_geometric_scale;  // s_inv as a prng_next_geometric scale, 1/s events are skip-sampled
+    struct TAStateList *ta_state;  // shape: (num_clauses)
+    uint8_t node_size;  // sizeof(struct TAStateNode), or sizeof(struct TAStateNodeWide) if num_literals > (STM_MAX_TA_ID + 1) / 2
     uint8_t *active_literals;  // shape: flat padded binary (num_classes, al_row_size)
     int16_t *weights;  // shape: flat (num_clauses, num_classes)
     uint8_t *clause_output;  // shape: (num_clauses)
     int32_t *votes;  // shape: (num_classes)
+    uint32_t *clause_include_count;  // shape: (num_clauses) - nodes with action 1 per clause, kept in sync by feedback
+    pthread_mutex_t *clause_locks;  // shape: (num_clauses) - guard the TA lists while stm_train_parallel runs, NULL otherwise
+
+    // Literal -> clause posting lists of the included TAs, for inference (see stm_update_posting_lists)
+    // Clauses including TA ta_id are posting_clauses[posting_offsets[ta_id] .. posting_offsets[ta_id + 1] - 1]
+    // All NULL if not built (then every row is evaluated by walking the TA lists)
+    uint32_t *posting_offsets;  // shape: (2 * num_literals + 1)
+    uint32_t *posting_clauses;  // shape: (posting_offsets[2 * num_literals])
+    uint32_t *clause_positive_count;  // shape: (num_clauses) - included positive literals (even ta_id) per clause
+    uint32_t *clause_hits;  // shape: (num_clauses) - scratch for posting list evaluation
+    uint32_t *row_literals;  // shape: (num_literals) - scratch, ids of the literals set in the current row
+    uint32_t num_row_literals;
+    const uint8_t *row_literals_X;  // row that row_literals were collected from during training, NULL if none
 
     struct FastPRNG rng;
 };
 
 
+// Per-caller scratch memory for stm_predict_context
+// Don't create, modify or free this struct directly, use stm_context_create, stm_context_free
+struct SparseTsetlinMachineContext {
+    struct SparseTsetlinMachine view;  // shallow copy of the model, pointing at the scratch buffers below
+    uint8_t *clause_output;  // shape: (num_clauses)
+    int32_t *votes;  // shape: (num_classes)
+    uint32_t *clause_hits;  // shape: (num_clauses)
+    uint32_t *row_literals;  // shape: (num_literals)
+};
+
+// Create an inference context sized for the given model
+struct SparseTsetlinMachineContext *stm_context_create(const struct SparseTsetlinMachine *stm);
+
+// Free the context and its scratch buffers
+void stm_context_free(struct SparseTsetlinMachineContext *ctx);
+
+
 // X shape: flat (rows, num_literals) of uint8_t (each uint8_t should be 0 or 1)
 // y shape: flat (rows, y_size) with element size (y_element_size) of any type (void *)
 // y_pred shape: flat (rows, num_classes) with element size (y_element_size) of any type (void *)
@@ -51,7 +127,8 @@ struct SparseTsetlinMachine {
  * 
  * num_classes: number of classes to predict
  * threshold: threshold for clause votes
- * num_literals: number of literals (features) in the input data
+ * num_literals: number of literals (features) in the input data, at most UINT32_MAX / 2
+ *   (above (STM_MAX_TA_ID + 1) / 2 the TA lists hold 8 byte nodes instead of 4 byte ones)
  * num_clauses: number of clauses in the Tsetlin Machine
  * max_state: maximum state value for a Tsetlin Automaton (default 127)
  * min_state: minimum state value for a Tsetlin Automaton (default -127)
@@ -68,10 +145,25 @@ struct SparseTsetlinMachine *stm_create(
 );
 
 // Load Tsetlin Machine from a bin file
+// The dense states are streamed clause by clause, so the whole dense model is never held in memory
 struct SparseTsetlinMachine *stm_load_dense(
     const char *filename, uint32_t y_size, uint32_t y_element_size
 );
 
+// Convert a dense Tsetlin Machine in memory, without a file round trip (e.g., to keep training a thinned out model sparse)
+// TAs at or above sparse_min_state are kept with their states, y_size, y_element_size and the random stream continue from tm,
+// active literals start empty as after stm_load_dense, output activation and feedback are the defaults
+// Clauses are split across num_threads worker threads (0 - one per online CPU core)
+// The result doesn't reference tm, which can be freed or trained further
+struct SparseTsetlinMachine *stm_from_dense(const struct TsetlinMachine *tm, uint32_t num_threads);
+
+// Convert a sparse Tsetlin Machine back into a dense one, in memory
+// TAs missing from the lists get state sparse_min_state - 1 (at least min_state), so they stay excluded,
+// predictions don't change and training continues with the random stream of stm
+// Clauses are split across num_threads worker threads (0 - one per online CPU core)
+// The result doesn't reference stm, which can be freed or trained further
+struct TsetlinMachine *stm_to_dense(const struct SparseTsetlinMachine *stm, uint32_t num_threads);
+
 // Save Tsetlin Machine to a bin file
 void stm_save(const struct SparseTsetlinMachine *stm, const char *filename);
 
@@ -80,17 +172,59 @@ void stm_save(const struct SparseTsetlinMachine *stm, const char *filename);
 // Remember to set tm to NULL after this call
 void stm_free(struct SparseTsetlinMachine *stm);
 
+// Recount clause_include_count from the TA lists
+// stm_load_dense, stm_from_dense, stm_train* and feedback keep the counts in sync,
+// so this is only needed after modifying the lists directly, before any stm_predict* call
+void stm_update_include_counts(struct SparseTsetlinMachine *stm);
+
+// Rebuild the literal -> clause posting lists from the TA lists
+// Inference evaluates rows with few literals set (e.g., bag-of-words) through them, touching only the postings of those literals
+// Done by stm_load_dense, stm_from_dense and at the end of stm_train*, needed before any stm_predict* call if the lists were modified directly
+// If memory allocation fails, the lists are dropped and inference walks the TA lists instead
+void stm_update_posting_lists(struct SparseTsetlinMachine *stm);
+
 // Train
 // X shape: flat (rows, num_literals) of uint8_t (each uint8_t should be 0 or 1)
 // y shape: flat (rows, y_size) with element size (y_element_size) of any type (void *)
 void stm_train(struct SparseTsetlinMachine *stm, const uint8_t *X, const void *y, uint32_t rows, uint32_t epochs);
 
+// Train on a subset or permutation of the rows, without copying X or y
+// Each epoch trains on rows row_ids[0], row_ids[1], ..., row_ids[num_row_ids - 1] of X and y (repeats are allowed)
+// If shuffle is 1, row_ids is shuffled in place with the model's PRNG before every epoch,
+// so the order is reproducible for the same seed and the array can be reused for the next call
+// X, y shape: as for stm_train, with any number of rows (every row id must be a valid row)
+// row_ids shape: (num_row_ids)
+void stm_train_indexed(
+    struct SparseTsetlinMachine *stm, const uint8_t *X, const void *y, uint32_t *row_ids, uint32_t num_row_ids, uint32_t epochs, uint8_t shuffle
+);
+
+// Hogwild training
+// Same as stm_train, but rows are split evenly across num_threads worker threads (0 - one per online CPU core),
+// each training on its own rows for all epochs with its own random stream and scratch memory
+// Unlike the dense tm_train_parallel, each clause is locked while it's evaluated or updated,
+// since list nodes are inserted and removed by feedback; only active_literals bits may race (a lost bit is set again later),
+// random streams are never shared between threads
+// Results are not reproducible (they depend on thread scheduling) and differ from stm_train
+void stm_train_parallel(struct SparseTsetlinMachine *stm, const uint8_t *X, const void *y, uint32_t rows, uint32_t epochs, uint32_t num_threads);
+
 // Inference
 // Writes to user allocated memory y_pred
 // X shape: flat (rows, num_literals) of uint8_t (each uint8_t should be 0 or 1)
 // y_pred shape: flat (rows, num_classes) with element size (y_element_size) of any type (void *)
 void stm_predict(struct SparseTsetlinMachine *stm, const uint8_t *X, void *y_pred, uint32_t rows);
 
+// Reentrant inference
+// Same as stm_predict, but stm is only read and all scratch memory comes from ctx,
+// so one model can serve many threads at once, each with its own context
+// Uses clause_include_count and the posting lists as last updated by stm_load_dense, stm_from_dense, stm_train*,
+// stm_update_include_counts or stm_update_posting_lists
+void stm_predict_context(const struct SparseTsetlinMachine *stm, struct SparseTsetlinMachineContext *ctx, const uint8_t *X, void *y_pred, uint32_t rows);
+
+// Parallel inference
+// Same as stm_predict, but rows are split evenly across num_threads worker threads (0 - one per online CPU core)
+// Output is identical to stm_predict
+void stm_predict_parallel(struct SparseTsetlinMachine *stm, const uint8_t *X, void *y_pred, uint32_t rows, uint32_t num_threads);
+
 // Simple accuracy evaluation
 // X shape: flat (rows, num_literals) of uint8_t (each uint8_t should be 0 or 1)
 // y shape: flat (rows, y_size) with element size (y_element_size) of any type (void *)
@@ -1,17 +1,19 @@
 #pragma once
 
 #include <stdint.h>
+#include "tsetlin_machine.h"
+#include "sparse_tsetlin_machine.h"
 
 
 // --- Stateless (Sparse) Tsetlin Machine ---
 
-// Linked list node for Tsetlin Automaton ids (without state)
-struct TANode {
-	uint32_t ta_id;
-    struct TANode *next;
+// Node of the clause prefix trie (see sltm_update_trie)
+// A node tests one literal, its children test the next literal of the clauses sharing the path to it
+struct StatelessTrieNode {
+    uint32_t ta_id;
+    uint32_t skip;  // first node after this node's subtree, evaluation continues there if the literal is falsified
+    uint32_t clause_start;  // clauses ending at this node are trie_clauses[clause_start .. clause_start of the next node - 1]
 };
-void ta_stateless_insert(struct TANode **head_ptr, struct TANode *prev, uint32_t ta_id, struct TANode **result);
-void ta_stateless_remove(struct TANode **head_ptr, struct TANode *prev, struct TANode **result);
 
 // Don't create, modify or free this struct directly, use sltm_load_dense, stm_free, etc.
 struct StatelessTsetlinMachine {
@@ -29,13 +31,53 @@ struct StatelessTsetlinMachine {
 
     int8_t mid_state;
     float s_inv, s_min1_inv;
-    struct TANode **ta_state;  // shape: (num_clauses) linked list pointers
+    // Included Tsetlin Automaton ids (without state) of all clauses, in compressed sparse row (CSR) form
+    // Clause clause_id includes ta_ids[clause_offsets[clause_id]] .. ta_ids[clause_offsets[clause_id + 1] - 1]
+    // ta_id is 2 * literal_id for a positive literal, 2 * literal_id + 1 for a negated one
+    // Ids are stored in as few bytes as the model shape allows: uint16_t if 2 * num_literals <= 65536, uint32_t otherwise
+    uint8_t ta_id_size;  // sizeof(uint16_t) or sizeof(uint32_t)
+    uint32_t *clause_offsets;  // shape: (num_clauses + 1) - a clause is empty (never active) if its offsets are equal
+    void *ta_ids;  // shape: (clause_offsets[num_clauses]) of ta_id_size bytes - sorted within each clause, or in sltm_calibrate order
     int16_t *weights;  // shape: flat (num_clauses, num_classes)
-    uint8_t *clause_output;  // shape: (num_clauses)
+    uint64_t *clause_output;  // shape: ((num_clauses - 1) / 64 + 1) - bitmap, bit clause_id % 64 of word clause_id / 64
     int8_t *feedback;  // shape: flat (num_clauses, num_classes, 3) - clause-class feedback type strengths: 1a, 1b, 2
     int32_t *votes;  // shape: (num_classes)
+
+    // Literal -> clause posting lists, for rows with few literals set (see sltm_update_posting_lists)
+    // Clauses including TA ta_id are posting_clauses[posting_offsets[ta_id] .. posting_offsets[ta_id + 1] - 1]
+    // All NULL if not built (then every row is evaluated by walking the TA lists)
+    uint32_t *posting_offsets;  // shape: (2 * num_literals + 1)
+    uint32_t *posting_clauses;  // shape: (posting_offsets[2 * num_literals])
+    uint32_t *clause_positive_count;  // shape: (num_clauses) - positive literals (even ta_id) per clause
+    uint32_t *clause_hits;  // shape: (num_clauses) - scratch for posting list evaluation
+    uint32_t *row_literals;  // shape: (num_literals) - scratch, ids of the literals set in the current row
+
+    // Prefix trie of the sorted clause literal lists, for rows evaluated literal by literal (see sltm_update_trie)
+    // Nodes are in preorder, so a literal shared by many clauses is tested once and a falsified one skips its whole subtree
+    // All NULL (then every clause is walked on its own) until sltm_update_trie is called
+    struct StatelessTrieNode *trie_nodes;  // shape: (num_trie_nodes + 1) - the last one only holds the end of trie_clauses
+    uint32_t *trie_clauses;  // shape: (non-empty clauses) - clause ids in the order their nodes end
+    uint32_t num_trie_nodes;
+    uint32_t trie_depth;  // longest clause, the deepest path
+};
+
+
+// Per-caller scratch memory for sltm_predict_context
+// Don't create, modify or free this struct directly, use sltm_context_create, sltm_context_free
+struct StatelessTsetlinMachineContext {
+    struct StatelessTsetlinMachine view;  // shallow copy of the model, pointing at the scratch buffers below
+    uint64_t *clause_output;  // shape: ((num_clauses - 1) / 64 + 1)
+    int32_t *votes;  // shape: (num_classes)
+    uint32_t *clause_hits;  // shape: (num_clauses)
+    uint32_t *row_literals;  // shape: (num_literals)
 };
 
+// Create an inference context sized for the given model
+struct StatelessTsetlinMachineContext *sltm_context_create(const struct StatelessTsetlinMachine *sltm);
+
+// Free the context and its scratch buffers
+void sltm_context_free(struct StatelessTsetlinMachineContext *ctx);
+
 
 // X shape: flat (rows, num_literals) of uint8_t (each uint8_t should be 0 or 1)
 // y shape: flat (rows, y_size) with element size (y_element_size) of any type (void *)
@@ -43,6 +85,7 @@ struct StatelessTsetlinMachine {
 
 // Don't use this function directly, there is no point since it can't be trained
 // Instead use sltm_load_dense to load (and prune) a pre-trained Tsetlin Machine from a bin file
+// or sltm_from_dense / sltm_from_sparse to convert one in memory
 struct StatelessTsetlinMachine *sltm_create(
     uint32_t num_classes, uint32_t threshold, uint32_t num_literals, uint32_t num_clauses,
     int8_t max_state, int8_t min_state, uint8_t boost_true_positive_feedback, 
@@ -50,10 +93,18 @@ struct StatelessTsetlinMachine *sltm_create(
 );
 
 // Load Tsetlin Machine from a bin file
+// The dense states are streamed clause by clause, so the whole dense model is never held in memory
 struct StatelessTsetlinMachine *sltm_load_dense(
     const char *filename, uint32_t y_size, uint32_t y_element_size
 );
 
+// Convert a trained dense or sparse Tsetlin Machine in memory, without a file round trip (e.g., to publish a serving snapshot)
+// Same clauses as sltm_load_dense of the saved model, y_size and y_element_size are taken from the source
+// Clauses are split across num_threads worker threads (0 - one per online CPU core)
+// The result doesn't reference the source, which can be freed or trained further
+struct StatelessTsetlinMachine *sltm_from_dense(const struct TsetlinMachine *tm, uint32_t num_threads);
+struct StatelessTsetlinMachine *sltm_from_sparse(const struct SparseTsetlinMachine *stm, uint32_t num_threads);
+
 // Save Tsetlin Machine to a bin file
 void sltm_save(const struct StatelessTsetlinMachine *sltm, const char *filename);
 
@@ -62,12 +113,57 @@ void sltm_save(const struct StatelessTsetlinMachine *sltm, const char *filename)
 // Remember to set tm to NULL after this call
 void sltm_free(struct StatelessTsetlinMachine *sltm);
 
+// Replace the clauses with the given included TA ids, and rebuild the posting lists
+// Clause clause_id includes ta_ids[clause_offsets[clause_id]] .. ta_ids[clause_offsets[clause_id + 1] - 1] (sorted, each < 2 * num_literals)
+// clause_offsets shape: (num_clauses + 1), clause_offsets[0] == 0
+// ta_ids shape: (clause_offsets[num_clauses])
+// Returns 0 (clauses unchanged) if memory allocation failed, 1 otherwise
+uint8_t sltm_set_clauses(struct StatelessTsetlinMachine *sltm, const uint32_t *clause_offsets, const uint32_t *ta_ids);
+
+// Rebuild the literal -> clause posting lists from the TA lists
+// Inference evaluates rows with few literals set (e.g., bag-of-words) through them, touching only the postings of those literals
+// Done by sltm_load_dense, sltm_from_dense, sltm_from_sparse and sltm_set_clauses
+// If memory allocation fails, the lists are dropped and inference walks the TA lists instead
+void sltm_update_posting_lists(struct StatelessTsetlinMachine *sltm);
+
+// Compact the clauses without changing any prediction
+// Clauses with the same literals are merged into one by summing their weight rows (unless a sum would overflow int16_t),
+// then empty clauses and clauses with all weights 0 are dropped (at least one clause is always kept)
+// Clause ids change and the posting lists are rebuilt, contexts created before must be recreated
+// Returns the number of clauses removed (0 if memory allocation failed, then nothing changes)
+uint32_t sltm_compact(struct StatelessTsetlinMachine *sltm);
+
+// Build (or rebuild) the clause prefix trie from the clauses
+// Rows that don't go through the posting lists (one by one or bit-sliced in blocks) are then evaluated through it,
+// with the same outputs as walking each clause
+// Opt-in, since it takes 12 bytes per node (up to one per included TA) on top of the clauses: nothing builds it by default,
+// sltm_set_clauses and sltm_compact rebuild it only if it was built
+// If memory allocation fails, the trie is dropped and every clause is walked on its own
+void sltm_update_trie(struct StatelessTsetlinMachine *sltm);
+
+// Reorder the included literals of each clause, most frequent falsifier first
+// Clause evaluation stops at the first falsified literal, so on skewed inputs fewer literals are checked
+// Frequencies are counted on the sample X (e.g., a part of the training data), predictions don't change
+// A built trie is rebuilt in the new order
+// X shape: flat (rows, num_literals) of uint8_t (each uint8_t should be 0 or 1)
+void sltm_calibrate(struct StatelessTsetlinMachine *sltm, const uint8_t *X, uint32_t rows);
+
 // Inference
 // Writes to user allocated memory y_pred
 // X shape: flat (rows, num_literals) of uint8_t (each uint8_t should be 0 or 1)
 // y_pred shape: flat (rows, num_classes) with element size (y_element_size) of any type (void *)
 void sltm_predict(struct StatelessTsetlinMachine *sltm, const uint8_t *X, void *y_pred, uint32_t rows);
 
+// Reentrant inference
+// Same as sltm_predict, but sltm is only read and all scratch memory comes from ctx,
+// so one model can serve many threads at once, each with its own context
+void sltm_predict_context(const struct StatelessTsetlinMachine *sltm, struct StatelessTsetlinMachineContext *ctx, const uint8_t *X, void *y_pred, uint32_t rows);
+
+// Parallel inference
+// Same as sltm_predict, but rows are split evenly across num_threads worker threads (0 - one per online CPU core)
+// Output is identical to sltm_predict
+void sltm_predict_parallel(struct StatelessTsetlinMachine *sltm, const uint8_t *X, void *y_pred, uint32_t rows, uint32_t num_threads);
+
 // Simple accuracy evaluation
 // X shape: flat (rows, num_literals) of uint8_t (each uint8_t should be 0 or 1)
 // y shape: flat (rows, y_size) with element size (y_element_size) of any type (void *)
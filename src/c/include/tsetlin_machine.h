@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include "fast_prng.h"
 
@@ -23,14 +24,53 @@ struct TsetlinMachine {
 
 	int8_t mid_state;
     float s_inv, s_min1_inv;
-	int8_t *ta_state;  // shape: flat (num_clauses, num_literals, 2)
+	int8_t *ta_state;  // shape: flat (num_clauses, 2, ta_plane_size) - positive literal plane, then negated literal plane
+    uint32_t ta_plane_size;  // states per literal plane == mask_row_size * 64, padding states stay at min_state
 	int16_t *weights;  // shape: flat (num_clauses, num_classes)
 	uint8_t *clause_output;  // shape: (num_clauses)
     int32_t *votes;  // shape: (num_classes)
+    uint32_t *clause_include_count;  // shape: (num_clauses) - TAs with action 1 per clause, kept in sync by feedback
+
+    // Bit-parallel feedback, TAs of a clause are updated 64 at a time from random bitmaps (see type_1a_feedback)
+    uint32_t s_inv_threshold;  // s_inv as a prng_next_mask threshold
+    float s_inv_geometric_scale;  // s_inv as a prng_next_geometric scale, rare 1/s events are skip-sampled for large s
+    uint32_t ta_mask_size;  // 64-bit words per clause TA bitmap == 2 * mask_row_size, bit i is TA ta_state[clause start + i]
+    const uint8_t *X_ta_row;  // training row currently expanded into X_ta_packed, NULL if none
+    uint64_t *X_ta_packed;  // shape: flat (2, ta_mask_size) - bit set if the literal of the TA is true / false
+    uint64_t *feedback_mask;  // shape: flat (3, ta_mask_size) - increment / decrement / action flip bitmaps of one clause
+
+    // Packed include masks, derived from ta_state (see tm_update_include_masks) and kept in sync by feedback during training
+    uint32_t mask_row_size;  // 64-bit words per packed literal row == (num_literals - 1) / 64 + 1
+    uint64_t *include_mask;  // shape: flat (num_clauses, mask_row_size) - bit per positive literal TA action
+    uint64_t *include_negated_mask;  // shape: flat (num_clauses, mask_row_size) - bit per negative literal TA action
+    uint64_t *X_packed;  // shape: (mask_row_size) - one input row packed to bits
+    uint64_t *clause_output_packed;  // shape: ((num_clauses - 1) / 64 + 1) - clause_output as a bitmap, inference only
 
     struct FastPRNG rng;
 };
 
+// Index into ta_state of the TA of literal literal_id in clause clause_id (negated: 0 - positive, 1 - negated literal)
+// The bin and fbs files keep the interleaved (num_clauses, num_literals, 2) layout, tm_load* and tm_save* convert
+static inline size_t tm_ta_state_index(const struct TsetlinMachine *tm, uint32_t clause_id, uint32_t literal_id, uint8_t negated) {
+    return ((((size_t)clause_id * 2) + negated) * tm->ta_plane_size) + literal_id;
+}
+
+
+// Per-caller scratch memory for tm_predict_context
+// Don't create, modify or free this struct directly, use tm_context_create, tm_context_free
+struct TsetlinMachineContext {
+    struct TsetlinMachine view;  // shallow copy of the model, pointing at the scratch buffers below
+    int32_t *votes;  // shape: (num_classes)
+    uint64_t *X_packed;  // shape: (mask_row_size)
+    uint64_t *clause_output_packed;  // shape: ((num_clauses - 1) / 64 + 1)
+};
+
+// Create an inference context sized for the given model
+struct TsetlinMachineContext *tm_context_create(const struct TsetlinMachine *tm);
+
+// Free the context and its scratch buffers
+void tm_context_free(struct TsetlinMachineContext *ctx);
+
 
 // X shape: flat (rows, num_literals) of uint8_t (each uint8_t should be 0 or 1)
 // y shape: flat (rows, y_size) with element size (y_element_size) of any type (void *)
@@ -77,17 +117,63 @@ void tm_save_fbs(struct TsetlinMachine *tm, const char *filename);
 // Remember to set tm to NULL after this call
 void tm_free(struct TsetlinMachine *tm);
 
+// Re-derive the packed include masks and clause_include_count from ta_state
+// tm_create, tm_load*, tm_train* and feedback keep them in sync, so this is only needed after modifying ta_state directly,
+// before any tm_predict* call
+void tm_update_include_masks(struct TsetlinMachine *tm);
+
 // Train
 // X shape: flat (rows, num_literals) of uint8_t (each uint8_t should be 0 or 1)
 // y shape: flat (rows, y_size) with element size (y_element_size) of any type (void *)
 void tm_train(struct TsetlinMachine *tm, const uint8_t *X, const void *y, uint32_t rows, uint32_t epochs);
 
+// Train on a subset or permutation of the rows, without copying X or y
+// Each epoch trains on rows row_ids[0], row_ids[1], ..., row_ids[num_row_ids - 1] of X and y (repeats are allowed)
+// If shuffle is 1, row_ids is shuffled in place with the model's PRNG before every epoch,
+// so the order is reproducible for the same seed and the array can be reused for the next call
+// X, y shape: as for tm_train, with any number of rows (every row id must be a valid row)
+// row_ids shape: (num_row_ids)
+void tm_train_indexed(
+    struct TsetlinMachine *tm, const uint8_t *X, const void *y, uint32_t *row_ids, uint32_t num_row_ids, uint32_t epochs, uint8_t shuffle
+);
+
+// Hogwild training
+// Same as tm_train, but rows are split evenly across num_threads worker threads (0 - one per online CPU core),
+// each training on its own rows for all epochs with its own random stream and scratch memory
+// ta_state and weights are shared and updated without locks, so concurrent updates of the same clause
+// may occasionally overwrite each other - harmless for the small saturating steps of TM feedback
+// Only model state races, random streams are never shared between threads
+// Results are not reproducible (they depend on thread scheduling) and differ from tm_train
+void tm_train_parallel(struct TsetlinMachine *tm, const uint8_t *X, const void *y, uint32_t rows, uint32_t epochs, uint32_t num_threads);
+
+// Clause-parallel training
+// Same as tm_train, but the clauses are split across num_threads worker threads (0 - one per online CPU core),
+// each evaluating and updating its own clauses with its own random stream, rows are still processed in order
+// Pays off for models with many clauses, threads synchronize twice per row
+// Results don't match tm_train (different random streams), but are the same for the same seed and num_threads
+// Only tm_feedback_class_idx and tm_feedback_bin_vector are supported, other feedback functions fall back to tm_train
+void tm_train_clause_parallel(
+    struct TsetlinMachine *tm, const uint8_t *X, const void *y, uint32_t rows, uint32_t epochs, uint32_t num_threads
+);
+
 // Inference
 // Writes to user allocated memory y_pred
+// Clause outputs are evaluated on the bit-packed include masks (see tm_update_include_masks)
 // X shape: flat (rows, num_literals) of uint8_t (each uint8_t should be 0 or 1)
 // y_pred shape: flat (rows, num_classes) with element size (y_element_size) of any type (void *)
 void tm_predict(struct TsetlinMachine *tm, const uint8_t *X, void *y_pred, uint32_t rows);
 
+// Reentrant inference
+// Same as tm_predict, but tm is only read and all scratch memory comes from ctx,
+// so one model can serve many threads at once, each with its own context
+// Uses the packed include masks as last updated by tm_create, tm_load*, tm_train* or tm_update_include_masks
+void tm_predict_context(const struct TsetlinMachine *tm, struct TsetlinMachineContext *ctx, const uint8_t *X, void *y_pred, uint32_t rows);
+
+// Parallel inference
+// Same as tm_predict, but rows are split evenly across num_threads worker threads (0 - one per online CPU core)
+// Output is identical to tm_predict
+void tm_predict_parallel(struct TsetlinMachine *tm, const uint8_t *X, void *y_pred, uint32_t rows, uint32_t num_threads);
+
 // Simple accuracy evaluation
 // X shape: flat (rows, num_literals) of uint8_t (each uint8_t should be 0 or 1)
 // y shape: flat (rows, y_size) with element size (y_element_size) of any type (void *)
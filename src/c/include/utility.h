@@ -1,6 +1,8 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
 
 
 static inline int32_t clip(const int32_t x, const int32_t threshold) {
@@ -14,3 +16,34 @@ static inline int32_t clip(const int32_t x, const int32_t threshold) {
        __typeof__ (b) _b = (b); \
      _a < _b ? _a : _b; })
 
+
+// Number of online CPU cores, used when the caller asks for 0 worker threads
+static inline uint32_t default_num_threads(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (uint32_t)n : 1;
+}
+
+
+// --- Dense model loading ---
+// stm_load_dense and sltm_load_dense stream the dense TA states through a buffer of DENSE_LOAD_CHUNK_SIZE bytes,
+// so peak memory is the sparse result plus one chunk, never the whole (num_clauses, 2 * num_literals) state tensor
+#define DENSE_LOAD_CHUNK_SIZE 65536
+
+
+// --- Bit-sliced inference ---
+// Rows are evaluated in blocks of 64, one bit per row, when predicting at least BITSLICE_MIN_ROWS rows
+#define BITSLICE_MIN_ROWS 256
+
+// Transpose a block of up to 64 input rows (0 or 1 per uint8_t) into literal-major bit-slices
+// Bit row of slices[literal_id] is literal literal_id of that row, bits of missing rows stay 0
+static inline void bit_slice_rows(const uint8_t *X, uint32_t block_rows, uint32_t num_literals, uint64_t *slices) {
+    for (uint32_t literal_id = 0; literal_id < num_literals; literal_id++) {
+        slices[literal_id] = 0;
+    }
+    for (uint32_t row = 0; row < block_rows; row++) {
+        const uint8_t *X_row = X + ((size_t)row * num_literals);
+        for (uint32_t literal_id = 0; literal_id < num_literals; literal_id++) {
+            slices[literal_id] |= (uint64_t)(X_row[literal_id] == 1) << row;
+        }
+    }
+}
@@ -1,3 +1,5 @@
+#include <math.h>
+
 #include "fast_prng.h"
 
 
@@ -25,7 +27,7 @@ float prng_next_float(struct FastPRNG* prng) {
     x ^= x << 5;
     prng->state = x;
 
-    static union {
+    union {
     	uint32_t u32;
     	float f;
     } caster;
@@ -38,3 +40,112 @@ float prng_next_float(struct FastPRNG* prng) {
 
     return caster.f - 1.0f;
 }
+
+// Generate 64 pseudo-random bits, each set with probability (threshold + 1) / 2^32
+// Each bit compares its own random number against threshold, one bit position at a time from the most significant,
+// with all 64 comparisons done at once on whole words
+// A comparison is decided at the first position where the random bit differs from threshold,
+// so about half of the still undecided bits are settled per random word (~8 words on average, instead of 64)
+uint64_t prng_next_mask(struct FastPRNG* prng, uint32_t threshold) {
+    uint64_t mask = 0;
+    uint64_t undecided = UINT64_MAX;  // random bits drawn so far equal the bits of threshold
+
+    for (int32_t bit = 31; bit >= 0 && undecided != 0; bit--) {
+        uint64_t random_word = ((uint64_t)prng_next_uint32(prng) << 32) | prng_next_uint32(prng);
+        if ((threshold >> bit) & 1) {
+            // Random bit 0 under threshold bit 1 means smaller
+            mask |= undecided & ~random_word;
+            undecided &= random_word;
+        }
+        else {
+            // Random bit 1 over threshold bit 0 means larger
+            undecided &= ~random_word;
+        }
+    }
+
+    // Still undecided after all 32 bits means equal
+    return mask | undecided;
+}
+
+// Threshold for prng_next_mask, so that each bit is set with probability p (clamped to [0, 1])
+uint32_t prng_mask_threshold(float p) {
+    if (p <= 0.0f) {
+        return 0;
+    }
+    if (p >= 1.0f) {
+        return UINT32_MAX;
+    }
+    double threshold = (double)p * 4294967296.0;
+    return threshold >= 4294967295.0 ? UINT32_MAX : (uint32_t)threshold;
+}
+
+// Fast log2 for x > 0 (no libm), absolute error below 2e-6
+static inline float fast_log2(float x) {
+    union {
+        uint32_t u32;
+        float f;
+    } caster;
+    caster.f = x;
+
+    // x = 2^exponent * mantissa, mantissa in [1, 2)
+    int32_t exponent = (int32_t)((caster.u32 >> 23) & 0xFF) - 127;
+    caster.u32 = (caster.u32 & 0x007FFFFF) | 0x3F800000;
+
+    // log2(m) = 2 / ln(2) * atanh(z), z = (m - 1) / (m + 1) in [0, 1/3]
+    float z = (caster.f - 1.0f) / (caster.f + 1.0f);
+    float z2 = z * z;
+    float series = 2.8853900817779268f * z * (1.0f + z2 * (1.0f / 3.0f + z2 * (1.0f / 5.0f + z2 * (1.0f / 7.0f + z2 * (1.0f / 9.0f)))));
+    return (float)exponent + series;
+}
+
+// Generate the number of failures before the first success, for independent trials with success probability p
+// Inverse transform sampling: floor(log(U) / log(1 - p)) for uniform U in (0, 1]
+uint32_t prng_next_geometric(struct FastPRNG* prng, float scale) {
+    float uniform = (float)((prng_next_uint32(prng) >> 8) + 1) * (1.0f / 16777216.0f);
+    float failures = fast_log2(uniform) * scale;
+
+    // Also catches NaN (0 * infinity) for p == 0
+    if (!(failures < 4294967040.0f)) {
+        return UINT32_MAX;
+    }
+    return (uint32_t)failures;
+}
+
+// Index of the next success at or after position
+uint32_t prng_next_event(struct FastPRNG* prng, float scale, uint32_t position) {
+    uint32_t gap = prng_next_geometric(prng, scale);
+    return gap < UINT32_MAX - position ? position + gap : UINT32_MAX;
+}
+
+// Scale for prng_next_geometric == 1 / log2(1 - p)
+// Computed once per model, so in double precision (fast_log2 would lose small p to cancellation)
+float prng_geometric_scale(float p) {
+    if (p >= 1.0f) {
+        return 0.0f;
+    }
+    if (p <= 0.0f) {
+        return -INFINITY;
+    }
+
+    // ln(1 - p) = 2 * atanh(z), z = -p / (2 - p)
+    double z = -(double)p / (2.0 - (double)p);
+    double z2 = z * z;
+    double term = z;
+    double sum = 0.0;
+    for (uint32_t k = 1; k < 100000 && (term > 0 ? term : -term) > 1e-17 * (sum > 0 ? sum : -sum); k += 2) {
+        sum += term / k;
+        term *= z2;
+    }
+    return (float)(0.6931471805599453 / (2.0 * sum));
+}
+
+// Shuffle array in place (Fisher-Yates)
+void prng_shuffle(struct FastPRNG* prng, uint32_t *array, uint32_t size) {
+    for (uint32_t i = size; i > 1; i--) {
+        // Uniform j in [0, i), multiply-shift instead of modulo
+        uint32_t j = (uint32_t)(((uint64_t)prng_next_uint32(prng) * i) >> 32);
+        uint32_t tmp = array[i - 1];
+        array[i - 1] = array[j];
+        array[j] = tmp;
+    }
+}
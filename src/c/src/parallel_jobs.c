@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "parallel_jobs.h"
+#include "utility.h"
+
+
+struct ParallelJobThread {
+    pthread_t thread;
+    uint8_t thread_started;
+    void (*run)(void *job);
+    void *job;
+};
+
+static void *parallel_job_thread(void *arg) {
+    struct ParallelJobThread *thread = (struct ParallelJobThread *)arg;
+    thread->run(thread->job);
+    return NULL;
+}
+
+// Run jobs on worker threads, see header
+void run_parallel_jobs(void (*run)(void *job), void *jobs, size_t job_size, uint32_t num_jobs) {
+    if (num_jobs == 0) {
+        return;
+    }
+
+    struct ParallelJobThread *threads = (struct ParallelJobThread *)calloc(num_jobs, sizeof(struct ParallelJobThread));
+    if (threads == NULL) {
+        perror("Memory allocation failed");
+        for (uint32_t job_id = 0; job_id < num_jobs; job_id++) {
+            run((uint8_t *)jobs + (size_t)job_id * job_size);
+        }
+        return;
+    }
+
+    for (uint32_t job_id = 1; job_id < num_jobs; job_id++) {
+        threads[job_id].run = run;
+        threads[job_id].job = (uint8_t *)jobs + (size_t)job_id * job_size;
+        // If a thread can't be started, its job runs on the calling thread below
+        threads[job_id].thread_started = 0 == pthread_create(&threads[job_id].thread, NULL, parallel_job_thread, threads + job_id);
+    }
+    run(jobs);
+    for (uint32_t job_id = 1; job_id < num_jobs; job_id++) {
+        if (threads[job_id].thread_started) {
+            pthread_join(threads[job_id].thread, NULL);
+        }
+        else {
+            run(threads[job_id].job);
+        }
+    }
+    free(threads);
+}
+
+
+struct ClauseRangeJob {
+    void (*run)(void *arg, uint32_t clause_start, uint32_t clause_end);
+    void *arg;
+    uint32_t clause_start, clause_end;
+};
+
+static void clause_range_job(void *arg) {
+    struct ClauseRangeJob *job = (struct ClauseRangeJob *)arg;
+    job->run(job->arg, job->clause_start, job->clause_end);
+}
+
+// Run clause ranges on worker threads, see header
+void run_clause_ranges(
+    void (*run)(void *arg, uint32_t clause_start, uint32_t clause_end), void *arg, uint32_t num_clauses, uint32_t num_threads
+) {
+    if (num_threads == 0) {
+        num_threads = default_num_threads();
+    }
+    if (num_threads > num_clauses) {
+        num_threads = num_clauses;
+    }
+    if (num_threads <= 1) {
+        run(arg, 0, num_clauses);
+        return;
+    }
+
+    struct ClauseRangeJob *jobs = (struct ClauseRangeJob *)calloc(num_threads, sizeof(struct ClauseRangeJob));
+    if (jobs == NULL) {
+        perror("Memory allocation failed");
+        run(arg, 0, num_clauses);
+        return;
+    }
+
+    // The first (num_clauses % num_threads) jobs get one extra clause
+    uint32_t clause_start = 0;
+    for (uint32_t job_id = 0; job_id < num_threads; job_id++) {
+        jobs[job_id].run = run;
+        jobs[job_id].arg = arg;
+        jobs[job_id].clause_start = clause_start;
+        clause_start += num_clauses / num_threads + (job_id < num_clauses % num_threads);
+        jobs[job_id].clause_end = clause_start;
+    }
+
+    run_parallel_jobs(clause_range_job, jobs, sizeof(struct ClauseRangeJob), num_threads);
+    free(jobs);
+}
@@ -0,0 +1,98 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "posting_lists.h"
+
+
+size_t posting_base_cost(uint32_t num_literals, uint32_t num_clauses) {
+    return num_literals / 8 + num_clauses;
+}
+
+uint32_t collect_row_literals(const uint8_t *X_row, uint32_t num_literals, uint32_t *row_literals) {
+    uint32_t count = 0;
+    uint32_t literal_id = 0;
+    // Sparse rows are mostly 0, so pass over 8 literals at a time
+    for (; literal_id + 8 <= num_literals; literal_id += 8) {
+        uint64_t word;
+        memcpy(&word, X_row + literal_id, sizeof(uint64_t));
+        while (word != 0) {
+            uint32_t byte_id = __builtin_ctzll(word) / 8;
+            word &= ~((uint64_t)0xFF << (byte_id * 8));
+            row_literals[count++] = literal_id + byte_id;
+        }
+    }
+    for (; literal_id < num_literals; literal_id++) {
+        if (X_row[literal_id] != 0) {
+            row_literals[count++] = literal_id;
+        }
+    }
+    return count;
+}
+
+uint8_t collect_row_literals_budget(
+    const uint8_t *X_row, uint32_t num_literals, const uint32_t *posting_offsets, size_t max_postings,
+    uint32_t *row_literals, uint32_t *num_row_literals, size_t *num_postings
+) {
+    size_t postings = 0;
+    uint32_t count = 0;
+    uint32_t literal_id = 0;
+    for (; literal_id + 8 <= num_literals; literal_id += 8) {
+        uint64_t word;
+        memcpy(&word, X_row + literal_id, sizeof(uint64_t));
+        while (word != 0) {
+            uint32_t byte_id = __builtin_ctzll(word) / 8;
+            word &= ~((uint64_t)0xFF << (byte_id * 8));
+            uint32_t set_literal_id = literal_id + byte_id;
+            postings += posting_offsets[2 * set_literal_id + 2] - posting_offsets[2 * set_literal_id];
+            if (postings > max_postings) {
+                return 0;
+            }
+            row_literals[count++] = set_literal_id;
+        }
+    }
+    for (; literal_id < num_literals; literal_id++) {
+        if (X_row[literal_id] != 0) {
+            postings += posting_offsets[2 * literal_id + 2] - posting_offsets[2 * literal_id];
+            if (postings > max_postings) {
+                return 0;
+            }
+            row_literals[count++] = literal_id;
+        }
+    }
+    *num_row_literals = count;
+    *num_postings += postings;
+    return 1;
+}
+
+void count_posting_hits(
+    const uint32_t *posting_offsets, const uint32_t *posting_clauses, const uint32_t *row_literals, uint32_t num_row_literals,
+    uint32_t num_clauses, uint32_t *clause_hits
+) {
+    memset(clause_hits, 0, num_clauses * sizeof(uint32_t));
+    for (uint32_t i = 0; i < num_row_literals; i++) {
+        uint32_t ta_id = 2 * row_literals[i];
+        for (uint32_t posting_id = posting_offsets[ta_id]; posting_id < posting_offsets[ta_id + 1]; posting_id++) {
+            clause_hits[posting_clauses[posting_id]]++;
+        }
+    }
+    // Negated literals last, so that no increment follows a UINT32_MAX
+    for (uint32_t i = 0; i < num_row_literals; i++) {
+        uint32_t ta_id = 2 * row_literals[i] + 1;
+        for (uint32_t posting_id = posting_offsets[ta_id]; posting_id < posting_offsets[ta_id + 1]; posting_id++) {
+            clause_hits[posting_clauses[posting_id]] = UINT32_MAX;
+        }
+    }
+}
+
+void posting_counts_to_offsets(uint32_t *posting_offsets, uint32_t num_tas) {
+    for (uint32_t ta_id = 0; ta_id < num_tas; ta_id++) {
+        posting_offsets[ta_id + 1] += posting_offsets[ta_id];
+    }
+}
+
+void posting_offsets_restore(uint32_t *posting_offsets, uint32_t num_tas) {
+    for (uint32_t ta_id = num_tas; ta_id > 0; ta_id--) {
+        posting_offsets[ta_id] = posting_offsets[ta_id - 1];
+    }
+    posting_offsets[0] = 0;
+}
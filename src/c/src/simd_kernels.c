@@ -0,0 +1,779 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "simd_kernels.h"
+#include "utility.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+
+// --- Scalar ---
+
+static void packed_clause_output_scalar(
+    const uint64_t *include, const uint64_t *include_negated, const uint32_t *include_count, const uint64_t *X_packed,
+    uint32_t num_clauses, uint32_t mask_row_size, uint64_t *clause_output
+) {
+    memset(clause_output, 0, ((num_clauses + 63) / 64) * sizeof(uint64_t));
+
+    for (uint32_t clause_id = 0; clause_id < num_clauses; clause_id++) {
+        if (include_count[clause_id] == 0) {
+            continue;
+        }
+
+        const uint64_t *clause_include = include + (clause_id * mask_row_size);
+        const uint64_t *clause_include_negated = include_negated + (clause_id * mask_row_size);
+        uint8_t output = 1;
+
+        for (uint32_t word_id = 0; word_id < mask_row_size; word_id++) {
+            if ((clause_include[word_id] & ~X_packed[word_id]) | (clause_include_negated[word_id] & X_packed[word_id])) {
+                output = 0;
+                break;
+            }
+        }
+
+        clause_output[clause_id / 64] |= (uint64_t)output << (clause_id % 64);
+    }
+}
+
+static inline uint32_t load_ta_id(const void *ta_ids, uint8_t id_size, uint32_t pos) {
+    return id_size == sizeof(uint16_t) ? ((const uint16_t *)ta_ids)[pos] : ((const uint32_t *)ta_ids)[pos];
+}
+
+// TAs start .. end - 1 of ta_ids hold for X, id_size is a constant at every call so each id type gets its own loop
+static inline uint8_t id_clause_holds_scalar(const void *ta_ids, uint8_t id_size, uint32_t start, uint32_t end, const uint8_t *X) {
+    for (uint32_t pos = start; pos < end; pos++) {
+        uint32_t ta_id = load_ta_id(ta_ids, id_size, pos);
+        if (ta_id % 2 == X[ta_id / 2]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static inline void id_clause_output_loop_scalar(
+    const void *ta_ids, uint8_t id_size, const uint32_t *clause_offsets, uint32_t num_clauses, const uint8_t *X, uint64_t *clause_output
+) {
+    memset(clause_output, 0, ((num_clauses + 63) / 64) * sizeof(uint64_t));
+    for (uint32_t clause_id = 0; clause_id < num_clauses; clause_id++) {
+        uint32_t start = clause_offsets[clause_id];
+        uint32_t end = clause_offsets[clause_id + 1];
+        if (start != end && id_clause_holds_scalar(ta_ids, id_size, start, end, X)) {
+            clause_output[clause_id / 64] |= (uint64_t)1 << (clause_id % 64);
+        }
+    }
+}
+
+static void id_clause_output_scalar(
+    const void *ta_ids, uint8_t id_size, const uint32_t *clause_offsets, uint32_t num_clauses,
+    const uint8_t *X, uint32_t num_literals, uint64_t *clause_output
+) {
+    (void)num_literals;
+    if (id_size == sizeof(uint16_t)) {
+        id_clause_output_loop_scalar(ta_ids, sizeof(uint16_t), clause_offsets, num_clauses, X, clause_output);
+    }
+    else {
+        id_clause_output_loop_scalar(ta_ids, sizeof(uint32_t), clause_offsets, num_clauses, X, clause_output);
+    }
+}
+
+static uint8_t node_clause_output_scalar(const void *nodes, uint32_t num_nodes, const uint8_t *X, uint32_t num_literals, int8_t mid_state) {
+    (void)num_literals;
+    for (uint32_t node_id = 0; node_id < num_nodes; node_id++) {
+        uint32_t node;
+        memcpy(&node, (const uint8_t *)nodes + (size_t)node_id * sizeof(uint32_t), sizeof(uint32_t));
+        uint32_t ta_id = node & 0xFFFFFF;
+        if ((int8_t)(node >> 24) >= mid_state && ta_id % 2 == X[ta_id / 2]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void add_weights_scalar(int32_t *votes, const int16_t *clause_weights, uint32_t num_classes) {
+    for (uint32_t class_id = 0; class_id < num_classes; class_id++) {
+        votes[class_id] += clause_weights[class_id];
+    }
+}
+
+static uint32_t clip_votes_scalar(int32_t *votes, uint32_t num_classes, int32_t threshold) {
+    uint32_t best_class = 0;
+    for (uint32_t class_id = 0; class_id < num_classes; class_id++) {
+        votes[class_id] = clip(votes[class_id], threshold);
+        if (votes[best_class] < votes[class_id]) {
+            best_class = class_id;
+        }
+    }
+    return best_class;
+}
+
+static uint32_t sum_votes_scalar(
+    const uint8_t *clause_output, const int16_t *weights,
+    uint32_t num_clauses, uint32_t num_classes, int32_t threshold, int32_t *votes
+) {
+    memset(votes, 0, num_classes * sizeof(int32_t));
+
+    for (uint32_t clause_id = 0; clause_id < num_clauses; clause_id++) {
+        if (clause_output[clause_id] == 0) {
+            continue;
+        }
+        add_weights_scalar(votes, weights + (clause_id * num_classes), num_classes);
+    }
+
+    return clip_votes_scalar(votes, num_classes, threshold);
+}
+
+static uint32_t sum_votes_bitmap_scalar(
+    const uint64_t *clause_output, const int16_t *weights,
+    uint32_t num_clauses, uint32_t num_classes, int32_t threshold, int32_t *votes
+) {
+    memset(votes, 0, num_classes * sizeof(int32_t));
+
+    for (uint32_t word_id = 0; word_id < (num_clauses + 63) / 64; word_id++) {
+        for (uint64_t bits = clause_output[word_id]; bits != 0; bits &= bits - 1) {
+            uint32_t clause_id = (word_id * 64) + __builtin_ctzll(bits);
+            add_weights_scalar(votes, weights + (clause_id * num_classes), num_classes);
+        }
+    }
+
+    return clip_votes_scalar(votes, num_classes, threshold);
+}
+
+
+static uint32_t update_states_scalar(
+    int8_t *ta_state, const uint64_t *increment, const uint64_t *decrement, uint32_t num_tas,
+    int8_t increment_below, int8_t decrement_above, int8_t mid_state, uint64_t *flipped
+) {
+    if (flipped != NULL) {
+        memset(flipped, 0, ((num_tas + 63) / 64) * sizeof(uint64_t));
+    }
+
+    uint32_t count = 0;
+    for (uint32_t ta_id = 0; ta_id < num_tas; ta_id++) {
+        uint8_t inc = increment != NULL && ((increment[ta_id / 64] >> (ta_id % 64)) & 1);
+        uint8_t dec = decrement != NULL && ((decrement[ta_id / 64] >> (ta_id % 64)) & 1);
+        int8_t state = ta_state[ta_id];
+        uint8_t was_included = state >= mid_state;
+        state += inc && state < increment_below;
+        state -= dec && state > decrement_above;
+        ta_state[ta_id] = state;
+        count += state >= mid_state;
+        if (flipped != NULL) {
+            flipped[ta_id / 64] |= (uint64_t)(was_included != (state >= mid_state)) << (ta_id % 64);
+        }
+    }
+    return count;
+}
+
+#ifdef SIMD_X86
+
+// --- AVX2 ---
+
+__attribute__((target("avx2")))
+static void packed_clause_output_avx2(
+    const uint64_t *include, const uint64_t *include_negated, const uint32_t *include_count, const uint64_t *X_packed,
+    uint32_t num_clauses, uint32_t mask_row_size, uint64_t *clause_output
+) {
+    memset(clause_output, 0, ((num_clauses + 63) / 64) * sizeof(uint64_t));
+
+    for (uint32_t clause_id = 0; clause_id < num_clauses; clause_id++) {
+        if (include_count[clause_id] == 0) {
+            continue;
+        }
+
+        const uint64_t *clause_include = include + (clause_id * mask_row_size);
+        const uint64_t *clause_include_negated = include_negated + (clause_id * mask_row_size);
+        uint8_t output = 1;
+
+        uint32_t word_id = 0;
+        for (; word_id + 4 <= mask_row_size; word_id += 4) {
+            __m256i x = _mm256_loadu_si256((const __m256i *)(X_packed + word_id));
+            __m256i inc = _mm256_loadu_si256((const __m256i *)(clause_include + word_id));
+            __m256i inc_neg = _mm256_loadu_si256((const __m256i *)(clause_include_negated + word_id));
+            __m256i falsified = _mm256_or_si256(_mm256_andnot_si256(x, inc), _mm256_and_si256(inc_neg, x));
+            if (!_mm256_testz_si256(falsified, falsified)) {
+                output = 0;
+                break;
+            }
+        }
+        if (output) {
+            for (; word_id < mask_row_size; word_id++) {
+                if ((clause_include[word_id] & ~X_packed[word_id]) | (clause_include_negated[word_id] & X_packed[word_id])) {
+                    output = 0;
+                    break;
+                }
+            }
+        }
+
+        clause_output[clause_id / 64] |= (uint64_t)output << (clause_id % 64);
+    }
+}
+
+// Clause output of up to 8 TA ids (the lanes set in check), 0 if any of them is falsified
+// X bytes are gathered as 32 bit words, so literals within 3 bytes of the end of X are checked one by one instead
+__attribute__((target("avx2")))
+static inline uint8_t id_lanes_hold_avx2(__m256i ta_ids, __m256i check, const uint8_t *X, uint32_t num_literals) {
+    __m256i literal_ids = _mm256_srli_epi32(ta_ids, 1);
+    __m256i gather_end = _mm256_set1_epi32(num_literals >= 3 ? (int32_t)(num_literals - 3) : 0);
+    __m256i safe = _mm256_and_si256(check, _mm256_cmpgt_epi32(gather_end, literal_ids));
+
+    __m256i bytes = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *)X, literal_ids, safe, 1);
+    __m256i falsified = _mm256_cmpeq_epi32(
+        _mm256_and_si256(bytes, _mm256_set1_epi32(0xFF)), _mm256_and_si256(ta_ids, _mm256_set1_epi32(1))
+    );
+    falsified = _mm256_and_si256(falsified, safe);
+    if (!_mm256_testz_si256(falsified, falsified)) {
+        return 0;
+    }
+
+    uint32_t rest = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_andnot_si256(safe, check)));
+    if (rest != 0) {
+        uint32_t lane_ids[8];
+        _mm256_storeu_si256((__m256i *)lane_ids, ta_ids);
+        for (; rest != 0; rest &= rest - 1) {
+            uint32_t ta_id = lane_ids[__builtin_ctz(rest)];
+            if (ta_id % 2 == X[ta_id / 2]) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+__attribute__((target("avx2")))
+static inline uint8_t id_clause_holds_avx2(
+    const void *ta_ids, uint8_t id_size, uint32_t start, uint32_t end, const uint8_t *X, uint32_t num_literals
+) {
+    __m256i all = _mm256_set1_epi32(-1);
+    uint32_t pos = start;
+    for (; pos + 8 <= end; pos += 8) {
+        __m256i ids = id_size == sizeof(uint16_t) ?
+            _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)((const uint16_t *)ta_ids + pos))) :
+            _mm256_loadu_si256((const __m256i *)((const uint32_t *)ta_ids + pos));
+        if (!id_lanes_hold_avx2(ids, all, X, num_literals)) {
+            return 0;
+        }
+    }
+    return id_clause_holds_scalar(ta_ids, id_size, pos, end, X);
+}
+
+__attribute__((target("avx2")))
+static inline void id_clause_output_loop_avx2(
+    const void *ta_ids, uint8_t id_size, const uint32_t *clause_offsets, uint32_t num_clauses,
+    const uint8_t *X, uint32_t num_literals, uint64_t *clause_output
+) {
+    memset(clause_output, 0, ((num_clauses + 63) / 64) * sizeof(uint64_t));
+    for (uint32_t clause_id = 0; clause_id < num_clauses; clause_id++) {
+        uint32_t start = clause_offsets[clause_id];
+        uint32_t end = clause_offsets[clause_id + 1];
+        if (start != end && id_clause_holds_avx2(ta_ids, id_size, start, end, X, num_literals)) {
+            clause_output[clause_id / 64] |= (uint64_t)1 << (clause_id % 64);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void id_clause_output_avx2(
+    const void *ta_ids, uint8_t id_size, const uint32_t *clause_offsets, uint32_t num_clauses,
+    const uint8_t *X, uint32_t num_literals, uint64_t *clause_output
+) {
+    if (id_size == sizeof(uint16_t)) {
+        id_clause_output_loop_avx2(ta_ids, sizeof(uint16_t), clause_offsets, num_clauses, X, num_literals, clause_output);
+    }
+    else {
+        id_clause_output_loop_avx2(ta_ids, sizeof(uint32_t), clause_offsets, num_clauses, X, num_literals, clause_output);
+    }
+}
+
+__attribute__((target("avx2")))
+static uint8_t node_clause_output_avx2(const void *nodes, uint32_t num_nodes, const uint8_t *X, uint32_t num_literals, int8_t mid_state) {
+    __m256i included_above = _mm256_set1_epi32((int32_t)mid_state - 1);
+    uint32_t node_id = 0;
+    for (; node_id + 8 <= num_nodes; node_id += 8) {
+        __m256i words = _mm256_loadu_si256((const __m256i *)((const uint32_t *)nodes + node_id));
+        __m256i ta_ids = _mm256_and_si256(words, _mm256_set1_epi32(0xFFFFFF));
+        __m256i included = _mm256_cmpgt_epi32(_mm256_srai_epi32(words, 24), included_above);
+        if (!id_lanes_hold_avx2(ta_ids, included, X, num_literals)) {
+            return 0;
+        }
+    }
+    return node_clause_output_scalar((const uint32_t *)nodes + node_id, num_nodes - node_id, X, num_literals, mid_state);
+}
+
+// 16 classes per iteration: one int16 load, widened to two int32 vectors
+__attribute__((target("avx2")))
+static inline void add_weights_avx2(int32_t *votes, const int16_t *clause_weights, uint32_t num_classes) {
+    uint32_t class_id = 0;
+    for (; class_id + 16 <= num_classes; class_id += 16) {
+        __m256i w = _mm256_loadu_si256((const __m256i *)(clause_weights + class_id));
+        __m256i w_lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(w));
+        __m256i w_hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(w, 1));
+        __m256i v_lo = _mm256_loadu_si256((const __m256i *)(votes + class_id));
+        __m256i v_hi = _mm256_loadu_si256((const __m256i *)(votes + class_id + 8));
+        _mm256_storeu_si256((__m256i *)(votes + class_id), _mm256_add_epi32(v_lo, w_lo));
+        _mm256_storeu_si256((__m256i *)(votes + class_id + 8), _mm256_add_epi32(v_hi, w_hi));
+    }
+    for (; class_id + 8 <= num_classes; class_id += 8) {
+        __m256i w = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(clause_weights + class_id)));
+        __m256i v = _mm256_loadu_si256((const __m256i *)(votes + class_id));
+        _mm256_storeu_si256((__m256i *)(votes + class_id), _mm256_add_epi32(v, w));
+    }
+    for (; class_id < num_classes; class_id++) {
+        votes[class_id] += clause_weights[class_id];
+    }
+}
+
+// Clip and track the maximum in one pass, then find its first occurrence with a compare mask
+__attribute__((target("avx2")))
+static inline uint32_t clip_votes_avx2(int32_t *votes, uint32_t num_classes, int32_t threshold) {
+    __m256i upper = _mm256_set1_epi32(threshold);
+    __m256i lower = _mm256_set1_epi32(-threshold);
+    __m256i best = _mm256_set1_epi32(INT32_MIN);
+    int32_t best_tail = INT32_MIN;
+
+    uint32_t class_id = 0;
+    for (; class_id + 8 <= num_classes; class_id += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(votes + class_id));
+        v = _mm256_max_epi32(_mm256_min_epi32(v, upper), lower);
+        _mm256_storeu_si256((__m256i *)(votes + class_id), v);
+        best = _mm256_max_epi32(best, v);
+    }
+    for (; class_id < num_classes; class_id++) {
+        votes[class_id] = clip(votes[class_id], threshold);
+        best_tail = votes[class_id] > best_tail ? votes[class_id] : best_tail;
+    }
+
+    __m128i best_128 = _mm_max_epi32(_mm256_castsi256_si128(best), _mm256_extracti128_si256(best, 1));
+    best_128 = _mm_max_epi32(best_128, _mm_shuffle_epi32(best_128, _MM_SHUFFLE(1, 0, 3, 2)));
+    best_128 = _mm_max_epi32(best_128, _mm_shuffle_epi32(best_128, _MM_SHUFFLE(2, 3, 0, 1)));
+    int32_t max_vote = _mm_cvtsi128_si32(best_128);
+    max_vote = best_tail > max_vote ? best_tail : max_vote;
+
+    __m256i target = _mm256_set1_epi32(max_vote);
+    for (class_id = 0; class_id + 8 <= num_classes; class_id += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(votes + class_id)), target);
+        uint32_t lanes = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(eq));
+        if (lanes != 0) {
+            return class_id + __builtin_ctz(lanes);
+        }
+    }
+    for (; class_id < num_classes; class_id++) {
+        if (votes[class_id] == max_vote) {
+            return class_id;
+        }
+    }
+    return 0;
+}
+
+__attribute__((target("avx2")))
+static uint32_t sum_votes_avx2(
+    const uint8_t *clause_output, const int16_t *weights,
+    uint32_t num_clauses, uint32_t num_classes, int32_t threshold, int32_t *votes
+) {
+    memset(votes, 0, num_classes * sizeof(int32_t));
+
+    for (uint32_t clause_id = 0; clause_id < num_clauses; clause_id++) {
+        if (clause_output[clause_id] == 0) {
+            continue;
+        }
+        add_weights_avx2(votes, weights + (clause_id * num_classes), num_classes);
+    }
+
+    return clip_votes_avx2(votes, num_classes, threshold);
+}
+
+__attribute__((target("avx2")))
+static uint32_t sum_votes_bitmap_avx2(
+    const uint64_t *clause_output, const int16_t *weights,
+    uint32_t num_clauses, uint32_t num_classes, int32_t threshold, int32_t *votes
+) {
+    memset(votes, 0, num_classes * sizeof(int32_t));
+
+    for (uint32_t word_id = 0; word_id < (num_clauses + 63) / 64; word_id++) {
+        for (uint64_t bits = clause_output[word_id]; bits != 0; bits &= bits - 1) {
+            uint32_t clause_id = (word_id * 64) + __builtin_ctzll(bits);
+            add_weights_avx2(votes, weights + (clause_id * num_classes), num_classes);
+        }
+    }
+
+    return clip_votes_avx2(votes, num_classes, threshold);
+}
+
+// state >= mid_state <=> max(state, mid_state) == state
+// Spread 32 bits over 32 bytes, 0xFF where the bit is set
+__attribute__((target("avx2")))
+static inline __m256i expand_bits_avx2(uint32_t bits) {
+    const __m256i byte_of_bit = _mm256_setr_epi8(
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+        2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3
+    );
+    const __m256i bit_in_byte = _mm256_set1_epi64x((int64_t)0x8040201008040201);
+    __m256i spread = _mm256_shuffle_epi8(_mm256_set1_epi32((int32_t)bits), byte_of_bit);
+    return _mm256_cmpeq_epi8(_mm256_and_si256(spread, bit_in_byte), bit_in_byte);
+}
+
+__attribute__((target("avx2")))
+static uint32_t update_states_avx2(
+    int8_t *ta_state, const uint64_t *increment, const uint64_t *decrement, uint32_t num_tas,
+    int8_t increment_below, int8_t decrement_above, int8_t mid_state, uint64_t *flipped
+) {
+    __m256i below = _mm256_set1_epi8(increment_below);
+    __m256i above = _mm256_set1_epi8(decrement_above);
+    __m256i mid = _mm256_set1_epi8(mid_state);
+    uint32_t count = 0;
+
+    if (flipped != NULL) {
+        memset(flipped, 0, ((num_tas + 63) / 64) * sizeof(uint64_t));
+    }
+
+    uint32_t ta_id = 0;
+    for (; ta_id + 32 <= num_tas; ta_id += 32) {
+        uint32_t inc = increment != NULL ? (uint32_t)(increment[ta_id / 64] >> (ta_id % 64)) : 0;
+        uint32_t dec = decrement != NULL ? (uint32_t)(decrement[ta_id / 64] >> (ta_id % 64)) : 0;
+        __m256i state = _mm256_loadu_si256((const __m256i *)(ta_state + ta_id));
+        __m256i included = _mm256_cmpeq_epi8(_mm256_max_epi8(state, mid), state);
+
+        if ((inc | dec) != 0) {
+            // Masks are -1 where a step applies, so subtracting increments and adding decrements
+            __m256i inc_lanes = _mm256_and_si256(expand_bits_avx2(inc), _mm256_cmpgt_epi8(below, state));
+            __m256i dec_lanes = _mm256_and_si256(expand_bits_avx2(dec), _mm256_cmpgt_epi8(state, above));
+            state = _mm256_add_epi8(_mm256_sub_epi8(state, inc_lanes), dec_lanes);
+            _mm256_storeu_si256((__m256i *)(ta_state + ta_id), state);
+
+            __m256i was_included = included;
+            included = _mm256_cmpeq_epi8(_mm256_max_epi8(state, mid), state);
+            if (flipped != NULL) {
+                uint32_t flips = (uint32_t)_mm256_movemask_epi8(_mm256_xor_si256(included, was_included));
+                flipped[ta_id / 64] |= (uint64_t)flips << (ta_id % 64);
+            }
+        }
+
+        count += __builtin_popcount((uint32_t)_mm256_movemask_epi8(included));
+    }
+    for (; ta_id < num_tas; ta_id++) {
+        uint8_t inc = increment != NULL && ((increment[ta_id / 64] >> (ta_id % 64)) & 1);
+        uint8_t dec = decrement != NULL && ((decrement[ta_id / 64] >> (ta_id % 64)) & 1);
+        int8_t state = ta_state[ta_id];
+        uint8_t was_included = state >= mid_state;
+        state += inc && state < increment_below;
+        state -= dec && state > decrement_above;
+        ta_state[ta_id] = state;
+        count += state >= mid_state;
+        if (flipped != NULL) {
+            flipped[ta_id / 64] |= (uint64_t)(was_included != (state >= mid_state)) << (ta_id % 64);
+        }
+    }
+    return count;
+}
+
+
+// --- AVX-512 ---
+// Tails are handled with masked loads and stores instead of scalar loops
+
+__attribute__((target("avx512f")))
+static void packed_clause_output_avx512(
+    const uint64_t *include, const uint64_t *include_negated, const uint32_t *include_count, const uint64_t *X_packed,
+    uint32_t num_clauses, uint32_t mask_row_size, uint64_t *clause_output
+) {
+    memset(clause_output, 0, ((num_clauses + 63) / 64) * sizeof(uint64_t));
+
+    for (uint32_t clause_id = 0; clause_id < num_clauses; clause_id++) {
+        if (include_count[clause_id] == 0) {
+            continue;
+        }
+
+        const uint64_t *clause_include = include + (clause_id * mask_row_size);
+        const uint64_t *clause_include_negated = include_negated + (clause_id * mask_row_size);
+        uint8_t output = 1;
+
+        for (uint32_t word_id = 0; word_id < mask_row_size; word_id += 8) {
+            __mmask8 lanes = mask_row_size - word_id >= 8 ? 0xFF : (__mmask8)((1u << (mask_row_size - word_id)) - 1);
+            __m512i x = _mm512_maskz_loadu_epi64(lanes, X_packed + word_id);
+            __m512i inc = _mm512_maskz_loadu_epi64(lanes, clause_include + word_id);
+            __m512i inc_neg = _mm512_maskz_loadu_epi64(lanes, clause_include_negated + word_id);
+            __m512i falsified = _mm512_or_si512(_mm512_andnot_si512(x, inc), _mm512_and_si512(inc_neg, x));
+            if (_mm512_test_epi64_mask(falsified, falsified)) {
+                output = 0;
+                break;
+            }
+        }
+
+        clause_output[clause_id / 64] |= (uint64_t)output << (clause_id % 64);
+    }
+}
+
+// Clause output of up to 16 TA ids (the lanes set in check), same as id_lanes_hold_avx2
+__attribute__((target("avx512f")))
+static inline uint8_t id_lanes_hold_avx512(__m512i ta_ids, __mmask16 check, const uint8_t *X, uint32_t num_literals) {
+    __m512i literal_ids = _mm512_srli_epi32(ta_ids, 1);
+    __m512i gather_end = _mm512_set1_epi32(num_literals >= 3 ? (int32_t)(num_literals - 3) : 0);
+    __mmask16 safe = _mm512_mask_cmplt_epi32_mask(check, literal_ids, gather_end);
+
+    __m512i bytes = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), safe, literal_ids, X, 1);
+    __mmask16 falsified = _mm512_mask_cmpeq_epi32_mask(
+        safe, _mm512_and_si512(bytes, _mm512_set1_epi32(0xFF)), _mm512_and_si512(ta_ids, _mm512_set1_epi32(1))
+    );
+    if (falsified) {
+        return 0;
+    }
+
+    uint32_t rest = check & ~safe;
+    if (rest != 0) {
+        uint32_t lane_ids[16];
+        _mm512_storeu_si512(lane_ids, ta_ids);
+        for (; rest != 0; rest &= rest - 1) {
+            uint32_t ta_id = lane_ids[__builtin_ctz(rest)];
+            if (ta_id % 2 == X[ta_id / 2]) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static inline uint8_t id_clause_holds_avx512(
+    const void *ta_ids, uint8_t id_size, uint32_t start, uint32_t end, const uint8_t *X, uint32_t num_literals
+) {
+    for (uint32_t pos = start; pos < end; pos += 16) {
+        __mmask16 lanes = end - pos >= 16 ? 0xFFFF : (__mmask16)((1u << (end - pos)) - 1);
+        __m512i ids = id_size == sizeof(uint16_t) ?
+            _mm512_cvtepu16_epi32(_mm256_maskz_loadu_epi16(lanes, (const uint16_t *)ta_ids + pos)) :
+            _mm512_maskz_loadu_epi32(lanes, (const uint32_t *)ta_ids + pos);
+        if (!id_lanes_hold_avx512(ids, lanes, X, num_literals)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static inline void id_clause_output_loop_avx512(
+    const void *ta_ids, uint8_t id_size, const uint32_t *clause_offsets, uint32_t num_clauses,
+    const uint8_t *X, uint32_t num_literals, uint64_t *clause_output
+) {
+    memset(clause_output, 0, ((num_clauses + 63) / 64) * sizeof(uint64_t));
+    for (uint32_t clause_id = 0; clause_id < num_clauses; clause_id++) {
+        uint32_t start = clause_offsets[clause_id];
+        uint32_t end = clause_offsets[clause_id + 1];
+        if (start != end && id_clause_holds_avx512(ta_ids, id_size, start, end, X, num_literals)) {
+            clause_output[clause_id / 64] |= (uint64_t)1 << (clause_id % 64);
+        }
+    }
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static void id_clause_output_avx512(
+    const void *ta_ids, uint8_t id_size, const uint32_t *clause_offsets, uint32_t num_clauses,
+    const uint8_t *X, uint32_t num_literals, uint64_t *clause_output
+) {
+    if (id_size == sizeof(uint16_t)) {
+        id_clause_output_loop_avx512(ta_ids, sizeof(uint16_t), clause_offsets, num_clauses, X, num_literals, clause_output);
+    }
+    else {
+        id_clause_output_loop_avx512(ta_ids, sizeof(uint32_t), clause_offsets, num_clauses, X, num_literals, clause_output);
+    }
+}
+
+__attribute__((target("avx512f")))
+static uint8_t node_clause_output_avx512(const void *nodes, uint32_t num_nodes, const uint8_t *X, uint32_t num_literals, int8_t mid_state) {
+    __m512i mid = _mm512_set1_epi32(mid_state);
+    for (uint32_t node_id = 0; node_id < num_nodes; node_id += 16) {
+        __mmask16 lanes = num_nodes - node_id >= 16 ? 0xFFFF : (__mmask16)((1u << (num_nodes - node_id)) - 1);
+        __m512i words = _mm512_maskz_loadu_epi32(lanes, (const uint32_t *)nodes + node_id);
+        __m512i ta_ids = _mm512_and_si512(words, _mm512_set1_epi32(0xFFFFFF));
+        __mmask16 included = _mm512_mask_cmpge_epi32_mask(lanes, _mm512_srai_epi32(words, 24), mid);
+        if (!id_lanes_hold_avx512(ta_ids, included, X, num_literals)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static inline void add_weights_avx512(int32_t *votes, const int16_t *clause_weights, uint32_t num_classes) {
+    for (uint32_t class_id = 0; class_id < num_classes; class_id += 16) {
+        __mmask16 lanes = num_classes - class_id >= 16 ? 0xFFFF : (__mmask16)((1u << (num_classes - class_id)) - 1);
+        __m512i w = _mm512_cvtepi16_epi32(_mm256_maskz_loadu_epi16(lanes, clause_weights + class_id));
+        __m512i v = _mm512_maskz_loadu_epi32(lanes, votes + class_id);
+        _mm512_mask_storeu_epi32(votes + class_id, lanes, _mm512_add_epi32(v, w));
+    }
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static inline uint32_t clip_votes_avx512(int32_t *votes, uint32_t num_classes, int32_t threshold) {
+    __m512i upper = _mm512_set1_epi32(threshold);
+    __m512i lower = _mm512_set1_epi32(-threshold);
+    __m512i best = _mm512_set1_epi32(INT32_MIN);
+
+    for (uint32_t class_id = 0; class_id < num_classes; class_id += 16) {
+        __mmask16 lanes = num_classes - class_id >= 16 ? 0xFFFF : (__mmask16)((1u << (num_classes - class_id)) - 1);
+        __m512i v = _mm512_maskz_loadu_epi32(lanes, votes + class_id);
+        v = _mm512_max_epi32(_mm512_min_epi32(v, upper), lower);
+        _mm512_mask_storeu_epi32(votes + class_id, lanes, v);
+        best = _mm512_mask_max_epi32(best, lanes, best, v);
+    }
+
+    __m512i target = _mm512_set1_epi32(_mm512_reduce_max_epi32(best));
+    for (uint32_t class_id = 0; class_id < num_classes; class_id += 16) {
+        __mmask16 lanes = num_classes - class_id >= 16 ? 0xFFFF : (__mmask16)((1u << (num_classes - class_id)) - 1);
+        __mmask16 eq = _mm512_mask_cmpeq_epi32_mask(lanes, _mm512_maskz_loadu_epi32(lanes, votes + class_id), target);
+        if (eq != 0) {
+            return class_id + __builtin_ctz(eq);
+        }
+    }
+    return 0;
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static uint32_t sum_votes_avx512(
+    const uint8_t *clause_output, const int16_t *weights,
+    uint32_t num_clauses, uint32_t num_classes, int32_t threshold, int32_t *votes
+) {
+    memset(votes, 0, num_classes * sizeof(int32_t));
+
+    for (uint32_t clause_id = 0; clause_id < num_clauses; clause_id++) {
+        if (clause_output[clause_id] == 0) {
+            continue;
+        }
+        add_weights_avx512(votes, weights + (clause_id * num_classes), num_classes);
+    }
+
+    return clip_votes_avx512(votes, num_classes, threshold);
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static uint32_t sum_votes_bitmap_avx512(
+    const uint64_t *clause_output, const int16_t *weights,
+    uint32_t num_clauses, uint32_t num_classes, int32_t threshold, int32_t *votes
+) {
+    memset(votes, 0, num_classes * sizeof(int32_t));
+
+    for (uint32_t word_id = 0; word_id < (num_clauses + 63) / 64; word_id++) {
+        for (uint64_t bits = clause_output[word_id]; bits != 0; bits &= bits - 1) {
+            uint32_t clause_id = (word_id * 64) + __builtin_ctzll(bits);
+            add_weights_avx512(votes, weights + (clause_id * num_classes), num_classes);
+        }
+    }
+
+    return clip_votes_avx512(votes, num_classes, threshold);
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static uint32_t update_states_avx512(
+    int8_t *ta_state, const uint64_t *increment, const uint64_t *decrement, uint32_t num_tas,
+    int8_t increment_below, int8_t decrement_above, int8_t mid_state, uint64_t *flipped
+) {
+    __m512i below = _mm512_set1_epi8(increment_below);
+    __m512i above = _mm512_set1_epi8(decrement_above);
+    __m512i mid = _mm512_set1_epi8(mid_state);
+    __m512i one = _mm512_set1_epi8(1);
+    uint32_t count = 0;
+
+    // One bitmap word is exactly one 64 lane mask
+    for (uint32_t ta_id = 0; ta_id < num_tas; ta_id += 64) {
+        __mmask64 lanes = num_tas - ta_id >= 64 ? ~(__mmask64)0 : (((__mmask64)1 << (num_tas - ta_id)) - 1);
+        __mmask64 inc = increment != NULL ? increment[ta_id / 64] & lanes : 0;
+        __mmask64 dec = decrement != NULL ? decrement[ta_id / 64] & lanes : 0;
+        __m512i state = _mm512_maskz_loadu_epi8(lanes, ta_state + ta_id);
+        __mmask64 included = _mm512_mask_cmpge_epi8_mask(lanes, state, mid);
+        __mmask64 was_included = included;
+
+        if ((inc | dec) != 0) {
+            inc = _mm512_mask_cmplt_epi8_mask(inc, state, below);
+            dec = _mm512_mask_cmpgt_epi8_mask(dec, state, above);
+            state = _mm512_mask_add_epi8(state, inc, state, one);
+            state = _mm512_mask_sub_epi8(state, dec, state, one);
+            _mm512_mask_storeu_epi8(ta_state + ta_id, inc | dec, state);
+            included = _mm512_mask_cmpge_epi8_mask(lanes, state, mid);
+        }
+
+        if (flipped != NULL) {
+            flipped[ta_id / 64] = included ^ was_included;
+        }
+        count += __builtin_popcountll(included);
+    }
+    return count;
+}
+
+#endif  // SIMD_X86
+
+
+// --- Dispatch ---
+
+struct SimdKernels simd_kernels = {
+    .level = SIMD_SCALAR,
+    .packed_clause_output = packed_clause_output_scalar,
+    .id_clause_output = id_clause_output_scalar,
+    .node_clause_output = node_clause_output_scalar,
+    .sum_votes = sum_votes_scalar,
+    .sum_votes_bitmap = sum_votes_bitmap_scalar,
+    .add_weights = add_weights_scalar,
+    .clip_votes = clip_votes_scalar,
+    .update_states = update_states_scalar,
+};
+
+enum SimdLevel simd_detect_level(void) {
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl")) {
+        return SIMD_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return SIMD_AVX2;
+    }
+#endif
+    return SIMD_SCALAR;
+}
+
+uint8_t simd_set_level(enum SimdLevel level) {
+    if (level > simd_detect_level()) {
+        return 0;
+    }
+
+    switch (level) {
+#ifdef SIMD_X86
+    case SIMD_AVX512:
+        simd_kernels.packed_clause_output = packed_clause_output_avx512;
+        simd_kernels.id_clause_output = id_clause_output_avx512;
+        simd_kernels.node_clause_output = node_clause_output_avx512;
+        simd_kernels.sum_votes = sum_votes_avx512;
+        simd_kernels.sum_votes_bitmap = sum_votes_bitmap_avx512;
+        simd_kernels.add_weights = add_weights_avx512;
+        simd_kernels.clip_votes = clip_votes_avx512;
+        simd_kernels.update_states = update_states_avx512;
+        break;
+    case SIMD_AVX2:
+        simd_kernels.packed_clause_output = packed_clause_output_avx2;
+        simd_kernels.id_clause_output = id_clause_output_avx2;
+        simd_kernels.node_clause_output = node_clause_output_avx2;
+        simd_kernels.sum_votes = sum_votes_avx2;
+        simd_kernels.sum_votes_bitmap = sum_votes_bitmap_avx2;
+        simd_kernels.add_weights = add_weights_avx2;
+        simd_kernels.clip_votes = clip_votes_avx2;
+        simd_kernels.update_states = update_states_avx2;
+        break;
+#endif
+    default:
+        simd_kernels.packed_clause_output = packed_clause_output_scalar;
+        simd_kernels.id_clause_output = id_clause_output_scalar;
+        simd_kernels.node_clause_output = node_clause_output_scalar;
+        simd_kernels.sum_votes = sum_votes_scalar;
+        simd_kernels.sum_votes_bitmap = sum_votes_bitmap_scalar;
+        simd_kernels.add_weights = add_weights_scalar;
+        simd_kernels.clip_votes = clip_votes_scalar;
+        simd_kernels.update_states = update_states_scalar;
+        break;
+    }
+    simd_kernels.level = level;
+
+    return 1;
+}
+
+// Pick the best supported kernels before main runs
+__attribute__((constructor))
+static void simd_init(void) {
+    simd_set_level(simd_detect_level());
+}
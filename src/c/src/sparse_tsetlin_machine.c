@@ -2,73 +2,60 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include "sparse_tsetlin_machine.h"
+#include "tsetlin_machine.h"
+#include "simd_kernels.h"
+#include "parallel_jobs.h"
+#include "posting_lists.h"
 #include "utility.h"
 
+// simd_kernels.node_clause_output reads packed nodes as 32 bit words, ta_id in bits 0 .. 23 and ta_state in bits 24 .. 31
+_Static_assert(sizeof(struct TAStateNode) == sizeof(uint32_t) && offsetof(struct TAStateNode, ta_state) == 3, "unexpected TAStateNode layout");
 
-// Insert a new node into a linked list after prev
-// If prev is NULL, insert at the head of the list
-// If head_ptr is NULL, it will be initialized to the new node
-// If result is not NULL, it will point to the new node
-void ta_state_insert(struct TAStateNode **head_ptr, struct TAStateNode *prev, uint32_t ta_id, uint8_t ta_state, struct TAStateNode **result) {
-	struct TAStateNode *node = malloc(sizeof(struct TAStateNode));
-	if (node == NULL) {
-		perror("Memory allocation failed");
-		exit(1);
-	}
-	node->ta_id = ta_id;
-	node->ta_state = ta_state;
-	node->next = prev != NULL ? prev->next : NULL;
-
-	if (*head_ptr == NULL) {
-		*head_ptr = node;
-	}
-	else if (prev == NULL) {
-		node->next = *head_ptr;
-		*head_ptr = node;
+// Make room for at least capacity nodes, at least doubling the capacity so inserts are amortized O(1)
+uint8_t ta_state_reserve(struct TAStateList *list, uint32_t capacity, uint8_t node_size) {
+	if (capacity <= list->capacity) {
+		return 1;
 	}
-	else {
-		prev->next = node;
+	uint32_t new_capacity = list->capacity < 4 ? 4 : list->capacity;
+	while (new_capacity < capacity) {
+		new_capacity = new_capacity <= UINT32_MAX / 2 ? new_capacity * 2 : capacity;
 	}
 
-	if (result != NULL) {
-		*result = node;
+	void *nodes = realloc(list->nodes, (size_t)new_capacity * node_size);  // shape: (new_capacity) of node_size bytes
+	if (nodes == NULL) {
+		return 0;
 	}
+	list->nodes = nodes;
+	list->capacity = new_capacity;
+	return 1;
 }
 
-// Remove a node from a linked list after prev
-// If prev is NULL, remove the head of the list
-// If head_ptr is NULL, it will not be modified but print an error message
-// If prev is not NULL and prev->next is NULL (trying to remove after last node), nothing happens
-// If result is not NULL, it will point to the next node after the removed node
-void ta_state_remove(struct TAStateNode **head_ptr, struct TAStateNode *prev, struct TAStateNode **result) {
-	if (*head_ptr == NULL) {
-        fprintf(stderr, "Trying to remove from empty linked list\n");
-        return;
-	}
-	if (prev != NULL && prev->next == NULL) {
-        // Trying to remove node after tail of linked list
-        return;
-	}
-
-	struct TAStateNode *to_remove = NULL;
-	if (prev == NULL) {
-		// Removing first element
-		to_remove = *head_ptr;
-		*head_ptr = to_remove->next;
-	}
-	else {
-		to_remove = prev->next;
-		prev->next = to_remove->next;
+// Insert a new node at position, keeping the nodes after it in order
+void ta_state_insert(struct TAStateList *list, uint32_t position, uint32_t ta_id, int8_t ta_state, uint8_t node_size) {
+	if (!ta_state_reserve(list, list->size + 1, node_size)) {
+		perror("Memory allocation failed");
+		exit(1);
 	}
+	uint8_t *nodes = (uint8_t *)list->nodes;
+	memmove(nodes + (size_t)(position + 1) * node_size, nodes + (size_t)position * node_size, (size_t)(list->size - position) * node_size);
+	ta_state_set(list, position, (struct TAStateNodeWide){.ta_id = ta_id, .ta_state = ta_state}, node_size);
+	list->size++;
+}
 
-	if (result != NULL) {
-		*result = to_remove->next;
+// Remove the node at position, keeping the nodes after it in order
+// If position is past the last node, nothing happens
+void ta_state_remove(struct TAStateList *list, uint32_t position, uint8_t node_size) {
+	if (position >= list->size) {
+		return;
 	}
-
-	free(to_remove);
+	uint8_t *nodes = (uint8_t *)list->nodes;
+	memmove(nodes + (size_t)position * node_size, nodes + (size_t)(position + 1) * node_size, (size_t)(list->size - position - 1) * node_size);
+	list->size--;
 }
 
 
@@ -82,7 +69,6 @@ uint8_t stm_y_eq_generic(const struct SparseTsetlinMachine *stm, const void *y,
 // --- Tsetlin Machine ---
 
 void stm_initialize(struct SparseTsetlinMachine *stm);
-static inline void stm_clear_llists(struct SparseTsetlinMachine *stm);
 
 // Translates automaton state to action - 0 or 1
 static inline uint8_t action(int8_t state, int8_t mid_state) {
@@ -95,6 +81,12 @@ struct SparseTsetlinMachine *stm_create(
     int8_t max_state, int8_t min_state, uint8_t boost_true_positive_feedback,
     uint32_t y_size, uint32_t y_element_size, float s, uint32_t seed
 ) {
+    // ta_id = 2 * literal_id + negated must fit in uint32_t
+    if (num_literals > UINT32_MAX / 2) {
+        fprintf(stderr, "stm_create: num_literals can be at most %u\n", UINT32_MAX / 2);
+        return NULL;
+    }
+
     struct SparseTsetlinMachine *stm = (struct SparseTsetlinMachine *)malloc(sizeof(struct SparseTsetlinMachine));
     if(stm == NULL) {
         perror("Memory allocation failed");
@@ -105,6 +97,8 @@ struct SparseTsetlinMachine *stm_create(
     stm->threshold = threshold;
     stm->num_literals = num_literals;
     stm->num_clauses = num_clauses;
+    // Packed 4 byte nodes whenever every ta_id fits in their 24 bits
+    stm->node_size = num_literals <= (STM_MAX_TA_ID + 1) / 2 ? sizeof(struct TAStateNode) : sizeof(struct TAStateNodeWide);
     stm->max_state = max_state;
     stm->min_state = min_state;
     stm->boost_true_positive_feedback = boost_true_positive_feedback;
@@ -115,16 +109,20 @@ struct SparseTsetlinMachine *stm_create(
     stm->y_eq = stm_y_eq_generic;
     stm->output_activation = stm_oa_class_idx;
     stm->calculate_feedback = stm_feedback_class_idx;
-
-    stm->ta_state = (struct TAStateNode **)malloc(num_clauses * sizeof(struct TAStateNode *));  // shape: flat (num_clauses)
+    stm->clause_locks = NULL;
+    stm->posting_offsets = NULL;
+    stm->posting_clauses = NULL;
+    stm->clause_positive_count = NULL;
+    stm->clause_hits = NULL;
+    stm->row_literals_X = NULL;
+
+    // Empty lists, nodes are allocated as feedback inserts them
+    stm->ta_state = (struct TAStateList *)calloc(num_clauses, sizeof(struct TAStateList));  // shape: (num_clauses)
     if (stm->ta_state == NULL) {
         perror("Memory allocation failed");
         stm_free(stm);
         return NULL;
     }
-    for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
-    	stm->ta_state[clause_id] = NULL;
-    }
 
     stm->al_row_size = (num_literals - 1) / 8 + 1;
     // shape: flat padded binary (num_classes, num_literals)
@@ -156,6 +154,20 @@ struct SparseTsetlinMachine *stm_create(
         return NULL;
     }
 
+    stm->clause_include_count = (uint32_t *)calloc(num_clauses, sizeof(uint32_t));  // shape: (num_clauses)
+    if (stm->clause_include_count == NULL) {
+        perror("Memory allocation failed");
+        stm_free(stm);
+        return NULL;
+    }
+
+    stm->row_literals = (uint32_t *)malloc(num_literals * sizeof(uint32_t));  // shape: (num_literals)
+    if (stm->row_literals == NULL) {
+        perror("Memory allocation failed");
+        stm_free(stm);
+        return NULL;
+    }
+
     prng_seed(&(stm->rng), seed);
 
     stm_initialize(stm);
@@ -220,35 +232,203 @@ struct SparseTsetlinMachine *stm_load_dense(
         fclose(file);
         return NULL;
     }
-    // Allocate and read clauses
-    int8_t *flat_states = malloc(num_clauses * num_literals * 2 * sizeof(int8_t));
-    size_t states_read = fread(flat_states, sizeof(int8_t), num_clauses * num_literals * 2, file);
-    if (states_read != num_clauses * num_literals * 2) {
-        fprintf(stderr, "Failed to read all states from bin\n");
+    // Stream the clause states chunk by chunk, appending the included TAs to the lists in order
+    int8_t *chunk = (int8_t *)malloc(DENSE_LOAD_CHUNK_SIZE * sizeof(int8_t));  // shape: (DENSE_LOAD_CHUNK_SIZE)
+    if (chunk == NULL) {
+        perror("Memory allocation failed");
         stm_free(stm);
-        free(flat_states);
         fclose(file);
         return NULL;
     }
+    size_t num_states = (size_t)num_clauses * num_literals * 2;
+    uint32_t clause_id = 0;
+    uint32_t ta_id = 0;
+    for (size_t states_done = 0; states_done < num_states;) {
+        size_t chunk_size = min(num_states - states_done, (size_t)DENSE_LOAD_CHUNK_SIZE);
+        if (fread(chunk, sizeof(int8_t), chunk_size, file) != chunk_size) {
+            fprintf(stderr, "Failed to read all states from bin\n");
+            stm_free(stm);
+            free(chunk);
+            fclose(file);
+            return NULL;
+        }
 
-	stm_clear_llists(stm);
-    for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
-    	struct TAStateNode *prev_ptr = NULL;
-    	struct TAStateNode **head_ptr_addr = stm->ta_state + clause_id;
+        for (size_t i = 0; i < chunk_size; i++) {
+            struct TAStateList *list = stm->ta_state + clause_id;
+            if (action(chunk[i], stm->mid_state)) {
+                if (!ta_state_reserve(list, list->size + 1, stm->node_size)) {
+                    perror("Memory allocation failed");
+                    stm_free(stm);
+                    free(chunk);
+                    fclose(file);
+                    return NULL;
+                }
+                ta_state_set(list, list->size++, (struct TAStateNodeWide){.ta_id = ta_id, .ta_state = chunk[i]}, stm->node_size);
+            }
 
-        for (uint32_t i = 0; i < stm->num_literals * 2; i++) {
-        	if (action(flat_states[clause_id * stm->num_literals * 2 + i], stm->mid_state)) {
-        		ta_state_insert(head_ptr_addr, prev_ptr, i, flat_states[clause_id * stm->num_literals * 2 + i], &prev_ptr);
-        	}
+            if (++ta_id == num_literals * 2) {
+                // Clause done, give back the spare capacity (the lists only grow again during training)
+                if (list->size != 0 && list->size < list->capacity) {
+                    void *nodes = realloc(list->nodes, (size_t)list->size * stm->node_size);
+                    if (nodes != NULL) {
+                        list->nodes = nodes;
+                        list->capacity = list->size;
+                    }
+                }
+                ta_id = 0;
+                clause_id++;
+            }
         }
+        states_done += chunk_size;
     }
-    free(flat_states);
+    free(chunk);
+    stm_update_include_counts(stm);
+    stm_update_posting_lists(stm);
 
     fclose(file);
     return stm;
 }
 
 
+// Shared state of the clause jobs of stm_from_dense and stm_to_dense
+struct STMConversion {
+    const struct TsetlinMachine *tm_source;
+    struct TsetlinMachine *tm;
+    const struct SparseTsetlinMachine *stm_source;
+    struct SparseTsetlinMachine *stm;
+    int8_t absent_state;  // dense state of the TAs missing from the sparse lists
+    uint8_t failed;  // set by a job if memory allocation failed
+};
+
+// Build the TA lists of clauses clause_start .. clause_end - 1 from the dense states, keeping the TAs at or above sparse_min_state
+static void stm_from_dense_clauses(void *arg, uint32_t clause_start, uint32_t clause_end) {
+    struct STMConversion *conversion = (struct STMConversion *)arg;
+    const struct TsetlinMachine *tm = conversion->tm_source;
+    struct SparseTsetlinMachine *stm = conversion->stm;
+
+    for (uint32_t clause_id = clause_start; clause_id < clause_end; clause_id++) {
+        const int8_t *positive = tm->ta_state + ((size_t)clause_id * 2 * tm->ta_plane_size);
+        const int8_t *negated = positive + tm->ta_plane_size;
+        uint32_t size = 0;
+        for (uint32_t literal_id = 0; literal_id < stm->num_literals; literal_id++) {
+            size += (positive[literal_id] >= stm->sparse_min_state) + (negated[literal_id] >= stm->sparse_min_state);
+        }
+        if (size == 0) {
+            continue;
+        }
+
+        // Exact capacity, as after stm_load_dense
+        struct TAStateList *list = stm->ta_state + clause_id;
+        list->nodes = malloc((size_t)size * stm->node_size);  // shape: (size) of node_size bytes
+        if (list->nodes == NULL) {
+            perror("Memory allocation failed");
+            __atomic_store_n(&conversion->failed, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        list->capacity = size;
+
+        uint32_t include_count = 0;
+        for (uint32_t literal_id = 0; literal_id < stm->num_literals; literal_id++) {
+            if (positive[literal_id] >= stm->sparse_min_state) {
+                ta_state_set(list, list->size++, (struct TAStateNodeWide){.ta_id = 2 * literal_id, .ta_state = positive[literal_id]}, stm->node_size);
+                include_count += action(positive[literal_id], stm->mid_state);
+            }
+            if (negated[literal_id] >= stm->sparse_min_state) {
+                ta_state_set(list, list->size++, (struct TAStateNodeWide){.ta_id = 2 * literal_id + 1, .ta_state = negated[literal_id]}, stm->node_size);
+                include_count += action(negated[literal_id], stm->mid_state);
+            }
+        }
+        stm->clause_include_count[clause_id] = include_count;
+    }
+}
+
+// Convert a dense Tsetlin Machine into a sparse one, in memory
+struct SparseTsetlinMachine *stm_from_dense(const struct TsetlinMachine *tm, uint32_t num_threads) {
+    struct SparseTsetlinMachine *stm = stm_create(
+        tm->num_classes, tm->threshold, tm->num_literals, tm->num_clauses,
+        tm->max_state, tm->min_state, tm->boost_true_positive_feedback,
+        tm->y_size, tm->y_element_size, tm->s, 0
+    );
+    if (!stm) {
+        fprintf(stderr, "stm_create failed\n");
+        return NULL;
+    }
+    stm->rng = tm->rng;
+    memcpy(stm->weights, tm->weights, (size_t)tm->num_clauses * tm->num_classes * sizeof(int16_t));
+
+    struct STMConversion conversion = {.tm_source = tm, .stm = stm};
+    run_clause_ranges(stm_from_dense_clauses, &conversion, stm->num_clauses, num_threads);
+    if (conversion.failed) {
+        stm_free(stm);
+        return NULL;
+    }
+    stm_update_posting_lists(stm);
+
+    return stm;
+}
+
+
+// Write the dense states and include masks of clauses clause_start .. clause_end - 1 from the TA lists
+static void stm_to_dense_clauses(void *arg, uint32_t clause_start, uint32_t clause_end) {
+    struct STMConversion *conversion = (struct STMConversion *)arg;
+    const struct SparseTsetlinMachine *stm = conversion->stm_source;
+    struct TsetlinMachine *tm = conversion->tm;
+
+    for (uint32_t clause_id = clause_start; clause_id < clause_end; clause_id++) {
+        int8_t *planes[2];
+        planes[0] = tm->ta_state + ((size_t)clause_id * 2 * tm->ta_plane_size);
+        planes[1] = planes[0] + tm->ta_plane_size;
+        memset(planes[0], conversion->absent_state, tm->num_literals);
+        memset(planes[1], conversion->absent_state, tm->num_literals);
+
+        uint64_t *masks[2];
+        masks[0] = tm->include_mask + ((size_t)clause_id * tm->mask_row_size);
+        masks[1] = tm->include_negated_mask + ((size_t)clause_id * tm->mask_row_size);
+        memset(masks[0], 0, tm->mask_row_size * sizeof(uint64_t));
+        memset(masks[1], 0, tm->mask_row_size * sizeof(uint64_t));
+
+        // absent_state is below mid_state, so only listed TAs can be included
+        const struct TAStateList *list = stm->ta_state + clause_id;
+        uint32_t include_count = 0;
+        for (uint32_t node_id = 0; node_id < list->size; node_id++) {
+            struct TAStateNodeWide node = ta_state_get(list, node_id, stm->node_size);
+            uint32_t literal_id = node.ta_id / 2;
+            uint8_t negated = node.ta_id % 2;
+            planes[negated][literal_id] = node.ta_state;
+            if (action(node.ta_state, tm->mid_state)) {
+                masks[negated][literal_id / 64] |= (uint64_t)1 << (literal_id % 64);
+                include_count++;
+            }
+        }
+        tm->clause_include_count[clause_id] = include_count;
+    }
+}
+
+// Convert a sparse Tsetlin Machine into a dense one, in memory
+struct TsetlinMachine *stm_to_dense(const struct SparseTsetlinMachine *stm, uint32_t num_threads) {
+    struct TsetlinMachine *tm = tm_create(
+        stm->num_classes, stm->threshold, stm->num_literals, stm->num_clauses,
+        stm->max_state, stm->min_state, stm->boost_true_positive_feedback,
+        stm->y_size, stm->y_element_size, stm->s, 0
+    );
+    if (!tm) {
+        fprintf(stderr, "tm_create failed\n");
+        return NULL;
+    }
+    tm->rng = stm->rng;
+    memcpy(tm->weights, stm->weights, (size_t)stm->num_clauses * stm->num_classes * sizeof(int16_t));
+
+    // Missing TAs fell below sparse_min_state (or were never inserted), put them just below it
+    int32_t absent_state = (int32_t)stm->sparse_min_state - 1;
+    struct STMConversion conversion = {
+        .stm_source = stm, .tm = tm,
+        .absent_state = (int8_t)(absent_state < stm->min_state ? stm->min_state : absent_state),
+    };
+    run_clause_ranges(stm_to_dense_clauses, &conversion, tm->num_clauses, num_threads);
+
+    return tm;
+}
+
 // Save Tsetlin Machine to a bin file
 void stm_save(const struct SparseTsetlinMachine *stm, const char *filename) {
     FILE *file = fopen(filename, "wb");
@@ -307,19 +487,19 @@ void stm_save(const struct SparseTsetlinMachine *stm, const char *filename) {
         goto save_error;
     }
     for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
-    	struct TAStateNode *curr_ptr = stm->ta_state[clause_id];
-    	while (curr_ptr != NULL) {
-    		written = fwrite(&curr_ptr->ta_id, sizeof(uint32_t), 1, file);
+    	const struct TAStateList *list = stm->ta_state + clause_id;
+    	for (uint32_t node_id = 0; node_id < list->size; node_id++) {
+            struct TAStateNodeWide node = ta_state_get(list, node_id, stm->node_size);
+    		written = fwrite(&node.ta_id, sizeof(uint32_t), 1, file);
 			if (written != 1) {
 				fprintf(stderr, "Failed to write node ta_id\n");
 				goto save_error;
     		}
-    		written = fwrite(&curr_ptr->ta_state, sizeof(int8_t), 1, file);
+    		written = fwrite(&node.ta_state, sizeof(int8_t), 1, file);
 			if (written != 1) {
 				fprintf(stderr, "Failed to write node ta_state\n");
 				goto save_error;
     		}
-			curr_ptr = curr_ptr->next;
     	}
     	uint32_t delim = UINT_MAX;
 		written = fwrite(&delim, sizeof(uint32_t), 1, file);
@@ -338,20 +518,13 @@ save_error:
 }
 
 
-static inline void stm_clear_llists(struct SparseTsetlinMachine *stm) {
-	for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
-		struct TAStateNode **head_ptr = stm->ta_state + clause_id;
-		while (*head_ptr != NULL) {
-			ta_state_remove(head_ptr, NULL, NULL);
-		}
-    }
-}
-
 // Free all allocated memory
 void stm_free(struct SparseTsetlinMachine *stm) {
     if (stm != NULL){
     	if (stm->ta_state != NULL) {
-            stm_clear_llists(stm);
+            for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
+                free(stm->ta_state[clause_id].nodes);
+            }
             free(stm->ta_state);
             stm->ta_state = NULL;
 		}
@@ -376,6 +549,17 @@ void stm_free(struct SparseTsetlinMachine *stm) {
             stm->votes = NULL;
         }
         
+        if (stm->clause_include_count != NULL) {
+            free(stm->clause_include_count);
+            stm->clause_include_count = NULL;
+        }
+
+        free(stm->posting_offsets);
+        free(stm->posting_clauses);
+        free(stm->clause_positive_count);
+        free(stm->clause_hits);
+        free(stm->row_literals);
+        
         free(stm);
     }
     
@@ -388,8 +572,13 @@ void stm_initialize(struct SparseTsetlinMachine *stm) {
     stm->mid_state = (stm->max_state + stm->min_state) / 2;
     stm->sparse_min_state = stm->mid_state - 40;
     stm->sparse_init_state = stm->sparse_min_state + 5;
+    // With a narrow state range (max_state - min_state < 80), new TAs start at min_state instead of below it
+    if (stm->sparse_init_state < stm->min_state) {
+        stm->sparse_init_state = stm->min_state;
+    }
     stm->s_inv = 1.0f / stm->s;
     stm->s_min1_inv = (stm->s - 1.0f) / stm->s;
+    stm->s_inv_geometric_scale = prng_geometric_scale(stm->s_inv);
 
     // Sparse Tsetlin Machine starts with empty clauses
     
@@ -405,66 +594,129 @@ void stm_initialize(struct SparseTsetlinMachine *stm) {
     }
 }
 
+// Only stm_train_parallel sets clause_locks, single threaded code pays one predictable branch
+static inline void clause_lock(struct SparseTsetlinMachine *stm, uint32_t clause_id) {
+    if (stm->clause_locks != NULL) {
+        pthread_mutex_lock(stm->clause_locks + clause_id);
+    }
+}
+
+static inline void clause_unlock(struct SparseTsetlinMachine *stm, uint32_t clause_id) {
+    if (stm->clause_locks != NULL) {
+        pthread_mutex_unlock(stm->clause_locks + clause_id);
+    }
+}
+
 // Calculate the output of each clause using the actions of each Tsetlin Automaton
 // Meaning: which clauses are active for given input
 // Output is stored an internal output array clause_output
-static inline void calculate_clause_output(struct SparseTsetlinMachine *stm, const uint8_t *X, uint8_t skip_empty) {
+// node_size is a constant at every call, so each node type gets its own loop without a branch per node
+static inline void calculate_clause_output_nodes(struct SparseTsetlinMachine *stm, const uint8_t *X, uint8_t skip_empty, uint8_t node_size) {
     // For each clause, check if it is "active" - all necessary literals have the right value
     for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
-        stm->clause_output[clause_id] = 1;
-        uint8_t empty_clause = 1;
+        clause_lock(stm, clause_id);
 
 		// Clause is active if:
         // - it's not empty (unless skip_empty is unset as should be the case for training)
         // - each literal present in the clause has the right value (same as the input X)
-        // Iterate over linked list of Tsetlin Automata
-        struct TAStateNode *curr_ptr = stm->ta_state[clause_id];
-		while (curr_ptr != NULL) {
-			if (action(curr_ptr->ta_state, stm->mid_state)) {
-				empty_clause = 0;
-				if (curr_ptr->ta_id % 2 == X[curr_ptr->ta_id / 2]) {
-					stm->clause_output[clause_id] = 0;
-					break;
-				}
+        if (stm->clause_include_count[clause_id] == 0) {
+            // Nothing to check, no need to walk the list
+            stm->clause_output[clause_id] = !skip_empty;
+            clause_unlock(stm, clause_id);
+            continue;
+        }
+        stm->clause_output[clause_id] = 1;
+
+        // Iterate over the clause's Tsetlin Automata
+        // Packed nodes are contiguous 32 bit words, so the SIMD kernel checks them several at a time
+        // (without SIMD, the inline loop below beats a kernel call per clause)
+        const struct TAStateList *list = stm->ta_state + clause_id;
+        if (node_size == sizeof(struct TAStateNode) && simd_kernels.level != SIMD_SCALAR) {
+            stm->clause_output[clause_id] = simd_kernels.node_clause_output(list->nodes, list->size, X, stm->num_literals, stm->mid_state);
+            clause_unlock(stm, clause_id);
+            continue;
+        }
+		for (uint32_t node_id = 0; node_id < list->size; node_id++) {
+			struct TAStateNodeWide node = ta_state_get(list, node_id, node_size);
+			if (action(node.ta_state, stm->mid_state) && node.ta_id % 2 == X[node.ta_id / 2]) {
+				stm->clause_output[clause_id] = 0;
+				break;
 			}
-			curr_ptr = curr_ptr->next;
-		}
-		if (empty_clause && skip_empty) {
-			stm->clause_output[clause_id] = 0;
 		}
+
+        clause_unlock(stm, clause_id);
+    }
+}
+
+static inline void calculate_clause_output(struct SparseTsetlinMachine *stm, const uint8_t *X, uint8_t skip_empty) {
+    if (stm->node_size == sizeof(struct TAStateNode)) {
+        calculate_clause_output_nodes(stm, X, skip_empty, sizeof(struct TAStateNode));
+    }
+    else {
+        calculate_clause_output_nodes(stm, X, skip_empty, sizeof(struct TAStateNodeWide));
     }
 }
 
 
 // Sum up the votes of each clause for each class
-static inline void sum_votes(struct SparseTsetlinMachine *stm) {
-    memset(stm->votes, 0, stm->num_classes*sizeof(int32_t));
-    
+// Returns the index of the first class with the highest vote
+static inline uint32_t sum_votes(struct SparseTsetlinMachine *stm) {
     // Simple sum of votes for each class, then clip them to the threshold
-    for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
-        if (stm->clause_output[clause_id] == 0) {
-            continue;
-        }
-        
-        for (uint32_t class_id = 0; class_id < stm->num_classes; class_id++) {
-            stm->votes[class_id] += stm->weights[(clause_id * stm->num_classes) + class_id];
-        }
+    return simd_kernels.sum_votes(stm->clause_output, stm->weights, stm->num_clauses, stm->num_classes, (int32_t)stm->threshold, stm->votes);
+}
+
+
+// Pass the votes through the output activation function
+// best_class comes from the vote kernels, so the default stm_oa_class_idx doesn't have to scan the votes again
+static inline void activate_output(struct SparseTsetlinMachine *stm, uint32_t best_class, void *y_pred_row) {
+    if (stm->output_activation == stm_oa_class_idx && stm->y_size == 1) {
+        *(uint32_t *)y_pred_row = best_class;
     }
-    
-    for (uint32_t class_id = 0; class_id < stm->num_classes; class_id++) {
-        stm->votes[class_id] = clip(stm->votes[class_id], (int32_t)stm->threshold);
+    else {
+        stm->output_activation(stm, y_pred_row);
+    }
+}
+
+
+// Number of TAs to pass over before the next 1/s event
+// Trials are independent, so drawing the gap once replaces one prng_next_float per TA
+static inline uint32_t next_s_inv_gap(struct SparseTsetlinMachine *stm) {
+    return prng_next_geometric(&(stm->rng), stm->s_inv_geometric_scale);
+}
+
+// Position of the first list node hit by a 1/s event, starting at node_id, UINT32_MAX if there is none
+static inline uint32_t next_s_inv_event(struct SparseTsetlinMachine *stm, uint32_t node_id) {
+    return prng_next_event(&(stm->rng), stm->s_inv_geometric_scale, node_id);
+}
+
+// Literals set in X (stm->row_literals[0 .. count - 1]), returns count
+// Collected on the first call for a row, the feedback of every other clause on the same row reuses them
+static inline uint32_t set_literals(struct SparseTsetlinMachine *stm, const uint8_t *X) {
+    if (stm->row_literals_X != X) {
+        stm->num_row_literals = collect_row_literals(X, stm->num_literals, stm->row_literals);
+        stm->row_literals_X = X;
     }
+    return stm->num_row_literals;
+}
+
+// 64 active literals of a class starting at literal word_id * 64, bit literal_id % 64 (bytes past al_row_size read as 0)
+static inline uint64_t active_literals_word(const uint8_t *class_active_literals, uint32_t al_row_size, uint32_t word_id) {
+    uint64_t word = 0;
+    uint32_t offset = word_id * sizeof(uint64_t);
+    memcpy(&word, class_active_literals + offset, min(al_row_size - offset, (uint32_t)sizeof(uint64_t)));
+    return word;
 }
 
 
 // Type I Feedback
 // Applied if clause at clause_id voted correctly for class at class_id
+// 1/s decisions (punish, or a missed reward without boost) are skip-sampled with next_s_inv_gap
 
 // Type I a - Clause is active for literals X (clause_output == 1)
 // Meaning: it's active and voted correctly
 // Action: reinforce the clause TAs and weights
 // Intuition: so that it continues to vote for the same class
-void type_1a_feedback(struct SparseTsetlinMachine *stm, const uint8_t *X, uint32_t clause_id, uint32_t class_id) {
+static inline void type_1a_feedback_nodes(struct SparseTsetlinMachine *stm, const uint8_t *X, uint32_t clause_id, uint32_t class_id, uint8_t node_size) {
     // float s_inv = 1.0f / stm->s;
     // float s_min1_inv = (stm->s - 1.0f) / stm->s;
 
@@ -478,51 +730,85 @@ void type_1a_feedback(struct SparseTsetlinMachine *stm, const uint8_t *X, uint32
         stm->weights[clause_id * stm->num_classes + class_id] -= min(feedback_strength, -(SHRT_MIN - stm->weights[clause_id * stm->num_classes + class_id]));
     }
     
-    // Reinforce the Tsetlin Automata states
-    struct TAStateNode *state_ptr = stm->ta_state[clause_id];
-    struct TAStateNode *prev_state_ptr = NULL;
-
-    for (uint32_t i = 0; i < stm->num_literals * 2; i++) {
-        uint32_t literal_id = i >> 1;  // i / 2
-        uint8_t is_negative_TA = i & 1;  // i % 2
-        uint8_t is_active_literal = stm->active_literals[class_id * stm->al_row_size + (literal_id >> 3)] & (1 << (literal_id & 7));
-
-        // If there's no Tsetlin Automaton for this literal
-    	if (state_ptr == NULL || state_ptr->ta_id != i) {
-            // Check if this literal should be added to active literals for this class
-    		if (!is_active_literal && !is_negative_TA && X[literal_id] == 1) {
-                // (i % 2 != X[i / 2]) means TA i "votes" correctly (condition for applying 1a feedback)
-
-				// Insert new active literal literal_id for class class_id
-				stm->active_literals[class_id * stm->al_row_size + (literal_id >> 3)] |= (1 << (literal_id & 7));
-    		}
-    		continue;
-    	}
-        // Else, there is a Tsetlin Automaton for this literal so reinforce it
+    // Reinforce the Tsetlin Automata states, merged with the literals set in X
+    // so that only those and the list nodes are visited, not all 2 * num_literals TAs
+    // Nodes only move down (TAs falling below sparse_min_state are dropped), so the list is compacted in the same pass
+    struct TAStateList *list = stm->ta_state + clause_id;
+    uint8_t *class_active_literals = stm->active_literals + class_id * stm->al_row_size;
+    uint32_t num_set_literals = set_literals(stm, X);
+    uint32_t set_id = 0;  // next set literal to merge
+    uint32_t kept = 0;  // nodes kept so far, written back to nodes 0 .. kept - 1
+    uint32_t reward_gap = stm->boost_true_positive_feedback == 1 ? UINT32_MAX : next_s_inv_gap(stm);
+    uint32_t punish_gap = next_s_inv_gap(stm);
+
+    for (uint32_t node_id = 0; node_id <= list->size; node_id++) {
+        // ta_id past the last node flushes the remaining set literals
+        struct TAStateNodeWide node = {.ta_id = UINT32_MAX};
+        if (node_id < list->size) {
+            node = ta_state_get(list, node_id, node_size);
+        }
+        uint32_t ta_id = node.ta_id;
+
+        // A set literal without a TA for its positive literal becomes active for this class
+        // (TA 2 * literal_id "votes" correctly, condition for applying 1a feedback)
+        for (; set_id < num_set_literals && 2 * stm->row_literals[set_id] <= ta_id; set_id++) {
+            uint32_t literal_id = stm->row_literals[set_id];
+            if (2 * literal_id != ta_id) {
+                class_active_literals[literal_id >> 3] |= (1 << (literal_id & 7));
+            }
+        }
+        if (node_id == list->size) {
+            break;
+        }
+
+        uint32_t literal_id = ta_id >> 1;  // ta_id / 2
+        uint8_t is_negative_TA = ta_id & 1;  // ta_id % 2
+        uint8_t was_included = action(node.ta_state, stm->mid_state);
 
         // X[literal_id] should equal action at ta_id (ta_id/2 == literal_id)
-        if ((state_ptr->ta_id & 1) != X[state_ptr->ta_id >> 1]) {
-            // Correct, reward
-            state_ptr->ta_state +=
-				min(stm->max_state - state_ptr->ta_state, feedback_strength) *
-				(stm->boost_true_positive_feedback == 1 || prng_next_float(&(stm->rng)) <= stm->s_min1_inv);
+        if (is_negative_TA != X[literal_id]) {
+            // Correct, reward with probability (s-1)/s (always if boosted)
+            uint8_t rewarded = reward_gap != 0;
+            if (rewarded) {
+                reward_gap -= reward_gap != UINT32_MAX;
+            }
+            else {
+                reward_gap = next_s_inv_gap(stm);
+            }
+
+            node.ta_state += min(stm->max_state - node.ta_state, feedback_strength) * rewarded;
+            stm->clause_include_count[clause_id] += action(node.ta_state, stm->mid_state) - was_included;
         }
         else {
-            // Incorrect, punish
-            state_ptr->ta_state -=
-				min(-(stm->min_state - state_ptr->ta_state), feedback_strength) *
-				prng_next_float(&(stm->rng)) <= stm->s_inv;
-
-            if (state_ptr->ta_state < stm->sparse_min_state) {
-            	// If falls below threshold sparse_min_state, remove TA
-            	ta_state_remove(stm->ta_state + clause_id, prev_state_ptr, &state_ptr);
+            // Incorrect, punish with probability 1/s
+            uint8_t punished = punish_gap == 0;
+            if (punished) {
+                punish_gap = next_s_inv_gap(stm);
+            }
+            else {
+                punish_gap -= punish_gap != UINT32_MAX;
+            }
+
+            node.ta_state -= min(-(stm->min_state - node.ta_state), feedback_strength) * punished;
+            stm->clause_include_count[clause_id] += action(node.ta_state, stm->mid_state) - was_included;
+
+            if (node.ta_state < stm->sparse_min_state) {
+            	// If falls below threshold sparse_min_state, remove TA (by not keeping it)
                 continue;
             }
         }
 
-        // Advance to next TA
-        prev_state_ptr = state_ptr;
-        state_ptr = state_ptr->next;
+        ta_state_set(list, kept++, node, node_size);
+    }
+    list->size = kept;
+}
+
+void type_1a_feedback(struct SparseTsetlinMachine *stm, const uint8_t *X, uint32_t clause_id, uint32_t class_id) {
+    if (stm->node_size == sizeof(struct TAStateNode)) {
+        type_1a_feedback_nodes(stm, X, clause_id, class_id, sizeof(struct TAStateNode));
+    }
+    else {
+        type_1a_feedback_nodes(stm, X, clause_id, class_id, sizeof(struct TAStateNodeWide));
     }
 }
 
@@ -531,38 +817,73 @@ void type_1a_feedback(struct SparseTsetlinMachine *stm, const uint8_t *X, uint32
 // Meaning: it's inactive but would have voted correctly
 // Action: lower the clause TAs, both positive and negative, towards exclusion
 // Intuition: so that it "finds something else to do", "countering force"
-void type_1b_feedback(struct SparseTsetlinMachine *stm, uint32_t clause_id) {
-    // float s_inv = 1.0f / stm->s;
-
+static inline void type_1b_feedback_nodes(struct SparseTsetlinMachine *stm, uint32_t clause_id, uint8_t node_size) {
     uint8_t feedback_strength = 1;
 
-    // Penalize the clause TAs (towards min_state - exclusion)
-    struct TAStateNode *state_ptr = stm->ta_state[clause_id];
-    struct TAStateNode *prev_state_ptr = NULL;
-    for (uint32_t i = 0; i < stm->num_literals * 2; i++) {
-    	// If there's no Tsetlin Automaton for this literal, skip it
-    	if (state_ptr == NULL || state_ptr->ta_id != i) {
-    		continue;
-    	}
-        // Else, there is a Tsetlin Automaton for this literal so penalize it
-
-        state_ptr->ta_state -=
-			min(-(stm->min_state - state_ptr->ta_state), feedback_strength) *
-			prng_next_float(&(stm->rng)) <= stm->s_inv;
+    // Penalize the clause TAs (towards min_state - exclusion) with probability 1/s
+    // Only the nodes of the list can change, so jump from one penalized node to the next
+    struct TAStateList *list = stm->ta_state + clause_id;
+    uint8_t any_removed = 0;
+    for (uint32_t node_id = next_s_inv_event(stm, 0); node_id < list->size; node_id = next_s_inv_event(stm, node_id + 1)) {
+        struct TAStateNodeWide node = ta_state_get(list, node_id, node_size);
+        uint8_t was_included = action(node.ta_state, stm->mid_state);
+
+        node.ta_state -= min(-(stm->min_state - node.ta_state), feedback_strength);
+        stm->clause_include_count[clause_id] -= was_included - action(node.ta_state, stm->mid_state);
+        any_removed |= node.ta_state < stm->sparse_min_state;
+        ta_state_set(list, node_id, node, node_size);
+    }
 
-        if (state_ptr->ta_state < stm->sparse_min_state) {
-        	// If falls below threshold sparse_min_state, remove TA
-            ta_state_remove(stm->ta_state + clause_id, prev_state_ptr, &state_ptr);
-        	continue;
+    // If any fell below threshold sparse_min_state, remove them (rare, the list is left alone otherwise)
+    if (any_removed) {
+        uint32_t kept = 0;
+        for (uint32_t node_id = 0; node_id < list->size; node_id++) {
+            struct TAStateNodeWide node = ta_state_get(list, node_id, node_size);
+            if (node.ta_state >= stm->sparse_min_state) {
+                ta_state_set(list, kept++, node, node_size);
+            }
         }
+        list->size = kept;
+    }
+}
 
-        // Advance to next TA
-        prev_state_ptr = state_ptr;
-        state_ptr = state_ptr->next;
+void type_1b_feedback(struct SparseTsetlinMachine *stm, uint32_t clause_id) {
+    if (stm->node_size == sizeof(struct TAStateNode)) {
+        type_1b_feedback_nodes(stm, clause_id, sizeof(struct TAStateNode));
+    }
+    else {
+        type_1b_feedback_nodes(stm, clause_id, sizeof(struct TAStateNodeWide));
     }
 }
 
 
+// Type II raise of the clause TAs from node *node_id up to TA end_ta_id (inclusive), moving *node_id past them
+// Excluded TAs that could deactivate the clause if included (ta_id % 2 == X[ta_id / 2]) are raised
+// Returns 1 if the clause has no TA end_ta_id (it's missing), 0 otherwise
+static inline uint8_t raise_tas_until(
+    struct SparseTsetlinMachine *stm, const uint8_t *X, uint32_t clause_id, uint32_t *node_id, uint32_t end_ta_id, uint8_t node_size
+) {
+    struct TAStateList *list = stm->ta_state + clause_id;
+    for (; *node_id < list->size; (*node_id)++) {
+        struct TAStateNodeWide node = ta_state_get(list, *node_id, node_size);
+        if (node.ta_id > end_ta_id) {
+            break;
+        }
+        uint8_t was_included = action(node.ta_state, stm->mid_state);
+        node.ta_state +=
+            min(stm->max_state - node.ta_state, 1) * (
+            0 == was_included &&
+            ((node.ta_id & 1) == X[node.ta_id >> 1]));
+        stm->clause_include_count[clause_id] += action(node.ta_state, stm->mid_state) - was_included;
+        ta_state_set(list, *node_id, node, node_size);
+        if (node.ta_id == end_ta_id) {
+            (*node_id)++;
+            return 0;
+        }
+    }
+    return 1;
+}
+
 // Type II Feedback
 // Clause at clause_id voted incorrectly for class at class_id
 // && Clause is active for literals X (clause_output == 1)
@@ -570,50 +891,175 @@ void type_1b_feedback(struct SparseTsetlinMachine *stm, uint32_t clause_id) {
 // Action: raise excluded clause TAs that could deactivate the clause is included (towards inclusion)
 // and punish the clause weight (towards zero)
 // Intuition: either fix the weight or exclude the clause, whichever is easier
-void type_2_feedback(struct SparseTsetlinMachine *stm, const uint8_t *X, uint32_t clause_id, uint32_t class_id) {
+static inline void type_2_feedback_nodes(struct SparseTsetlinMachine *stm, const uint8_t *X, uint32_t clause_id, uint32_t class_id, uint8_t node_size) {
     uint8_t feedback_strength = 1;
 
     stm->weights[clause_id * stm->num_classes + class_id] +=
         stm->weights[clause_id * stm->num_classes + class_id] >= 0 ? -feedback_strength : feedback_strength;
 
-    struct TAStateNode *state_ptr = stm->ta_state[clause_id];
-    struct TAStateNode *prev_state_ptr = NULL;
+    // Raise the existing TAs, and count the missing ones to insert
+    // Missing TAs are added for the active literals of this class (from type I a): the positive one,
+    // and the negated one if the literal is set in X ((ta_id % 2 == X[ta_id / 2]) means TA ta_id "votes" incorrectly)
+    // Candidates come from a bit scan of the active literals merged with the sorted list,
+    // so only those and the list nodes are visited, not all 2 * num_literals TAs
+    struct TAStateList *list = stm->ta_state + clause_id;
+    const uint8_t *class_active_literals = stm->active_literals + class_id * stm->al_row_size;
+    uint32_t num_words = (stm->al_row_size - 1) / sizeof(uint64_t) + 1;
+    uint32_t node_id = 0;
+    uint32_t num_inserts = 0;
+    for (uint32_t word_id = 0; word_id < num_words; word_id++) {
+        uint64_t word = active_literals_word(class_active_literals, stm->al_row_size, word_id);
+        while (word != 0) {
+            uint32_t literal_id = word_id * 64 + __builtin_ctzll(word);
+            word &= word - 1;
+
+            num_inserts += raise_tas_until(stm, X, clause_id, &node_id, 2 * literal_id, node_size);
+            if (X[literal_id] == 1) {
+                num_inserts += raise_tas_until(stm, X, clause_id, &node_id, 2 * literal_id + 1, node_size);
+            }
+        }
+    }
+    raise_tas_until(stm, X, clause_id, &node_id, UINT32_MAX, node_size);
 
-    for (uint32_t i = 0; i < stm->num_literals * 2; i++) {
-        uint32_t literal_id = i >> 1;  // i / 2
-        uint8_t is_negative_TA = i & 1;  // i % 2
-        uint8_t is_active_literal = stm->active_literals[class_id * stm->al_row_size + (literal_id >> 3)] & (1 << (literal_id & 7));
+    if (num_inserts == 0) {
+        return;
+    }
+    if (!ta_state_reserve(list, list->size + num_inserts, node_size)) {
+        perror("Memory allocation failed");
+        exit(1);
+    }
 
-        // If there's no Tsetlin Automaton for this literal
-    	if (state_ptr == NULL || state_ptr->ta_id != i) {
-            // Check if Tsetlin Automaton for this literal should be added
-            // Prerequisite: this literal is active for this class (from type I a)
-            if (is_active_literal && (!is_negative_TA || (is_negative_TA && X[literal_id] == 1))) {
-                // (i % 2 == X[i / 2]) means TA i "votes" incorrectly (condition for applying 2 feedback)
+    // Insert new TAs with state sparse_init_state, merging from the back so that every node moves at most once
+    // (the bit scan runs backwards too, and stops as soon as every new TA is in place)
+    uint32_t read = list->size;
+    uint32_t write = list->size + num_inserts;
+    for (uint32_t word_id = num_words; word_id-- > 0 && write > read;) {
+        uint64_t word = active_literals_word(class_active_literals, stm->al_row_size, word_id);
+        while (word != 0 && write > read) {
+            uint32_t bit = 63 - __builtin_clzll(word);
+            uint32_t literal_id = word_id * 64 + bit;
+            word &= ~((uint64_t)1 << bit);
+
+            // Negated TA first, the list is sorted by ta_id
+            for (uint32_t ta_id = 2 * literal_id + (X[literal_id] == 1); ta_id + 1 > 2 * literal_id; ta_id--) {
+                struct TAStateNodeWide node;
+                while (read > 0 && (node = ta_state_get(list, read - 1, node_size)).ta_id > ta_id) {
+                    ta_state_set(list, --write, node, node_size);
+                    read--;
+                }
+                if (read > 0 && node.ta_id == ta_id) {
+                    ta_state_set(list, --write, node, node_size);
+                    read--;
+                }
+                else {
+                    ta_state_set(list, --write, (struct TAStateNodeWide){.ta_id = ta_id, .ta_state = stm->sparse_init_state}, node_size);
+                }
+            }
+        }
+    }
+    list->size += num_inserts;
+}
 
-				// Insert new TA with state stm->mid_state
-				ta_state_insert(stm->ta_state + clause_id, prev_state_ptr, i, stm->sparse_init_state, &prev_state_ptr);
-				state_ptr = prev_state_ptr->next;
-    		}
-    		continue;
-    	}
-        // Else, there is a Tsetlin Automaton for this literal so raise it
+void type_2_feedback(struct SparseTsetlinMachine *stm, const uint8_t *X, uint32_t clause_id, uint32_t class_id) {
+    if (stm->node_size == sizeof(struct TAStateNode)) {
+        type_2_feedback_nodes(stm, X, clause_id, class_id, sizeof(struct TAStateNode));
+    }
+    else {
+        type_2_feedback_nodes(stm, X, clause_id, class_id, sizeof(struct TAStateNodeWide));
+    }
+}
 
-        state_ptr->ta_state +=
-            min(stm->max_state - state_ptr->ta_state, feedback_strength) * (
-            0 == action(state_ptr->ta_state, stm->mid_state) &&
-            (is_negative_TA == X[literal_id]));
 
-        // Advance to next TA
-        prev_state_ptr = state_ptr;
-        state_ptr = state_ptr->next;
+// Recount clause_include_count from the TA lists
+void stm_update_include_counts(struct SparseTsetlinMachine *stm) {
+    for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
+        const struct TAStateList *list = stm->ta_state + clause_id;
+        uint32_t count = 0;
+        for (uint32_t node_id = 0; node_id < list->size; node_id++) {
+            count += action(ta_state_get(list, node_id, stm->node_size).ta_state, stm->mid_state);
+        }
+        stm->clause_include_count[clause_id] = count;
     }
 }
 
 
-void stm_train(struct SparseTsetlinMachine *stm, const uint8_t *X, const void *y, uint32_t rows, uint32_t epochs) {
+static void stm_free_posting_lists(struct SparseTsetlinMachine *stm) {
+    free(stm->posting_offsets);
+    free(stm->posting_clauses);
+    free(stm->clause_positive_count);
+    free(stm->clause_hits);
+    stm->posting_offsets = NULL;
+    stm->posting_clauses = NULL;
+    stm->clause_positive_count = NULL;
+    stm->clause_hits = NULL;
+}
+
+// Rebuild the literal -> clause posting lists from the TA lists
+// Postings of each TA come out sorted by clause_id
+void stm_update_posting_lists(struct SparseTsetlinMachine *stm) {
+    uint32_t num_tas = stm->num_literals * 2;
+    if (stm->posting_offsets == NULL) {
+        stm->posting_offsets = (uint32_t *)malloc((num_tas + 1) * sizeof(uint32_t));  // shape: (2 * num_literals + 1)
+        stm->clause_positive_count = (uint32_t *)malloc(stm->num_clauses * sizeof(uint32_t));  // shape: (num_clauses)
+        stm->clause_hits = (uint32_t *)malloc(stm->num_clauses * sizeof(uint32_t));  // shape: (num_clauses)
+        if (stm->posting_offsets == NULL || stm->clause_positive_count == NULL || stm->clause_hits == NULL) {
+            perror("Memory allocation failed");
+            stm_free_posting_lists(stm);
+            return;
+        }
+    }
+
+    // Count the postings of each TA (into posting_offsets[ta_id + 1]) and the positive literals of each clause
+    memset(stm->posting_offsets, 0, (num_tas + 1) * sizeof(uint32_t));
+    for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
+        const struct TAStateList *list = stm->ta_state + clause_id;
+        uint32_t positive_count = 0;
+        for (uint32_t node_id = 0; node_id < list->size; node_id++) {
+            struct TAStateNodeWide node = ta_state_get(list, node_id, stm->node_size);
+            if (action(node.ta_state, stm->mid_state)) {
+                stm->posting_offsets[node.ta_id + 1]++;
+                positive_count += node.ta_id % 2 == 0;
+            }
+        }
+        stm->clause_positive_count[clause_id] = positive_count;
+    }
+    posting_counts_to_offsets(stm->posting_offsets, num_tas);
+
+    uint32_t num_postings = stm->posting_offsets[num_tas];
+    uint32_t *posting_clauses = (uint32_t *)realloc(stm->posting_clauses, (num_postings + 1) * sizeof(uint32_t));  // shape: (num_postings)
+    if (posting_clauses == NULL) {
+        perror("Memory allocation failed");
+        stm_free_posting_lists(stm);
+        return;
+    }
+    stm->posting_clauses = posting_clauses;
+
+    for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
+        const struct TAStateList *list = stm->ta_state + clause_id;
+        for (uint32_t node_id = 0; node_id < list->size; node_id++) {
+            struct TAStateNodeWide node = ta_state_get(list, node_id, stm->node_size);
+            if (action(node.ta_state, stm->mid_state)) {
+                posting_clauses[stm->posting_offsets[node.ta_id]++] = clause_id;
+            }
+        }
+    }
+    posting_offsets_restore(stm->posting_offsets, num_tas);
+}
+
+
+// Train on rows row_ids[0..rows) (0..rows in storage order if row_ids is NULL), clause_include_count must be up to date
+// If shuffle is set, row_ids is shuffled in place with the model's PRNG before every epoch
+static void train_rows(
+    struct SparseTsetlinMachine *stm, const uint8_t *X, const void *y, uint32_t *row_ids, uint32_t rows, uint32_t epochs, uint8_t shuffle
+) {
     for (uint32_t epoch = 0; epoch < epochs; epoch++) {
-		for (uint32_t row = 0; row < rows; row++) {
+        if (shuffle) {
+            prng_shuffle(&(stm->rng), row_ids, rows);
+        }
+
+		for (uint32_t i = 0; i < rows; i++) {
+            // size_t offsets, large datasets exceed 4 GB
+            size_t row = row_ids != NULL ? row_ids[i] : i;
 			const uint8_t *X_row = X + (row * stm->num_literals);
 			void *y_row = (void *)((uint8_t *)y + (row * stm->y_size * stm->y_element_size));
 
@@ -625,28 +1071,296 @@ void stm_train(struct SparseTsetlinMachine *stm, const uint8_t *X, const void *y
 			sum_votes(stm);
 
 			// Calculate and apply feedback to all clauses
+            // X_row may be at the address of an earlier row (e.g., a reused buffer), so its set literals are collected anew
+            stm->row_literals_X = NULL;
 			stm->calculate_feedback(stm, X_row, y_row);
 		}
     }
 }
 
+void stm_train(struct SparseTsetlinMachine *stm, const uint8_t *X, const void *y, uint32_t rows, uint32_t epochs) {
+    // The lists may have been modified directly since the last call, feedback keeps the counts in sync from here on
+    stm_update_include_counts(stm);
 
-// Inference
-// y_pred should be allocated like: void *y_pred = malloc(rows * stm->y_size * stm->y_element_size);
-void stm_predict(struct SparseTsetlinMachine *stm, const uint8_t *X, void *y_pred, uint32_t rows) {
+    train_rows(stm, X, y, NULL, rows, epochs, 0);
+    stm_update_posting_lists(stm);
+}
+
+void stm_train_indexed(
+    struct SparseTsetlinMachine *stm, const uint8_t *X, const void *y, uint32_t *row_ids, uint32_t num_row_ids, uint32_t epochs, uint8_t shuffle
+) {
+    // Same as stm_train, only the row order differs
+    stm_update_include_counts(stm);
+
+    train_rows(stm, X, y, row_ids, num_row_ids, epochs, shuffle);
+    stm_update_posting_lists(stm);
+}
+
+
+// One worker of stm_train_parallel
+// Its view shares the lists, weights, active_literals and counts with the model, clause_output, votes and row_literals are its own
+struct STMTrainJob {
+    struct SparseTsetlinMachine view;
+    const uint8_t *X;
+    const void *y;
+    uint32_t rows, epochs;
+};
+
+static void stm_train_job(void *arg) {
+    struct STMTrainJob *job = (struct STMTrainJob *)arg;
+    train_rows(&job->view, job->X, job->y, NULL, job->rows, job->epochs, 0);
+}
+
+// Hogwild training, see header
+void stm_train_parallel(struct SparseTsetlinMachine *stm, const uint8_t *X, const void *y, uint32_t rows, uint32_t epochs, uint32_t num_threads) {
+    if (num_threads == 0) {
+        num_threads = default_num_threads();
+    }
+    if (num_threads > rows) {
+        num_threads = rows;
+    }
+    if (num_threads <= 1) {
+        stm_train(stm, X, y, rows, epochs);
+        return;
+    }
+
+    struct STMTrainJob *jobs = (struct STMTrainJob *)calloc(num_threads, sizeof(struct STMTrainJob));
+    pthread_mutex_t *clause_locks = (pthread_mutex_t *)malloc(stm->num_clauses * sizeof(pthread_mutex_t));  // shape: (num_clauses)
+    if (jobs == NULL || clause_locks == NULL) {
+        perror("Memory allocation failed");
+        free(jobs);
+        free(clause_locks);
+        stm_train(stm, X, y, rows, epochs);
+        return;
+    }
+
+    // Same starting point as stm_train
+    stm_update_include_counts(stm);
+    for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
+        pthread_mutex_init(clause_locks + clause_id, NULL);
+    }
+    stm->clause_locks = clause_locks;
+
+    // Split rows evenly, the first (rows % num_threads) jobs get one extra row
+    uint32_t row_start = 0;
+    uint32_t jobs_ready = 0;
+    for (; jobs_ready < num_threads; jobs_ready++) {
+        struct STMTrainJob *job = jobs + jobs_ready;
+        uint32_t job_rows = rows / num_threads + (jobs_ready < rows % num_threads);
+
+        job->view = *stm;
+        prng_seed(&(job->view.rng), prng_next_uint32(&(stm->rng)));
+        job->view.clause_output = (uint8_t *)malloc(stm->num_clauses * sizeof(uint8_t));  // shape: (num_clauses)
+        job->view.votes = (int32_t *)malloc(stm->num_classes * sizeof(int32_t));  // shape: (num_classes)
+        job->view.row_literals = (uint32_t *)malloc(stm->num_literals * sizeof(uint32_t));  // shape: (num_literals)
+        job->view.row_literals_X = NULL;
+        job->X = X + ((size_t)row_start * stm->num_literals);
+        job->y = (const void *)((const uint8_t *)y + ((size_t)row_start * stm->y_size * stm->y_element_size));
+        job->rows = job_rows;
+        job->epochs = epochs;
+        row_start += job_rows;
+
+        if (job->view.clause_output == NULL || job->view.votes == NULL || job->view.row_literals == NULL) {
+            free(job->view.clause_output);
+            free(job->view.votes);
+            free(job->view.row_literals);
+            break;
+        }
+    }
+
+    if (jobs_ready == num_threads) {
+        run_parallel_jobs(stm_train_job, jobs, sizeof(struct STMTrainJob), num_threads);
+    }
+
+    stm->clause_locks = NULL;
+    for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
+        pthread_mutex_destroy(clause_locks + clause_id);
+    }
+    free(clause_locks);
+    for (uint32_t job_id = 0; job_id < jobs_ready; job_id++) {
+        free(jobs[job_id].view.clause_output);
+        free(jobs[job_id].view.votes);
+        free(jobs[job_id].view.row_literals);
+    }
+    free(jobs);
+
+    if (jobs_ready < num_threads) {
+        // Not enough memory for every worker, fall back to serial training
+        perror("Memory allocation failed");
+        stm_train(stm, X, y, rows, epochs);
+        return;
+    }
+    stm_update_posting_lists(stm);
+}
+
+
+// Calculate the output of each clause for inference (empty clauses are inactive) through the posting lists
+// Only the postings of the literals set in X are touched, instead of the TA lists of every clause
+// Returns 0 (nothing calculated) if the posting lists aren't built or walking the TA lists is cheaper for this row
+static inline uint8_t calculate_clause_output_postings(struct SparseTsetlinMachine *stm, const uint8_t *X) {
+    if (stm->posting_offsets == NULL) {
+        return 0;
+    }
+
+    // Dense rows run out of budget early in the scan
+    size_t max_cost = stm->posting_offsets[stm->num_literals * 2] / POSTING_MAX_COST_FRACTION;
+    size_t base_cost = posting_base_cost(stm->num_literals, stm->num_clauses);
+    uint32_t num_row_literals;
+    size_t num_postings = 0;
+    stm->row_literals_X = NULL;
+    if (base_cost > max_cost ||
+            !collect_row_literals_budget(X, stm->num_literals, stm->posting_offsets, max_cost - base_cost, stm->row_literals, &num_row_literals, &num_postings)) {
+        return 0;
+    }
+
+    count_posting_hits(stm->posting_offsets, stm->posting_clauses, stm->row_literals, num_row_literals, stm->num_clauses, stm->clause_hits);
+    for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
+        stm->clause_output[clause_id] = stm->clause_include_count[clause_id] != 0 && stm->clause_hits[clause_id] == stm->clause_positive_count[clause_id];
+    }
+    return 1;
+}
+
+// Predict rows one by one
+static void predict_rows(struct SparseTsetlinMachine *stm, const uint8_t *X, void *y_pred, uint32_t rows) {
     for (uint32_t row = 0; row < rows; row++) {
-    	const uint8_t* X_row = X + (row * stm->num_literals);
-        void *y_pred_row = (void *)(((uint8_t *)y_pred) + (row * stm->y_size * stm->y_element_size));
+    	const uint8_t* X_row = X + ((size_t)row * stm->num_literals);
+        void *y_pred_row = (void *)(((uint8_t *)y_pred) + ((size_t)row * stm->y_size * stm->y_element_size));
 
         // Calculate clause output - which clauses are active for this row of input
-        calculate_clause_output(stm, X_row, 1);
+        if (!calculate_clause_output_postings(stm, X_row)) {
+            calculate_clause_output(stm, X_row, 1);
+        }
 
         // Sum up clause votes for each class
-        sum_votes(stm);
+        uint32_t best_class = sum_votes(stm);
 
         // Pass through output activation function to get output in desired format
-        stm->output_activation(stm, y_pred_row);
+        activate_output(stm, best_class, y_pred_row);
+    }
+}
+
+// Inference
+// y_pred should be allocated like: void *y_pred = malloc(rows * stm->y_size * stm->y_element_size);
+void stm_predict(struct SparseTsetlinMachine *stm, const uint8_t *X, void *y_pred, uint32_t rows) {
+    predict_rows(stm, X, y_pred, rows);
+}
+
+
+// Create a per-caller inference context for stm
+struct SparseTsetlinMachineContext *stm_context_create(const struct SparseTsetlinMachine *stm) {
+    struct SparseTsetlinMachineContext *ctx = (struct SparseTsetlinMachineContext *)calloc(1, sizeof(struct SparseTsetlinMachineContext));
+    if (ctx == NULL) {
+        perror("Memory allocation failed");
+        return NULL;
+    }
+
+    ctx->clause_output = (uint8_t *)malloc(stm->num_clauses * sizeof(uint8_t));  // shape: (num_clauses)
+    ctx->votes = (int32_t *)malloc(stm->num_classes * sizeof(int32_t));  // shape: (num_classes)
+    ctx->clause_hits = (uint32_t *)malloc(stm->num_clauses * sizeof(uint32_t));  // shape: (num_clauses)
+    ctx->row_literals = (uint32_t *)malloc(stm->num_literals * sizeof(uint32_t));  // shape: (num_literals)
+    if (ctx->clause_output == NULL || ctx->votes == NULL || ctx->clause_hits == NULL || ctx->row_literals == NULL) {
+        perror("Memory allocation failed");
+        stm_context_free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+// Free the context and its scratch buffers
+void stm_context_free(struct SparseTsetlinMachineContext *ctx) {
+    if (ctx != NULL) {
+        free(ctx->clause_output);
+        free(ctx->votes);
+        free(ctx->clause_hits);
+        free(ctx->row_literals);
+        free(ctx);
+    }
+}
+
+// Reentrant inference
+// Only reads stm, all per-row state is written to ctx
+void stm_predict_context(const struct SparseTsetlinMachine *stm, struct SparseTsetlinMachineContext *ctx, const uint8_t *X, void *y_pred, uint32_t rows) {
+    // Refresh the view every call, so that later changes to stm (e.g., output_activation) are picked up
+    ctx->view = *stm;
+    ctx->view.clause_output = ctx->clause_output;
+    ctx->view.votes = ctx->votes;
+    ctx->view.clause_hits = ctx->clause_hits;
+    ctx->view.row_literals = ctx->row_literals;
+
+    predict_rows(&ctx->view, X, y_pred, rows);
+}
+
+
+// One worker of stm_predict_parallel
+struct STMPredictJob {
+    const struct SparseTsetlinMachine *stm;
+    struct SparseTsetlinMachineContext *ctx;
+    const uint8_t *X;
+    void *y_pred;
+    uint32_t rows;
+};
+
+static void stm_predict_job(void *arg) {
+    struct STMPredictJob *job = (struct STMPredictJob *)arg;
+    stm_predict_context(job->stm, job->ctx, job->X, job->y_pred, job->rows);
+}
+
+// Parallel inference
+// y_pred should be allocated like: void *y_pred = malloc(rows * stm->y_size * stm->y_element_size);
+void stm_predict_parallel(struct SparseTsetlinMachine *stm, const uint8_t *X, void *y_pred, uint32_t rows, uint32_t num_threads) {
+    if (num_threads == 0) {
+        num_threads = default_num_threads();
     }
+    if (num_threads > rows) {
+        num_threads = rows;
+    }
+    if (num_threads <= 1) {
+        predict_rows(stm, X, y_pred, rows);
+        return;
+    }
+
+    struct STMPredictJob *jobs = (struct STMPredictJob *)calloc(num_threads, sizeof(struct STMPredictJob));
+    if (jobs == NULL) {
+        perror("Memory allocation failed");
+        predict_rows(stm, X, y_pred, rows);
+        return;
+    }
+
+    // Split rows evenly, the first (rows % num_threads) jobs get one extra row
+    uint32_t row_start = 0;
+    uint32_t jobs_ready = 0;
+    for (; jobs_ready < num_threads; jobs_ready++) {
+        struct STMPredictJob *job = jobs + jobs_ready;
+        uint32_t job_rows = rows / num_threads + (jobs_ready < rows % num_threads);
+
+        job->stm = stm;
+        job->ctx = stm_context_create(stm);
+        job->X = X + ((size_t)row_start * stm->num_literals);
+        job->y_pred = (void *)(((uint8_t *)y_pred) + ((size_t)row_start * stm->y_size * stm->y_element_size));
+        job->rows = job_rows;
+        row_start += job_rows;
+
+        if (job->ctx == NULL) {
+            break;
+        }
+    }
+    if (jobs_ready < num_threads) {
+        // Not enough memory for every worker, fall back to serial inference
+        for (uint32_t job_id = 0; job_id < jobs_ready; job_id++) {
+            stm_context_free(jobs[job_id].ctx);
+        }
+        free(jobs);
+        predict_rows(stm, X, y_pred, rows);
+        return;
+    }
+
+    run_parallel_jobs(stm_predict_job, jobs, sizeof(struct STMPredictJob), num_threads);
+
+    for (uint32_t job_id = 0; job_id < num_threads; job_id++) {
+        stm_context_free(jobs[job_id].ctx);
+    }
+    free(jobs);
 }
 
 
@@ -730,6 +1444,7 @@ void stm_set_output_activation(
 // Internal component of feedback functions below
 // Intuition for the choice is in comments above, for each type_*_feedback function
 void stm_apply_feedback(struct SparseTsetlinMachine *stm, uint32_t clause_id, uint32_t class_id, uint8_t is_class_positive, const uint8_t *X) {
+	clause_lock(stm, clause_id);
 	uint8_t is_vote_positive = stm->weights[(clause_id * stm->num_classes) + class_id] >= 0;
 	if (is_vote_positive == is_class_positive) {
 		if (stm->clause_output[clause_id] == 1) {
@@ -742,6 +1457,32 @@ void stm_apply_feedback(struct SparseTsetlinMachine *stm, uint32_t clause_id, ui
 	else if (stm->clause_output[clause_id] == 1) {
 		type_2_feedback(stm, X, clause_id, class_id);
 	}
+	clause_unlock(stm, clause_id);
+}
+
+// Apply feedback to each clause independently with probability update_probability
+// A well-fitted row has a small probability, then only the chosen clauses are drawn (skipping the gaps between them)
+static inline void apply_feedback_sampled(
+	struct SparseTsetlinMachine *stm, const uint8_t *X, uint32_t class_id, uint8_t is_class_positive, float update_probability
+) {
+	if (update_probability <= 0.0f) {
+		return;
+	}
+
+	if (update_probability >= PRNG_SKIP_SAMPLING_MAX_P) {
+		for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
+			if (prng_next_float(&(stm->rng)) <= update_probability) {
+				stm_apply_feedback(stm, clause_id, class_id, is_class_positive, X);
+			}
+		}
+		return;
+	}
+
+	float scale = prng_geometric_scale(update_probability);
+	for (uint32_t clause_id = prng_next_event(&(stm->rng), scale, 0); clause_id < stm->num_clauses;
+			clause_id = prng_next_event(&(stm->rng), scale, clause_id + 1)) {
+		stm_apply_feedback(stm, clause_id, class_id, is_class_positive, X);
+	}
 }
 
 // --- calculate_feedback ---
@@ -762,11 +1503,7 @@ void stm_feedback_class_idx(struct SparseTsetlinMachine *stm, const uint8_t *X,
 	float update_probability_positive = ((float)stm->threshold - (float)votes_clipped_positive) / (float)(2 * stm->threshold);
 
     // Apply feedback to: chosen classes - every clause
-	for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
-		if (prng_next_float(&(stm->rng)) <= update_probability_positive) {
-			stm_apply_feedback(stm, clause_id, positive_class, 1, X);
-		}
-	}
+	apply_feedback_sampled(stm, X, positive_class, 1, update_probability_positive);
 
     // Continue for negative class
     int32_t sum_votes_clipped_negative = 0;
@@ -791,11 +1528,7 @@ void stm_feedback_class_idx(struct SparseTsetlinMachine *stm, const uint8_t *X,
     int32_t votes_clipped_negative = clip(stm->votes[negative_class], (int32_t)stm->threshold);
     float update_probability_negative = ((float)votes_clipped_negative + (float)stm->threshold) / (float)(2 * stm->threshold);
 
-    for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
-		if (prng_next_float(&(stm->rng)) <= update_probability_negative) {
-			stm_apply_feedback(stm, clause_id, negative_class, 0, X);
-		}
-    }
+	apply_feedback_sampled(stm, X, negative_class, 0, update_probability_negative);
 }
 
 void stm_feedback_bin_vector(struct SparseTsetlinMachine *stm, const uint8_t *X, const void *y) {
@@ -832,11 +1565,7 @@ void stm_feedback_bin_vector(struct SparseTsetlinMachine *stm, const uint8_t *X,
 	float update_probability_positive = ((float)stm->threshold - (float)votes_clipped_positive) / (float)(2 * stm->threshold);
 
     // Apply feedback to: chosen classes - every clause
-	for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
-		if (prng_next_float(&(stm->rng)) <= update_probability_positive) {
-			stm_apply_feedback(stm, clause_id, positive_class, 1, X);
-		}
-	}
+	apply_feedback_sampled(stm, X, positive_class, 1, update_probability_positive);
 
     // Continue for negative class
 negative_feedback:
@@ -863,11 +1592,7 @@ negative_feedback:
 	int32_t votes_clipped_negative = clip(stm->votes[negative_class], (int32_t)stm->threshold);
 	float update_probability_negative = ((float)votes_clipped_negative + (float)stm->threshold) / (float)(2 * stm->threshold);
 
-	for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
-		if (prng_next_float(&(stm->rng)) <= update_probability_negative) {
-			stm_apply_feedback(stm, clause_id, negative_class, 0, X);
-		}
-	}
+	apply_feedback_sampled(stm, X, negative_class, 0, update_probability_negative);
 }
 
 
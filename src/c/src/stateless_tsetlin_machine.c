@@ -5,69 +5,25 @@
 #include <limits.h>
 
 #include "stateless_tsetlin_machine.h"
+#include "simd_kernels.h"
+#include "parallel_jobs.h"
+#include "posting_lists.h"
 #include "utility.h"
 
 
-// Insert a new node into a linked list after prev
-// If prev is NULL, insert at the head of the list
-// If head_ptr is NULL, it will be initialized to the new node
-// If result is not NULL, it will point to the new node
-void ta_stateless_insert(struct TANode **head_ptr, struct TANode *prev, uint32_t ta_id, struct TANode **result) {
-	struct TANode *node = malloc(sizeof(struct TANode));
-	if (node == NULL) {
-		perror("Memory allocation failed");
-		exit(1);
-	}
-	node->ta_id = ta_id;
-	node->next = prev != NULL ? prev->next : NULL;
-
-	if (*head_ptr == NULL) {
-		*head_ptr = node;
-	}
-	else if (prev == NULL) {
-		node->next = *head_ptr;
-		*head_ptr = node;
-	}
-	else {
-		prev->next = node;
-	}
-
-	if (result != NULL) {
-		*result = node;
-	}
-}
-
-// Remove a node from a linked list after prev
-// If prev is NULL, remove the head of the list
-// If head_ptr is NULL, it will not be modified but print an error message
-// If prev is not NULL and prev->next is NULL (trying to remove after last node), nothing happens
-// If result is not NULL, it will point to the next node after the removed node
-void ta_stateless_remove(struct TANode **head_ptr, struct TANode *prev, struct TANode **result) {
-	if (*head_ptr == NULL) {
-        fprintf(stderr, "Trying to remove from empty linked list\n");
-        return;
-	}
-	if (prev != NULL && prev->next == NULL) {
-        // Trying to remove node after tail of linked list
-        return;
-	}
-
-	struct TANode *to_remove = NULL;
-	if (prev == NULL) {
-		// Removing first element
-		to_remove = *head_ptr;
-		*head_ptr = to_remove->next;
-	}
-	else {
-		to_remove = prev->next;
-		prev->next = to_remove->next;
-	}
-
-	if (result != NULL) {
-		*result = to_remove->next;
-	}
+// Included TA id at position pos of the CSR ta_ids (see StatelessTsetlinMachine)
+static inline uint32_t clause_ta_id(const struct StatelessTsetlinMachine *sltm, uint32_t pos) {
+    return sltm->ta_id_size == sizeof(uint16_t) ? ((const uint16_t *)sltm->ta_ids)[pos] : ((const uint32_t *)sltm->ta_ids)[pos];
+}
 
-	free(to_remove);
+// Store ta_id at position pos of the CSR ta_ids
+static inline void set_clause_ta_id(struct StatelessTsetlinMachine *sltm, uint32_t pos, uint32_t ta_id) {
+    if (sltm->ta_id_size == sizeof(uint16_t)) {
+        ((uint16_t *)sltm->ta_ids)[pos] = (uint16_t)ta_id;
+    }
+    else {
+        ((uint32_t *)sltm->ta_ids)[pos] = ta_id;
+    }
 }
 
 
@@ -81,7 +37,6 @@ uint8_t sltm_y_eq_generic(const struct StatelessTsetlinMachine *sltm, const void
 // --- Tsetlin Machine ---
 
 void sltm_initialize(struct StatelessTsetlinMachine *sltm);
-inline static void sltm_free_state_llists(struct StatelessTsetlinMachine *sltm);
 
 // Allocate memory, fill in fields, calls sltm_initialize
 struct StatelessTsetlinMachine *sltm_create(
@@ -108,16 +63,25 @@ struct StatelessTsetlinMachine *sltm_create(
     sltm->y_element_size = y_element_size;
     sltm->y_eq = sltm_y_eq_generic;
     sltm->output_activation = sltm_oa_class_idx;
+    sltm->posting_offsets = NULL;
+    sltm->posting_clauses = NULL;
+    sltm->clause_positive_count = NULL;
+    sltm->clause_hits = NULL;
+    sltm->row_literals = NULL;
+    sltm->trie_nodes = NULL;
+    sltm->trie_clauses = NULL;
+    sltm->num_trie_nodes = 0;
+    sltm->trie_depth = 0;
 
-    sltm->ta_state = (struct TANode **)malloc(num_clauses * sizeof(struct TANode *));  // shape: flat (num_clauses)
-    if (sltm->ta_state == NULL) {
+    // Empty clauses, ta_ids are allocated once the clauses are known
+    sltm->ta_id_size = (uint64_t)num_literals * 2 <= (uint64_t)UINT16_MAX + 1 ? sizeof(uint16_t) : sizeof(uint32_t);
+    sltm->ta_ids = NULL;
+    sltm->clause_offsets = (uint32_t *)calloc(num_clauses + 1, sizeof(uint32_t));  // shape: (num_clauses + 1)
+    if (sltm->clause_offsets == NULL) {
         perror("Memory allocation failed");
         sltm_free(sltm);
         return NULL;
     }
-    for (uint32_t clause_id = 0; clause_id < sltm->num_clauses; clause_id++) {
-    	sltm->ta_state[clause_id] = NULL;
-    }
     
     sltm->weights = (int16_t *)malloc(num_clauses * num_classes * sizeof(int16_t));  // shape: flat (num_clauses, num_classes)
     if (sltm->weights == NULL) {
@@ -126,7 +90,7 @@ struct StatelessTsetlinMachine *sltm_create(
         return NULL;
     }
     
-    sltm->clause_output = (uint8_t *)malloc(num_clauses * sizeof(uint8_t));  // shape: (num_clauses)
+    sltm->clause_output = (uint64_t *)malloc(((num_clauses - 1) / 64 + 1) * sizeof(uint64_t));  // shape: ((num_clauses - 1) / 64 + 1)
     if (sltm->clause_output == NULL) {
         perror("Memory allocation failed");
         sltm_free(sltm);
@@ -206,35 +170,192 @@ struct StatelessTsetlinMachine *sltm_load_dense(
         fclose(file);
         return NULL;
     }
-    // Allocate and read clauses
-    int8_t *flat_states = malloc(num_clauses * num_literals * 2 * sizeof(int8_t));
-    size_t states_read = fread(flat_states, sizeof(int8_t), num_clauses * num_literals * 2, file);
-    if (states_read != num_clauses * num_literals * 2) {
-        fprintf(stderr, "Failed to read all states from bin\n");
+    // Stream the clause states chunk by chunk, appending the included TAs to ta_ids in order
+    int8_t *chunk = (int8_t *)malloc(DENSE_LOAD_CHUNK_SIZE * sizeof(int8_t));  // shape: (DENSE_LOAD_CHUNK_SIZE)
+    if (chunk == NULL) {
+        perror("Memory allocation failed");
         sltm_free(sltm);
-        free(flat_states);
         fclose(file);
         return NULL;
     }
+    size_t num_states = (size_t)num_clauses * num_literals * 2;
+    uint32_t capacity = 0;
+    uint32_t pos = 0;
+    uint32_t clause_id = 0;
+    uint32_t ta_id = 0;
+    for (size_t states_done = 0; states_done < num_states;) {
+        size_t chunk_size = min(num_states - states_done, (size_t)DENSE_LOAD_CHUNK_SIZE);
+        if (fread(chunk, sizeof(int8_t), chunk_size, file) != chunk_size) {
+            fprintf(stderr, "Failed to read all states from bin\n");
+            sltm_free(sltm);
+            free(chunk);
+            fclose(file);
+            return NULL;
+        }
 
-    sltm_free_state_llists(sltm);
-	for (uint32_t clause_id = 0; clause_id < sltm->num_clauses; clause_id++) {
-		struct TANode *prev_ptr = NULL;
-		struct TANode **head_ptr_addr = sltm->ta_state + clause_id;
+        for (size_t i = 0; i < chunk_size; i++) {
+            if (action(chunk[i], sltm->mid_state)) {
+                if (pos == capacity) {
+                    // Grow geometrically, the number of included TAs is only known at the end
+                    uint32_t new_capacity = capacity < 1024 ? 1024 : capacity * 2;
+                    void *ta_ids = realloc(sltm->ta_ids, (size_t)new_capacity * sltm->ta_id_size);  // shape: (capacity)
+                    if (ta_ids == NULL) {
+                        perror("Memory allocation failed");
+                        sltm_free(sltm);
+                        free(chunk);
+                        fclose(file);
+                        return NULL;
+                    }
+                    sltm->ta_ids = ta_ids;
+                    capacity = new_capacity;
+                }
+                set_clause_ta_id(sltm, pos++, ta_id);
+            }
 
-		for (uint32_t i = 0; i < sltm->num_literals * 2; i++) {
-			if (action(flat_states[clause_id * sltm->num_literals * 2 + i], sltm->mid_state)) {
-				ta_stateless_insert(head_ptr_addr, prev_ptr, i, &prev_ptr);
-			}
-		}
-	}
-	free(flat_states);
+            if (++ta_id == num_literals * 2) {
+                sltm->clause_offsets[++clause_id] = pos;
+                ta_id = 0;
+            }
+        }
+        states_done += chunk_size;
+    }
+    free(chunk);
+
+    // Give back the spare capacity, ta_ids never changes from here on
+    void *ta_ids = realloc(sltm->ta_ids, ((size_t)pos + 1) * sltm->ta_id_size);  // shape: (clause_offsets[num_clauses])
+    if (ta_ids != NULL) {
+        sltm->ta_ids = ta_ids;
+    }
+    sltm_update_posting_lists(sltm);
 
     fclose(file);
     return sltm;
 }
 
 
+// Shared state of the clause jobs of sltm_from_dense and sltm_from_sparse
+// First pass (fill 0) counts the included TAs of each clause into clause_offsets[clause_id + 1],
+// second pass (fill 1) writes them to ta_ids from clause_offsets[clause_id] on
+struct SLTMConversion {
+    const struct TsetlinMachine *tm;
+    const struct SparseTsetlinMachine *stm;
+    struct StatelessTsetlinMachine *sltm;
+    uint8_t fill;
+};
+
+static void sltm_from_dense_clauses(void *arg, uint32_t clause_start, uint32_t clause_end) {
+    struct SLTMConversion *conversion = (struct SLTMConversion *)arg;
+    const struct TsetlinMachine *tm = conversion->tm;
+    struct StatelessTsetlinMachine *sltm = conversion->sltm;
+
+    for (uint32_t clause_id = clause_start; clause_id < clause_end; clause_id++) {
+        const int8_t *positive = tm->ta_state + ((size_t)clause_id * 2 * tm->ta_plane_size);
+        const int8_t *negated = positive + tm->ta_plane_size;
+        uint32_t pos = conversion->fill ? sltm->clause_offsets[clause_id] : 0;
+        for (uint32_t literal_id = 0; literal_id < sltm->num_literals; literal_id++) {
+            if (action(positive[literal_id], sltm->mid_state)) {
+                if (conversion->fill) {
+                    set_clause_ta_id(sltm, pos, 2 * literal_id);
+                }
+                pos++;
+            }
+            if (action(negated[literal_id], sltm->mid_state)) {
+                if (conversion->fill) {
+                    set_clause_ta_id(sltm, pos, 2 * literal_id + 1);
+                }
+                pos++;
+            }
+        }
+        if (!conversion->fill) {
+            sltm->clause_offsets[clause_id + 1] = pos;
+        }
+    }
+}
+
+static void sltm_from_sparse_clauses(void *arg, uint32_t clause_start, uint32_t clause_end) {
+    struct SLTMConversion *conversion = (struct SLTMConversion *)arg;
+    struct StatelessTsetlinMachine *sltm = conversion->sltm;
+
+    for (uint32_t clause_id = clause_start; clause_id < clause_end; clause_id++) {
+        const struct TAStateList *list = conversion->stm->ta_state + clause_id;
+        uint32_t pos = conversion->fill ? sltm->clause_offsets[clause_id] : 0;
+        for (uint32_t node_id = 0; node_id < list->size; node_id++) {
+            struct TAStateNodeWide node = ta_state_get(list, node_id, conversion->stm->node_size);
+            if (action(node.ta_state, sltm->mid_state)) {
+                if (conversion->fill) {
+                    set_clause_ta_id(sltm, pos, node.ta_id);
+                }
+                pos++;
+            }
+        }
+        if (!conversion->fill) {
+            sltm->clause_offsets[clause_id + 1] = pos;
+        }
+    }
+}
+
+// Count, allocate, fill, then build the posting lists
+// Frees conversion->sltm and returns NULL if memory allocation failed
+static struct StatelessTsetlinMachine *sltm_convert(
+    struct SLTMConversion *conversion, void (*run)(void *arg, uint32_t clause_start, uint32_t clause_end), uint32_t num_threads
+) {
+    struct StatelessTsetlinMachine *sltm = conversion->sltm;
+
+    conversion->fill = 0;
+    run_clause_ranges(run, conversion, sltm->num_clauses, num_threads);
+    for (uint32_t clause_id = 0; clause_id < sltm->num_clauses; clause_id++) {
+        sltm->clause_offsets[clause_id + 1] += sltm->clause_offsets[clause_id];
+    }
+
+    uint32_t num_included = sltm->clause_offsets[sltm->num_clauses];
+    sltm->ta_ids = malloc((num_included + 1) * sltm->ta_id_size);  // shape: (num_included)
+    if (sltm->ta_ids == NULL) {
+        perror("Memory allocation failed");
+        sltm_free(sltm);
+        return NULL;
+    }
+    conversion->fill = 1;
+    run_clause_ranges(run, conversion, sltm->num_clauses, num_threads);
+
+    sltm_update_posting_lists(sltm);
+    return sltm;
+}
+
+// Convert a dense Tsetlin Machine, keeping only TAs with action 1 (included)
+struct StatelessTsetlinMachine *sltm_from_dense(const struct TsetlinMachine *tm, uint32_t num_threads) {
+    struct StatelessTsetlinMachine *sltm = sltm_create(
+        tm->num_classes, tm->threshold, tm->num_literals, tm->num_clauses,
+        tm->max_state, tm->min_state, tm->boost_true_positive_feedback,
+        tm->y_size, tm->y_element_size, tm->s
+    );
+    if (!sltm) {
+        fprintf(stderr, "sltm_create failed\n");
+        return NULL;
+    }
+    memcpy(sltm->weights, tm->weights, (size_t)tm->num_clauses * tm->num_classes * sizeof(int16_t));
+
+    struct SLTMConversion conversion = {.tm = tm, .sltm = sltm};
+    return sltm_convert(&conversion, sltm_from_dense_clauses, num_threads);
+}
+
+// Convert a sparse Tsetlin Machine, keeping only TAs with action 1 (included)
+struct StatelessTsetlinMachine *sltm_from_sparse(const struct SparseTsetlinMachine *stm, uint32_t num_threads) {
+    struct StatelessTsetlinMachine *sltm = sltm_create(
+        stm->num_classes, stm->threshold, stm->num_literals, stm->num_clauses,
+        stm->max_state, stm->min_state, stm->boost_true_positive_feedback,
+        stm->y_size, stm->y_element_size, stm->s
+    );
+    if (!sltm) {
+        fprintf(stderr, "sltm_create failed\n");
+        return NULL;
+    }
+    memcpy(sltm->weights, stm->weights, (size_t)stm->num_clauses * stm->num_classes * sizeof(int16_t));
+
+    struct SLTMConversion conversion = {.stm = stm, .sltm = sltm};
+    return sltm_convert(&conversion, sltm_from_sparse_clauses, num_threads);
+}
+
+
 void sltm_save(const struct StatelessTsetlinMachine *sltm, const char *filename) {
     FILE *file = fopen(filename, "wb");
     if (!file) {
@@ -292,14 +413,13 @@ void sltm_save(const struct StatelessTsetlinMachine *sltm, const char *filename)
         goto save_error;
     }
     for (uint32_t clause_id = 0; clause_id < sltm->num_clauses; clause_id++) {
-    	struct TANode *curr_ptr = sltm->ta_state[clause_id];
-    	while (curr_ptr != NULL) {
-    		written = fwrite(&curr_ptr->ta_id, sizeof(uint32_t), 1, file);
+    	for (uint32_t pos = sltm->clause_offsets[clause_id]; pos < sltm->clause_offsets[clause_id + 1]; pos++) {
+            uint32_t ta_id = clause_ta_id(sltm, pos);
+    		written = fwrite(&ta_id, sizeof(uint32_t), 1, file);
 			if (written != 1) {
 				fprintf(stderr, "Failed to write node ta_id\n");
 				goto save_error;
     		}
-			curr_ptr = curr_ptr->next;
     	}
     	uint32_t delim = UINT_MAX;
 		written = fwrite(&delim, sizeof(uint32_t), 1, file);
@@ -319,22 +439,17 @@ save_error:
 
 
 
-inline static void sltm_free_state_llists(struct StatelessTsetlinMachine *sltm) {
-	for (uint32_t clause_id = 0; clause_id < sltm->num_clauses; clause_id++) {
-		struct TANode **head_ptr = sltm->ta_state + clause_id;
-		while (*head_ptr != NULL) {
-			ta_stateless_remove(head_ptr, NULL, NULL);
-		}
-	}
-}
-
 // Free all allocated memory
 void sltm_free(struct StatelessTsetlinMachine *sltm) {
     if (sltm != NULL){
-        if (sltm->ta_state != NULL) {
-        	sltm_free_state_llists(sltm);
-        	free(sltm->ta_state);
-            sltm->ta_state = NULL;
+        if (sltm->clause_offsets != NULL) {
+            free(sltm->clause_offsets);
+            sltm->clause_offsets = NULL;
+        }
+
+        if (sltm->ta_ids != NULL) {
+            free(sltm->ta_ids);
+            sltm->ta_ids = NULL;
         }
         
         if (sltm->weights != NULL) {
@@ -351,6 +466,14 @@ void sltm_free(struct StatelessTsetlinMachine *sltm) {
             free(sltm->votes);
             sltm->votes = NULL;
         }
+
+        free(sltm->posting_offsets);
+        free(sltm->posting_clauses);
+        free(sltm->clause_positive_count);
+        free(sltm->clause_hits);
+        free(sltm->row_literals);
+        free(sltm->trie_nodes);
+        free(sltm->trie_clauses);
         
         free(sltm);
     }
@@ -366,72 +489,770 @@ void sltm_initialize(struct StatelessTsetlinMachine *sltm) {
     sltm->s_min1_inv = (sltm->s - 1.0f) / sltm->s;
 }
 
+
+// Replace the clauses, narrowing the ids to ta_id_size
+uint8_t sltm_set_clauses(struct StatelessTsetlinMachine *sltm, const uint32_t *clause_offsets, const uint32_t *ta_ids) {
+    uint32_t num_included = clause_offsets[sltm->num_clauses];
+    void *new_ta_ids = malloc((num_included + 1) * sltm->ta_id_size);  // shape: (num_included)
+    if (new_ta_ids == NULL) {
+        perror("Memory allocation failed");
+        return 0;
+    }
+
+    free(sltm->ta_ids);
+    sltm->ta_ids = new_ta_ids;
+    memcpy(sltm->clause_offsets, clause_offsets, (sltm->num_clauses + 1) * sizeof(uint32_t));
+    for (uint32_t pos = 0; pos < num_included; pos++) {
+        set_clause_ta_id(sltm, pos, ta_ids[pos]);
+    }
+
+    sltm_update_posting_lists(sltm);
+    // Only if the caller built the trie, it's opt-in
+    if (sltm->trie_nodes != NULL) {
+        sltm_update_trie(sltm);
+    }
+    return 1;
+}
+
+
+static void sltm_free_posting_lists(struct StatelessTsetlinMachine *sltm) {
+    free(sltm->posting_offsets);
+    free(sltm->posting_clauses);
+    free(sltm->clause_positive_count);
+    free(sltm->clause_hits);
+    free(sltm->row_literals);
+    sltm->posting_offsets = NULL;
+    sltm->posting_clauses = NULL;
+    sltm->clause_positive_count = NULL;
+    sltm->clause_hits = NULL;
+    sltm->row_literals = NULL;
+}
+
+// Rebuild the literal -> clause posting lists from the TA lists
+// Postings of each TA come out sorted by clause_id
+void sltm_update_posting_lists(struct StatelessTsetlinMachine *sltm) {
+    uint32_t num_tas = sltm->num_literals * 2;
+    if (sltm->posting_offsets == NULL) {
+        sltm->posting_offsets = (uint32_t *)malloc((num_tas + 1) * sizeof(uint32_t));  // shape: (2 * num_literals + 1)
+        sltm->clause_positive_count = (uint32_t *)malloc(sltm->num_clauses * sizeof(uint32_t));  // shape: (num_clauses)
+        sltm->clause_hits = (uint32_t *)malloc(sltm->num_clauses * sizeof(uint32_t));  // shape: (num_clauses)
+        sltm->row_literals = (uint32_t *)malloc(sltm->num_literals * sizeof(uint32_t));  // shape: (num_literals)
+        if (sltm->posting_offsets == NULL || sltm->clause_positive_count == NULL || sltm->clause_hits == NULL || sltm->row_literals == NULL) {
+            perror("Memory allocation failed");
+            sltm_free_posting_lists(sltm);
+            return;
+        }
+    }
+
+    // Count the postings of each TA (into posting_offsets[ta_id + 1]) and the positive literals of each clause
+    memset(sltm->posting_offsets, 0, (num_tas + 1) * sizeof(uint32_t));
+    for (uint32_t clause_id = 0; clause_id < sltm->num_clauses; clause_id++) {
+        uint32_t positive_count = 0;
+        for (uint32_t pos = sltm->clause_offsets[clause_id]; pos < sltm->clause_offsets[clause_id + 1]; pos++) {
+            uint32_t ta_id = clause_ta_id(sltm, pos);
+            sltm->posting_offsets[ta_id + 1]++;
+            positive_count += ta_id % 2 == 0;
+        }
+        sltm->clause_positive_count[clause_id] = positive_count;
+    }
+    posting_counts_to_offsets(sltm->posting_offsets, num_tas);
+
+    uint32_t num_postings = sltm->posting_offsets[num_tas];
+    uint32_t *posting_clauses = (uint32_t *)realloc(sltm->posting_clauses, (num_postings + 1) * sizeof(uint32_t));  // shape: (num_postings)
+    if (posting_clauses == NULL) {
+        perror("Memory allocation failed");
+        sltm_free_posting_lists(sltm);
+        return;
+    }
+    sltm->posting_clauses = posting_clauses;
+
+    for (uint32_t clause_id = 0; clause_id < sltm->num_clauses; clause_id++) {
+        for (uint32_t pos = sltm->clause_offsets[clause_id]; pos < sltm->clause_offsets[clause_id + 1]; pos++) {
+            posting_clauses[sltm->posting_offsets[clause_ta_id(sltm, pos)]++] = clause_id;
+        }
+    }
+    posting_offsets_restore(sltm->posting_offsets, num_tas);
+}
+
+
+// Hash of the included TA ids at positions start .. end - 1 of the CSR ta_ids
+static inline uint64_t clause_ta_ids_hash(const struct StatelessTsetlinMachine *sltm, uint32_t start, uint32_t end) {
+    uint64_t hash = end - start;
+    for (uint32_t pos = start; pos < end; pos++) {
+        hash = (hash ^ clause_ta_id(sltm, pos)) * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+// Whether a clause can change any vote: it's not empty and some of its weights are not 0
+static inline uint8_t clause_votes(const struct StatelessTsetlinMachine *sltm, uint32_t start, uint32_t end, const int16_t *clause_weights) {
+    if (start == end) {
+        return 0;
+    }
+    for (uint32_t class_id = 0; class_id < sltm->num_classes; class_id++) {
+        if (clause_weights[class_id] != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Move clause clause_id (positions start .. end - 1, already read) to kept clause new_clause_id, which is <= clause_id
+// Positions and weights only ever move down, so nothing is overwritten before it's read
+static inline void keep_clause(struct StatelessTsetlinMachine *sltm, uint32_t clause_id, uint32_t start, uint32_t end, uint32_t new_clause_id) {
+    uint32_t new_start = sltm->clause_offsets[new_clause_id];
+    memmove((uint8_t *)sltm->ta_ids + ((size_t)new_start * sltm->ta_id_size), (uint8_t *)sltm->ta_ids + ((size_t)start * sltm->ta_id_size), (size_t)(end - start) * sltm->ta_id_size);
+    memmove(sltm->weights + ((size_t)new_clause_id * sltm->num_classes), sltm->weights + ((size_t)clause_id * sltm->num_classes), sltm->num_classes * sizeof(int16_t));
+    sltm->clause_offsets[new_clause_id + 1] = new_start + (end - start);
+}
+
+// Merge clauses with the same literals, then drop the clauses that can't change any vote
+uint32_t sltm_compact(struct StatelessTsetlinMachine *sltm) {
+    uint32_t num_clauses = sltm->num_clauses;
+    uint32_t table_size = 16;
+    while (table_size < 2 * num_clauses) {
+        table_size *= 2;
+    }
+    // Open addressing table of kept clause ids (UINT32_MAX if the slot is free), probed linearly
+    uint32_t *table = (uint32_t *)malloc(table_size * sizeof(uint32_t));  // shape: (table_size)
+    uint64_t *hashes = (uint64_t *)malloc(num_clauses * sizeof(uint64_t));  // shape: (num_clauses) - per kept clause
+    if (table == NULL || hashes == NULL) {
+        perror("Memory allocation failed");
+        free(table);
+        free(hashes);
+        return 0;
+    }
+    memset(table, 0xFF, table_size * sizeof(uint32_t));
+
+    // Merge duplicates into their first occurrence by summing the weight rows
+    // A duplicate whose sums would overflow int16_t is kept as a clause of its own instead
+    uint32_t num_kept = 0;
+    uint32_t end = sltm->clause_offsets[0];
+    for (uint32_t clause_id = 0; clause_id < num_clauses; clause_id++) {
+        uint32_t start = end;
+        end = sltm->clause_offsets[clause_id + 1];
+        const int16_t *clause_weights = sltm->weights + ((size_t)clause_id * sltm->num_classes);
+        if (!clause_votes(sltm, start, end, clause_weights)) {
+            continue;
+        }
+
+        uint64_t hash = clause_ta_ids_hash(sltm, start, end);
+        uint32_t slot = (uint32_t)hash & (table_size - 1);
+        for (; table[slot] != UINT32_MAX; slot = (slot + 1) & (table_size - 1)) {
+            uint32_t kept_id = table[slot];
+            uint32_t kept_start = sltm->clause_offsets[kept_id];
+            if (hashes[kept_id] == hash && sltm->clause_offsets[kept_id + 1] - kept_start == end - start &&
+                    0 == memcmp((uint8_t *)sltm->ta_ids + ((size_t)kept_start * sltm->ta_id_size),
+                                (uint8_t *)sltm->ta_ids + ((size_t)start * sltm->ta_id_size), (size_t)(end - start) * sltm->ta_id_size)) {
+                break;
+            }
+        }
+
+        if (table[slot] != UINT32_MAX) {
+            int16_t *kept_weights = sltm->weights + ((size_t)table[slot] * sltm->num_classes);
+            uint8_t fits = 1;
+            for (uint32_t class_id = 0; class_id < sltm->num_classes; class_id++) {
+                int32_t sum = (int32_t)kept_weights[class_id] + clause_weights[class_id];
+                fits &= sum >= INT16_MIN && sum <= INT16_MAX;
+            }
+            if (fits) {
+                for (uint32_t class_id = 0; class_id < sltm->num_classes; class_id++) {
+                    kept_weights[class_id] += clause_weights[class_id];
+                }
+                continue;
+            }
+        }
+
+        // Later duplicates merge into the newest copy
+        keep_clause(sltm, clause_id, start, end, num_kept);
+        hashes[num_kept] = hash;
+        table[slot] = num_kept;
+        num_kept++;
+    }
+    free(table);
+    free(hashes);
+
+    // Merged weights may have cancelled out
+    uint32_t num_merged = num_kept;
+    num_kept = 0;
+    end = sltm->clause_offsets[0];
+    for (uint32_t clause_id = 0; clause_id < num_merged; clause_id++) {
+        uint32_t start = end;
+        end = sltm->clause_offsets[clause_id + 1];
+        if (clause_votes(sltm, start, end, sltm->weights + ((size_t)clause_id * sltm->num_classes))) {
+            keep_clause(sltm, clause_id, start, end, num_kept++);
+        }
+    }
+
+    // At least one clause is kept (empty, with zero weights), the buffers are sized by num_clauses
+    if (num_kept == 0) {
+        memset(sltm->weights, 0, sltm->num_classes * sizeof(int16_t));
+        sltm->clause_offsets[1] = 0;
+        num_kept = 1;
+    }
+    sltm->num_clauses = num_kept;
+
+    // Give back the memory of the removed clauses, the larger buffers stay valid if that fails
+    uint32_t num_included = sltm->clause_offsets[num_kept];
+    void *ta_ids = realloc(sltm->ta_ids, ((size_t)num_included + 1) * sltm->ta_id_size);  // shape: (clause_offsets[num_clauses])
+    if (ta_ids != NULL) {
+        sltm->ta_ids = ta_ids;
+    }
+    uint32_t *clause_offsets = (uint32_t *)realloc(sltm->clause_offsets, (num_kept + 1) * sizeof(uint32_t));  // shape: (num_clauses + 1)
+    if (clause_offsets != NULL) {
+        sltm->clause_offsets = clause_offsets;
+    }
+    int16_t *weights = (int16_t *)realloc(sltm->weights, (size_t)num_kept * sltm->num_classes * sizeof(int16_t));  // shape: flat (num_clauses, num_classes)
+    if (weights != NULL) {
+        sltm->weights = weights;
+    }
+
+    // Clause ids changed
+    sltm_free_posting_lists(sltm);
+    sltm_update_posting_lists(sltm);
+    if (sltm->trie_nodes != NULL) {
+        sltm_update_trie(sltm);
+    }
+
+    return num_clauses - num_kept;
+}
+
+// Lexicographic order of the included TA id lists of two clauses, a prefix comes before the longer lists
+static inline int compare_clause_ta_ids(const struct StatelessTsetlinMachine *sltm, uint32_t clause_a, uint32_t clause_b) {
+    uint32_t pos_a = sltm->clause_offsets[clause_a], end_a = sltm->clause_offsets[clause_a + 1];
+    uint32_t pos_b = sltm->clause_offsets[clause_b], end_b = sltm->clause_offsets[clause_b + 1];
+    for (; pos_a < end_a && pos_b < end_b; pos_a++, pos_b++) {
+        uint32_t ta_id_a = clause_ta_id(sltm, pos_a);
+        uint32_t ta_id_b = clause_ta_id(sltm, pos_b);
+        if (ta_id_a != ta_id_b) {
+            return ta_id_a < ta_id_b ? -1 : 1;
+        }
+    }
+    return (pos_a < end_a) - (pos_b < end_b);
+}
+
+// Stable bottom-up merge sort of clause ids by compare_clause_ta_ids
+// clause_ids, scratch shape: (count)
+static void sort_clauses(const struct StatelessTsetlinMachine *sltm, uint32_t *clause_ids, uint32_t *scratch, uint32_t count) {
+    uint32_t *from = clause_ids, *to = scratch;
+    for (uint32_t width = 1; width < count; width = width <= UINT32_MAX / 2 ? width * 2 : count) {
+        for (uint32_t low = 0; low < count; low = count - low > 2 * width ? low + 2 * width : count) {
+            uint32_t mid = min(low + width, count);
+            uint32_t high = count - low > 2 * width ? low + 2 * width : count;
+            uint32_t a = low, b = mid;
+            for (uint32_t i = low; i < high; i++) {
+                to[i] = b >= high || (a < mid && compare_clause_ta_ids(sltm, from[a], from[b]) <= 0) ? from[a++] : from[b++];
+            }
+        }
+        uint32_t *swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != clause_ids) {
+        memcpy(clause_ids, from, count * sizeof(uint32_t));
+    }
+}
+
+static void sltm_free_trie(struct StatelessTsetlinMachine *sltm) {
+    free(sltm->trie_nodes);
+    free(sltm->trie_clauses);
+    sltm->trie_nodes = NULL;
+    sltm->trie_clauses = NULL;
+    sltm->num_trie_nodes = 0;
+    sltm->trie_depth = 0;
+}
+
+// Rebuild the clause prefix trie
+// Clauses are sorted by their literal lists, so each one shares its path with the previous one up to their common prefix,
+// and the nodes come out in preorder
+void sltm_update_trie(struct StatelessTsetlinMachine *sltm) {
+    sltm_free_trie(sltm);
+
+    uint32_t num_included = sltm->clause_offsets[sltm->num_clauses];
+    uint32_t num_trie_clauses = 0;
+    uint32_t trie_depth = 0;
+    for (uint32_t clause_id = 0; clause_id < sltm->num_clauses; clause_id++) {
+        uint32_t length = sltm->clause_offsets[clause_id + 1] - sltm->clause_offsets[clause_id];
+        num_trie_clauses += length != 0;
+        trie_depth = length > trie_depth ? length : trie_depth;
+    }
+
+    // At most one node per included TA, shrunk to the actual count below
+    sltm->trie_nodes = (struct StatelessTrieNode *)malloc(((size_t)num_included + 1) * sizeof(struct StatelessTrieNode));  // shape: (num_trie_nodes + 1)
+    sltm->trie_clauses = (uint32_t *)malloc((num_trie_clauses + 1) * sizeof(uint32_t));  // shape: (non-empty clauses)
+    uint32_t *scratch = (uint32_t *)malloc((num_trie_clauses + 1) * sizeof(uint32_t));  // shape: (non-empty clauses)
+    uint32_t *path = (uint32_t *)malloc((trie_depth + 1) * sizeof(uint32_t));  // shape: (trie_depth) - node ids of the current path
+    if (sltm->trie_nodes == NULL || sltm->trie_clauses == NULL || scratch == NULL || path == NULL) {
+        perror("Memory allocation failed");
+        sltm_free_trie(sltm);
+        free(scratch);
+        free(path);
+        return;
+    }
+
+    uint32_t *clause_ids = sltm->trie_clauses;
+    num_trie_clauses = 0;
+    for (uint32_t clause_id = 0; clause_id < sltm->num_clauses; clause_id++) {
+        if (sltm->clause_offsets[clause_id] != sltm->clause_offsets[clause_id + 1]) {
+            clause_ids[num_trie_clauses++] = clause_id;
+        }
+    }
+    sort_clauses(sltm, clause_ids, scratch, num_trie_clauses);
+    free(scratch);
+
+    struct StatelessTrieNode *nodes = sltm->trie_nodes;
+    uint32_t num_nodes = 0;
+    uint32_t path_length = 0;
+    for (uint32_t i = 0; i < num_trie_clauses; i++) {
+        uint32_t start = sltm->clause_offsets[clause_ids[i]];
+        uint32_t length = sltm->clause_offsets[clause_ids[i] + 1] - start;
+
+        // Common prefix with the previous clause, whose nodes are the current path
+        uint32_t shared = 0;
+        while (shared < min(length, path_length) && nodes[path[shared]].ta_id == clause_ta_id(sltm, start + shared)) {
+            shared++;
+        }
+        // Subtrees of the previous clause's nodes below the common prefix are complete
+        for (; path_length > shared; path_length--) {
+            nodes[path[path_length - 1]].skip = num_nodes;
+        }
+        // The clause ends at the last node it adds (or at the previous clause's last node if they're equal),
+        // so the clauses ending at a node are the sorted ones from its clause_start up to the next node's
+        for (; path_length < length; path_length++) {
+            nodes[num_nodes].ta_id = clause_ta_id(sltm, start + path_length);
+            nodes[num_nodes].clause_start = i;
+            path[path_length] = num_nodes++;
+        }
+    }
+    for (; path_length > 0; path_length--) {
+        nodes[path[path_length - 1]].skip = num_nodes;
+    }
+    nodes[num_nodes].clause_start = num_trie_clauses;
+    free(path);
+
+    struct StatelessTrieNode *trie_nodes = (struct StatelessTrieNode *)realloc(nodes, ((size_t)num_nodes + 1) * sizeof(struct StatelessTrieNode));
+    if (trie_nodes != NULL) {
+        sltm->trie_nodes = trie_nodes;
+    }
+    sltm->num_trie_nodes = num_nodes;
+    sltm->trie_depth = trie_depth;
+}
+
+
+// Included TA and how often it falsified its clause during calibration
+struct TAFalsifyCount {
+    uint32_t ta_id;
+    uint32_t count;
+};
+
+// Most frequent falsifier first, ties in ta_id order
+static int compare_falsify_count(const void *a, const void *b) {
+    const struct TAFalsifyCount *lhs = (const struct TAFalsifyCount *)a;
+    const struct TAFalsifyCount *rhs = (const struct TAFalsifyCount *)b;
+    if (lhs->count != rhs->count) {
+        return lhs->count < rhs->count ? 1 : -1;
+    }
+    return (lhs->ta_id > rhs->ta_id) - (lhs->ta_id < rhs->ta_id);
+}
+
+// Reorder the included literals of each clause, most frequent falsifier first
+// Counts depend only on the TA, so clauses with the same literals keep the same order (sltm_compact still merges them)
+void sltm_calibrate(struct StatelessTsetlinMachine *sltm, const uint8_t *X, uint32_t rows) {
+    uint32_t num_included = sltm->clause_offsets[sltm->num_clauses];
+    if (num_included == 0) {
+        return;
+    }
+    struct TAFalsifyCount *counts = (struct TAFalsifyCount *)malloc(num_included * sizeof(struct TAFalsifyCount));  // shape: (num_included)
+    if (counts == NULL) {
+        perror("Memory allocation failed");
+        return;
+    }
+    for (uint32_t pos = 0; pos < num_included; pos++) {
+        counts[pos].ta_id = clause_ta_id(sltm, pos);
+        counts[pos].count = 0;
+    }
+
+    // Count every falsification, not just the first one in the current order
+    for (uint32_t row = 0; row < rows; row++) {
+        const uint8_t *X_row = X + ((size_t)row * sltm->num_literals);
+        for (uint32_t pos = 0; pos < num_included; pos++) {
+            counts[pos].count += counts[pos].ta_id % 2 == X_row[counts[pos].ta_id / 2];
+        }
+    }
+
+    for (uint32_t clause_id = 0; clause_id < sltm->num_clauses; clause_id++) {
+        uint32_t start = sltm->clause_offsets[clause_id];
+        uint32_t end = sltm->clause_offsets[clause_id + 1];
+        qsort(counts + start, end - start, sizeof(struct TAFalsifyCount), compare_falsify_count);
+        for (uint32_t pos = start; pos < end; pos++) {
+            set_clause_ta_id(sltm, pos, counts[pos].ta_id);
+        }
+    }
+    free(counts);
+
+    // The posting lists don't depend on the order, the trie follows it
+    if (sltm->trie_nodes != NULL) {
+        sltm_update_trie(sltm);
+    }
+}
+
+
 // Calculate the output of each clause using the actions of each Tsetlin Automaton
 // Meaning: which clauses are active for given input
-// Output is stored an internal output array clause_output
+// Output is stored an internal output bitmap clause_output
 static inline void calculate_clause_output(struct StatelessTsetlinMachine *sltm, const uint8_t *X) {
-    // For each clause, check if it is "active" - all necessary literals have the right value
+    if (sltm->trie_nodes != NULL) {
+        memset(sltm->clause_output, 0, ((sltm->num_clauses + 63) / 64) * sizeof(uint64_t));
+
+        // Only nodes whose whole path holds are visited, so every clause ending at a visited node is active
+        const struct StatelessTrieNode *nodes = sltm->trie_nodes;
+        for (uint32_t node_id = 0; node_id < sltm->num_trie_nodes;) {
+            if (nodes[node_id].ta_id % 2 == X[nodes[node_id].ta_id / 2]) {
+                node_id = nodes[node_id].skip;
+                continue;
+            }
+            for (uint32_t i = nodes[node_id].clause_start; i < nodes[node_id + 1].clause_start; i++) {
+                uint32_t clause_id = sltm->trie_clauses[i];
+                sltm->clause_output[clause_id / 64] |= (uint64_t)1 << (clause_id % 64);
+            }
+            node_id++;
+        }
+        return;
+    }
+
+    // For each clause, check if it is "active" - it's not empty and each literal present in the clause has the right value
+    // The included TA ids of all clauses are one contiguous array, so the SIMD kernel checks them several at a time
+    simd_kernels.id_clause_output(sltm->ta_ids, sltm->ta_id_size, sltm->clause_offsets, sltm->num_clauses, X, sltm->num_literals, sltm->clause_output);
+}
+
+
+// Whether the row X is cheaper to evaluate through the posting lists than by walking the TA lists
+// If so, row_literals holds the ids of the literals set in X (num_row_literals of them)
+static inline uint8_t use_postings(struct StatelessTsetlinMachine *sltm, const uint8_t *X, uint32_t *num_row_literals) {
+    if (sltm->posting_offsets == NULL) {
+        return 0;
+    }
+
+    // Dense rows run out of budget early in the scan
+    size_t max_cost = sltm->posting_offsets[sltm->num_literals * 2] / POSTING_MAX_COST_FRACTION;
+    size_t base_cost = posting_base_cost(sltm->num_literals, sltm->num_clauses);
+    size_t num_postings = 0;
+    return base_cost <= max_cost &&
+        collect_row_literals_budget(X, sltm->num_literals, sltm->posting_offsets, max_cost - base_cost, sltm->row_literals, num_row_literals, &num_postings);
+}
+
+// Same as calculate_clause_output, but only the postings of the literals set in the row are touched
+// Uses row_literals as filled by use_postings
+static inline void calculate_clause_output_postings(struct StatelessTsetlinMachine *sltm, uint32_t num_row_literals) {
+    count_posting_hits(sltm->posting_offsets, sltm->posting_clauses, sltm->row_literals, num_row_literals, sltm->num_clauses, sltm->clause_hits);
+
+    memset(sltm->clause_output, 0, ((sltm->num_clauses + 63) / 64) * sizeof(uint64_t));
     for (uint32_t clause_id = 0; clause_id < sltm->num_clauses; clause_id++) {
-        sltm->clause_output[clause_id] = 1;
-        uint8_t empty_clause = 1;
-
-		// Clause is active if:
-        // - it's not empty (unless skip_empty is unset as should be the case for training)
-        // - each literal present in the clause has the right value (same as the input X)
-        // Iterate over linked list of Tsetlin Automata ids
-		struct TANode *curr_ptr = sltm->ta_state[clause_id];
-		while (curr_ptr != NULL) {
-			empty_clause = 0;
-			if (curr_ptr->ta_id % 2 == X[curr_ptr->ta_id / 2]) {
-				sltm->clause_output[clause_id] = 0;
-				break;
-			}
-			curr_ptr = curr_ptr->next;
-		}
-		if (empty_clause) {
-			sltm->clause_output[clause_id] = 0;
-		}
+        // Empty clauses are inactive
+        uint8_t output = sltm->clause_offsets[clause_id] != sltm->clause_offsets[clause_id + 1] && sltm->clause_hits[clause_id] == sltm->clause_positive_count[clause_id];
+        sltm->clause_output[clause_id / 64] |= (uint64_t)output << (clause_id % 64);
     }
 }
 
 
 // Sum up the votes of each clause for each class
-static inline void sum_votes(struct StatelessTsetlinMachine *sltm) {
-    memset(sltm->votes, 0, sltm->num_classes*sizeof(int32_t));
-    
-    // Simple sum of votes for each class, then clip them to the threshold
-    for (uint32_t clause_id = 0; clause_id < sltm->num_clauses; clause_id++) {
-        if (sltm->clause_output[clause_id] == 0) {
+// Returns the index of the first class with the highest vote
+static inline uint32_t sum_votes(struct StatelessTsetlinMachine *sltm) {
+    // Simple sum of votes for each active clause, then clip them to the threshold
+    return simd_kernels.sum_votes_bitmap(sltm->clause_output, sltm->weights, sltm->num_clauses, sltm->num_classes, (int32_t)sltm->threshold, sltm->votes);
+}
+
+
+// Pass the votes through the output activation function
+// best_class comes from the vote kernels, so the default sltm_oa_class_idx doesn't have to scan the votes again
+static inline void activate_output(struct StatelessTsetlinMachine *sltm, uint32_t best_class, void *y_pred_row) {
+    if (sltm->output_activation == sltm_oa_class_idx && sltm->y_size == 1) {
+        *(uint32_t *)y_pred_row = best_class;
+    }
+    else {
+        sltm->output_activation(sltm, y_pred_row);
+    }
+}
+
+
+// Predict a single row
+static inline void predict_row(struct StatelessTsetlinMachine *sltm, const uint8_t *X_row, void *y_pred_row) {
+    // Calculate clause output, through the posting lists for sparse rows
+    uint32_t num_row_literals;
+    if (use_postings(sltm, X_row, &num_row_literals)) {
+        calculate_clause_output_postings(sltm, num_row_literals);
+    }
+    else {
+        calculate_clause_output(sltm, X_row);
+    }
+
+    // Sum up clause votes for each class
+    uint32_t best_class = sum_votes(sltm);
+
+    // Pass through output activation function
+    activate_output(sltm, best_class, y_pred_row);
+}
+
+// Whether a block of rows is cheaper to predict row by row through the posting lists than bit-sliced
+// A bit-sliced block transposes every literal of each row, then walks the literals of every clause about once
+static inline uint8_t block_uses_postings(struct StatelessTsetlinMachine *sltm, const uint8_t *X, uint32_t block_rows) {
+    if (sltm->posting_offsets == NULL) {
+        return 0;
+    }
+
+    size_t max_cost = ((size_t)sltm->posting_offsets[sltm->num_literals * 2] + (size_t)block_rows * sltm->num_literals) / POSTING_MAX_COST_FRACTION;
+    size_t base_cost = block_rows * posting_base_cost(sltm->num_literals, sltm->num_clauses);
+    size_t num_postings = 0;
+    if (base_cost > max_cost) {
+        return 0;
+    }
+    for (uint32_t row = 0; row < block_rows; row++) {
+        uint32_t num_row_literals;
+        if (!collect_row_literals_budget(
+                X + ((size_t)row * sltm->num_literals), sltm->num_literals, sltm->posting_offsets, max_cost - base_cost - num_postings,
+                sltm->row_literals, &num_row_literals, &num_postings)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Predict blocks of 64 rows at once
+// Each clause is tested against the whole block by ANDing the bit-slices of its literals
+// Blocks of sparse rows go row by row through the posting lists instead
+// Returns 0 if scratch memory couldn't be allocated (nothing predicted)
+static uint8_t predict_rows_bitsliced(struct StatelessTsetlinMachine *sltm, const uint8_t *X, void *y_pred, uint32_t rows) {
+    uint64_t *slices = (uint64_t *)malloc(sltm->num_literals * sizeof(uint64_t));  // shape: (num_literals)
+    int32_t *block_votes = (int32_t *)malloc(64 * sltm->num_classes * sizeof(int32_t));  // shape: flat (64, num_classes)
+    uint64_t *path_output = (uint64_t *)malloc((sltm->trie_depth + 1) * sizeof(uint64_t));  // shape: (trie_depth + 1)
+    uint32_t *path_end = (uint32_t *)malloc((sltm->trie_depth + 1) * sizeof(uint32_t));  // shape: (trie_depth) - skip of each node on the current path
+    if (slices == NULL || block_votes == NULL || path_output == NULL || path_end == NULL) {
+        free(slices);
+        free(block_votes);
+        free(path_output);
+        free(path_end);
+        return 0;
+    }
+
+    for (uint32_t block_start = 0; block_start < rows; block_start += 64) {
+        uint32_t block_rows = min(rows - block_start, (uint32_t)64);
+        uint64_t block_mask = block_rows == 64 ? UINT64_MAX : (((uint64_t)1 << block_rows) - 1);
+
+        if (block_uses_postings(sltm, X + ((size_t)block_start * sltm->num_literals), block_rows)) {
+            for (uint32_t row = block_start; row < block_start + block_rows; row++) {
+                predict_row(sltm, X + ((size_t)row * sltm->num_literals), (void *)(((uint8_t *)y_pred) + ((size_t)row * sltm->y_size * sltm->y_element_size)));
+            }
             continue;
         }
-        
-        for (uint32_t class_id = 0; class_id < sltm->num_classes; class_id++) {
-            sltm->votes[class_id] += sltm->weights[(clause_id * sltm->num_classes) + class_id];
+
+        bit_slice_rows(X + ((size_t)block_start * sltm->num_literals), block_rows, sltm->num_literals, slices);
+        memset(block_votes, 0, 64 * sltm->num_classes * sizeof(int32_t));
+
+        if (sltm->trie_nodes != NULL) {
+            // Through the trie, path_output[depth] holds the rows satisfying the path down to the last node visited above depth
+            // Nodes are in preorder, so the path is left once node_id reaches the end of a subtree on it
+            path_output[0] = block_mask;
+            uint32_t depth = 0;
+            for (uint32_t node_id = 0; node_id < sltm->num_trie_nodes;) {
+                const struct StatelessTrieNode *node = sltm->trie_nodes + node_id;
+                while (depth > 0 && node_id >= path_end[depth - 1]) {
+                    depth--;
+                }
+                uint64_t slice = slices[node->ta_id / 2];
+                uint64_t output = path_output[depth] & (node->ta_id % 2 ? ~slice : slice);
+                if (output == 0) {
+                    node_id = node->skip;
+                    continue;
+                }
+                path_end[depth] = node->skip;
+                path_output[++depth] = output;
+
+                for (uint32_t i = node->clause_start; i < node[1].clause_start; i++) {
+                    const int16_t *clause_weights = sltm->weights + (sltm->trie_clauses[i] * sltm->num_classes);
+                    for (uint64_t rows_left = output; rows_left != 0; rows_left &= rows_left - 1) {
+                        simd_kernels.add_weights(block_votes + (__builtin_ctzll(rows_left) * sltm->num_classes), clause_weights, sltm->num_classes);
+                    }
+                }
+                node_id++;
+            }
+        }
+        else {
+            for (uint32_t clause_id = 0; clause_id < sltm->num_clauses; clause_id++) {
+                // Empty clauses are inactive
+                uint32_t start = sltm->clause_offsets[clause_id];
+                uint32_t end = sltm->clause_offsets[clause_id + 1];
+                if (start == end) {
+                    continue;
+                }
+
+                // Even ta_id is a positive literal, odd ta_id a negated one
+                uint64_t output = block_mask;  // bit per row of the block
+                for (uint32_t pos = start; pos < end && output != 0; pos++) {
+                    uint32_t ta_id = clause_ta_id(sltm, pos);
+                    uint64_t slice = slices[ta_id / 2];
+                    output &= ta_id % 2 ? ~slice : slice;
+                }
+
+                const int16_t *clause_weights = sltm->weights + (clause_id * sltm->num_classes);
+                while (output != 0) {
+                    simd_kernels.add_weights(block_votes + (__builtin_ctzll(output) * sltm->num_classes), clause_weights, sltm->num_classes);
+                    output &= output - 1;
+                }
+            }
+        }
+
+        for (uint32_t row = 0; row < block_rows; row++) {
+            void *y_pred_row = (void *)(((uint8_t *)y_pred) + ((size_t)(block_start + row) * sltm->y_size * sltm->y_element_size));
+            memcpy(sltm->votes, block_votes + (row * sltm->num_classes), sltm->num_classes * sizeof(int32_t));
+            uint32_t best_class = simd_kernels.clip_votes(sltm->votes, sltm->num_classes, (int32_t)sltm->threshold);
+            activate_output(sltm, best_class, y_pred_row);
         }
     }
-    
-    for (uint32_t class_id = 0; class_id < sltm->num_classes; class_id++) {
-        sltm->votes[class_id] = clip(sltm->votes[class_id], (int32_t)sltm->threshold);
-    }
+
+    free(slices);
+    free(block_votes);
+    free(path_output);
+    free(path_end);
+    return 1;
 }
 
+// Predict rows one by one (or bit-sliced in blocks for large batches)
+static void predict_rows(struct StatelessTsetlinMachine *sltm, const uint8_t *X, void *y_pred, uint32_t rows) {
+    if (rows >= BITSLICE_MIN_ROWS && predict_rows_bitsliced(sltm, X, y_pred, rows)) {
+        return;
+    }
+
+    for (uint32_t row = 0; row < rows; row++) {
+    	const uint8_t* X_row = X + ((size_t)row * sltm->num_literals);
+        void *y_pred_row = (void *)(((uint8_t *)y_pred) + ((size_t)row * sltm->y_size * sltm->y_element_size));
+
+        predict_row(sltm, X_row, y_pred_row);
+    }
+}
 
 // Inference
 // y_pred should be allocated like: void *y_pred = malloc(rows * sltm->y_size * sltm->y_element_size);
 void sltm_predict(struct StatelessTsetlinMachine *sltm, const uint8_t *X, void *y_pred, uint32_t rows) {
-    for (uint32_t row = 0; row < rows; row++) {
-    	const uint8_t* X_row = X + (row * sltm->num_literals);
-        void *y_pred_row = (void *)(((uint8_t *)y_pred) + (row * sltm->y_size * sltm->y_element_size));
+    predict_rows(sltm, X, y_pred, rows);
+}
 
-        // Calculate clause output
-        calculate_clause_output(sltm, X_row);
 
-        // Sum up clause votes for each class
-        sum_votes(sltm);
+// Create a per-caller inference context for sltm
+struct StatelessTsetlinMachineContext *sltm_context_create(const struct StatelessTsetlinMachine *sltm) {
+    struct StatelessTsetlinMachineContext *ctx = (struct StatelessTsetlinMachineContext *)calloc(1, sizeof(struct StatelessTsetlinMachineContext));
+    if (ctx == NULL) {
+        perror("Memory allocation failed");
+        return NULL;
+    }
 
-        // Pass through output activation function
-        sltm->output_activation(sltm, y_pred_row);
+    ctx->clause_output = (uint64_t *)malloc(((sltm->num_clauses - 1) / 64 + 1) * sizeof(uint64_t));  // shape: ((num_clauses - 1) / 64 + 1)
+    ctx->votes = (int32_t *)malloc(sltm->num_classes * sizeof(int32_t));  // shape: (num_classes)
+    ctx->clause_hits = (uint32_t *)malloc(sltm->num_clauses * sizeof(uint32_t));  // shape: (num_clauses)
+    ctx->row_literals = (uint32_t *)malloc(sltm->num_literals * sizeof(uint32_t));  // shape: (num_literals)
+    if (ctx->clause_output == NULL || ctx->votes == NULL || ctx->clause_hits == NULL || ctx->row_literals == NULL) {
+        perror("Memory allocation failed");
+        sltm_context_free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+// Free the context and its scratch buffers
+void sltm_context_free(struct StatelessTsetlinMachineContext *ctx) {
+    if (ctx != NULL) {
+        free(ctx->clause_output);
+        free(ctx->votes);
+        free(ctx->clause_hits);
+        free(ctx->row_literals);
+        free(ctx);
+    }
+}
+
+// Reentrant inference
+// Only reads sltm, all per-row state is written to ctx
+void sltm_predict_context(const struct StatelessTsetlinMachine *sltm, struct StatelessTsetlinMachineContext *ctx, const uint8_t *X, void *y_pred, uint32_t rows) {
+    // Refresh the view every call, so that later changes to sltm (e.g., output_activation) are picked up
+    ctx->view = *sltm;
+    ctx->view.clause_output = ctx->clause_output;
+    ctx->view.votes = ctx->votes;
+    ctx->view.clause_hits = ctx->clause_hits;
+    ctx->view.row_literals = ctx->row_literals;
+
+    predict_rows(&ctx->view, X, y_pred, rows);
+}
+
+
+// One worker of sltm_predict_parallel
+struct SLTMPredictJob {
+    const struct StatelessTsetlinMachine *sltm;
+    struct StatelessTsetlinMachineContext *ctx;
+    const uint8_t *X;
+    void *y_pred;
+    uint32_t rows;
+};
+
+static void sltm_predict_job(void *arg) {
+    struct SLTMPredictJob *job = (struct SLTMPredictJob *)arg;
+    sltm_predict_context(job->sltm, job->ctx, job->X, job->y_pred, job->rows);
+}
+
+// Parallel inference
+// y_pred should be allocated like: void *y_pred = malloc(rows * sltm->y_size * sltm->y_element_size);
+void sltm_predict_parallel(struct StatelessTsetlinMachine *sltm, const uint8_t *X, void *y_pred, uint32_t rows, uint32_t num_threads) {
+    if (num_threads == 0) {
+        num_threads = default_num_threads();
+    }
+    if (num_threads > rows) {
+        num_threads = rows;
+    }
+    if (num_threads <= 1) {
+        predict_rows(sltm, X, y_pred, rows);
+        return;
+    }
+
+    struct SLTMPredictJob *jobs = (struct SLTMPredictJob *)calloc(num_threads, sizeof(struct SLTMPredictJob));
+    if (jobs == NULL) {
+        perror("Memory allocation failed");
+        predict_rows(sltm, X, y_pred, rows);
+        return;
+    }
+
+    // Split rows evenly, the first (rows % num_threads) jobs get one extra row
+    uint32_t row_start = 0;
+    uint32_t jobs_ready = 0;
+    for (; jobs_ready < num_threads; jobs_ready++) {
+        struct SLTMPredictJob *job = jobs + jobs_ready;
+        uint32_t job_rows = rows / num_threads + (jobs_ready < rows % num_threads);
+
+        job->sltm = sltm;
+        job->ctx = sltm_context_create(sltm);
+        job->X = X + ((size_t)row_start * sltm->num_literals);
+        job->y_pred = (void *)(((uint8_t *)y_pred) + ((size_t)row_start * sltm->y_size * sltm->y_element_size));
+        job->rows = job_rows;
+        row_start += job_rows;
+
+        if (job->ctx == NULL) {
+            break;
+        }
+    }
+    if (jobs_ready < num_threads) {
+        // Not enough memory for every worker, fall back to serial inference
+        for (uint32_t job_id = 0; job_id < jobs_ready; job_id++) {
+            sltm_context_free(jobs[job_id].ctx);
+        }
+        free(jobs);
+        predict_rows(sltm, X, y_pred, rows);
+        return;
+    }
+
+    run_parallel_jobs(sltm_predict_job, jobs, sizeof(struct SLTMPredictJob), num_threads);
+
+    for (uint32_t job_id = 0; job_id < num_threads; job_id++) {
+        sltm_context_free(jobs[job_id].ctx);
     }
+    free(jobs);
 }
 
 
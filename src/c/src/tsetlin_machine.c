@@ -3,12 +3,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include "flatbuffers/tsetlin_machine_builder.h"
 #include "tsetlin_machine.h"
+#include "simd_kernels.h"
+#include "parallel_jobs.h"
 #include "utility.h"
 
-
 // --- Basic y_eq function ---
 
 uint8_t tm_y_eq_generic(const struct TsetlinMachine *tm, const void *y, const void *y_pred) {
@@ -20,6 +22,26 @@ uint8_t tm_y_eq_generic(const struct TsetlinMachine *tm, const void *y, const vo
 
 void tm_initialize(struct TsetlinMachine *tm);
 
+// Copy the states of one clause from the interleaved file layout, flat (num_literals, 2), into its planes
+static void set_clause_states(struct TsetlinMachine *tm, uint32_t clause_id, const int8_t *clause_states) {
+    int8_t *positive = tm->ta_state + ((size_t)clause_id * 2 * tm->ta_plane_size);
+    int8_t *negated = positive + tm->ta_plane_size;
+    for (uint32_t literal_id = 0; literal_id < tm->num_literals; literal_id++) {
+        positive[literal_id] = clause_states[(literal_id * 2) + 0];
+        negated[literal_id] = clause_states[(literal_id * 2) + 1];
+    }
+}
+
+// Inverse of set_clause_states
+static void get_clause_states(const struct TsetlinMachine *tm, uint32_t clause_id, int8_t *clause_states) {
+    const int8_t *positive = tm->ta_state + ((size_t)clause_id * 2 * tm->ta_plane_size);
+    const int8_t *negated = positive + tm->ta_plane_size;
+    for (uint32_t literal_id = 0; literal_id < tm->num_literals; literal_id++) {
+        clause_states[(literal_id * 2) + 0] = positive[literal_id];
+        clause_states[(literal_id * 2) + 1] = negated[literal_id];
+    }
+}
+
 // Allocate memory, fill in fields, calls tm_initialize
 struct TsetlinMachine *tm_create(
     uint32_t num_classes, uint32_t threshold, uint32_t num_literals, uint32_t num_clauses,
@@ -50,7 +72,10 @@ struct TsetlinMachine *tm_create(
     tm->calculate_feedback = tm_feedback_class_idx;
     
     // Allocate memory for the Tsetlin Machine internal arrays
-    tm->ta_state = (int8_t *)malloc(num_clauses * num_literals * 2 * sizeof(int8_t));  // shape: flat (num_clauses, num_literals, 2)
+    // Literal planes are whole cache lines, so every clause and plane starts 64 byte aligned
+    tm->mask_row_size = (num_literals - 1) / 64 + 1;
+    tm->ta_plane_size = tm->mask_row_size * 64;
+    tm->ta_state = (int8_t *)aligned_alloc(64, (size_t)num_clauses * 2 * tm->ta_plane_size * sizeof(int8_t));  // shape: flat (num_clauses, 2, ta_plane_size)
     if (tm->ta_state == NULL) {
         perror("Memory allocation failed");
         tm_free(tm);
@@ -78,6 +103,57 @@ struct TsetlinMachine *tm_create(
         return NULL;
     }
 
+    tm->clause_include_count = (uint32_t *)malloc(num_clauses * sizeof(uint32_t));  // shape: (num_clauses)
+    if (tm->clause_include_count == NULL) {
+        perror("Memory allocation failed");
+        tm_free(tm);
+        return NULL;
+    }
+
+    tm->ta_mask_size = 2 * tm->mask_row_size;
+    tm->X_ta_row = NULL;
+    tm->X_ta_packed = (uint64_t *)malloc(2 * tm->ta_mask_size * sizeof(uint64_t));  // shape: flat (2, ta_mask_size)
+    if (tm->X_ta_packed == NULL) {
+        perror("Memory allocation failed");
+        tm_free(tm);
+        return NULL;
+    }
+
+    tm->feedback_mask = (uint64_t *)malloc(3 * tm->ta_mask_size * sizeof(uint64_t));  // shape: flat (3, ta_mask_size)
+    if (tm->feedback_mask == NULL) {
+        perror("Memory allocation failed");
+        tm_free(tm);
+        return NULL;
+    }
+
+    tm->include_mask = (uint64_t *)malloc(num_clauses * tm->mask_row_size * sizeof(uint64_t));  // shape: flat (num_clauses, mask_row_size)
+    if (tm->include_mask == NULL) {
+        perror("Memory allocation failed");
+        tm_free(tm);
+        return NULL;
+    }
+
+    tm->include_negated_mask = (uint64_t *)malloc(num_clauses * tm->mask_row_size * sizeof(uint64_t));  // shape: flat (num_clauses, mask_row_size)
+    if (tm->include_negated_mask == NULL) {
+        perror("Memory allocation failed");
+        tm_free(tm);
+        return NULL;
+    }
+
+    tm->X_packed = (uint64_t *)malloc(tm->mask_row_size * sizeof(uint64_t));  // shape: (mask_row_size)
+    if (tm->X_packed == NULL) {
+        perror("Memory allocation failed");
+        tm_free(tm);
+        return NULL;
+    }
+
+    tm->clause_output_packed = (uint64_t *)malloc(((num_clauses - 1) / 64 + 1) * sizeof(uint64_t));  // shape: ((num_clauses - 1) / 64 + 1)
+    if (tm->clause_output_packed == NULL) {
+        perror("Memory allocation failed");
+        tm_free(tm);
+        return NULL;
+    }
+
     // Seed the random number generator
     prng_seed(&(tm->rng), seed);
 
@@ -145,14 +221,27 @@ struct TsetlinMachine *tm_load(
         return NULL;
     }
 
-    // Read clauses (TA states)
-    size_t states_read = fread(tm->ta_state, sizeof(int8_t), num_clauses * num_literals * 2, file);
-    if (states_read != num_clauses * num_literals * 2) {
-        fprintf(stderr, "Failed to read all states from bin\n");
+    // Read clauses (TA states), stored as flat (num_clauses, num_literals, 2)
+    int8_t *clause_states = (int8_t *)malloc(num_literals * 2 * sizeof(int8_t));  // shape: (num_literals, 2)
+    if (clause_states == NULL) {
+        perror("Memory allocation failed");
         tm_free(tm);
         fclose(file);
         return NULL;
     }
+    for (uint32_t clause_id = 0; clause_id < num_clauses; clause_id++) {
+        size_t states_read = fread(clause_states, sizeof(int8_t), num_literals * 2, file);
+        if (states_read != num_literals * 2) {
+            fprintf(stderr, "Failed to read all states from bin\n");
+            free(clause_states);
+            tm_free(tm);
+            fclose(file);
+            return NULL;
+        }
+        set_clause_states(tm, clause_id, clause_states);
+    }
+    free(clause_states);
+    tm_update_include_masks(tm);
 
     fclose(file);
     return tm;
@@ -218,13 +307,24 @@ void tm_save(const struct TsetlinMachine *tm, const char *filename) {
         goto save_error;
     }
 
-    size_t n_states = (size_t)tm->num_clauses * tm->num_literals * 2;
-    written = fwrite(tm->ta_state, sizeof(int8_t), n_states, file);
-    if (written != n_states) {
-        fprintf(stderr, "Failed to write ta_state array (%zu of %zu)\n",
-                written, n_states);
+    // Clauses (TA states) are stored as flat (num_clauses, num_literals, 2)
+    int8_t *clause_states = (int8_t *)malloc(tm->num_literals * 2 * sizeof(int8_t));  // shape: (num_literals, 2)
+    if (clause_states == NULL) {
+        perror("Memory allocation failed");
         goto save_error;
     }
+    size_t n_states = (size_t)tm->num_literals * 2;
+    for (uint32_t clause_id = 0; clause_id < tm->num_clauses; clause_id++) {
+        get_clause_states(tm, clause_id, clause_states);
+        written = fwrite(clause_states, sizeof(int8_t), n_states, file);
+        if (written != n_states) {
+            fprintf(stderr, "Failed to write ta_state array of clause %u (%zu of %zu)\n",
+                    clause_id, written, n_states);
+            free(clause_states);
+            goto save_error;
+        }
+    }
+    free(clause_states);
 
     fclose(file);
     return;
@@ -331,9 +431,19 @@ struct TsetlinMachine *tm_load_fbs(
     memcpy(tm->weights, weights_vec, weights_len * sizeof(int16_t));
     
     // Copy states data from flatbuffers
+    // Stored as flat (num_clauses, num_literals, 2)
     flatbuffers_int8_vec_t states_vec = TsetlinMachine_AutomatonStatesTensor_states(states);
     size_t states_len = flatbuffers_int8_vec_len(states_vec);
-    memcpy(tm->ta_state, states_vec, states_len * sizeof(int8_t));
+    if (states_len != (size_t)num_clauses * num_literals * 2) {
+        fprintf(stderr, "Wrong number of states in fbs (%zu)\n", states_len);
+        tm_free(tm);
+        free(buffer);
+        return NULL;
+    }
+    for (uint32_t clause_id = 0; clause_id < num_clauses; clause_id++) {
+        set_clause_states(tm, clause_id, states_vec + ((size_t)clause_id * num_literals * 2));
+    }
+    tm_update_include_masks(tm);
     
     free(buffer);
     return tm;
@@ -355,8 +465,19 @@ void tm_save_fbs(struct TsetlinMachine *tm, const char *filename) {
     TsetlinMachine_ClauseWeightsTensor_shape_add(&builder, weights_shape_vec);
     TsetlinMachine_ClauseWeightsTensor_ref_t clause_weights = TsetlinMachine_ClauseWeightsTensor_end(&builder);
 
-    // Create states
-    flatbuffers_int8_vec_ref_t states_vec = flatbuffers_int8_vec_create(&builder, tm->ta_state, (size_t)tm->num_clauses * tm->num_literals * 2);
+    // Create states, stored as flat (num_clauses, num_literals, 2)
+    size_t n_states = (size_t)tm->num_clauses * tm->num_literals * 2;
+    int8_t *states_data = (int8_t *)malloc(n_states * sizeof(int8_t));  // shape: flat (num_clauses, num_literals, 2)
+    if (states_data == NULL) {
+        perror("Memory allocation failed");
+        flatcc_builder_clear(&builder);
+        return;
+    }
+    for (uint32_t clause_id = 0; clause_id < tm->num_clauses; clause_id++) {
+        get_clause_states(tm, clause_id, states_data + ((size_t)clause_id * tm->num_literals * 2));
+    }
+    flatbuffers_int8_vec_ref_t states_vec = flatbuffers_int8_vec_create(&builder, states_data, n_states);
+    free(states_data);
     uint32_t states_shape_data[] = {tm->num_clauses, tm->num_literals, 2};
     flatbuffers_uint32_vec_ref_t states_shape_vec = flatbuffers_uint32_vec_create(&builder, states_shape_data, 3);
 
@@ -438,6 +559,41 @@ void tm_free(struct TsetlinMachine *tm) {
             free(tm->votes);
             tm->votes = NULL;
         }
+
+        if (tm->clause_include_count != NULL) {
+            free(tm->clause_include_count);
+            tm->clause_include_count = NULL;
+        }
+
+        if (tm->X_ta_packed != NULL) {
+            free(tm->X_ta_packed);
+            tm->X_ta_packed = NULL;
+        }
+
+        if (tm->feedback_mask != NULL) {
+            free(tm->feedback_mask);
+            tm->feedback_mask = NULL;
+        }
+
+        if (tm->include_mask != NULL) {
+            free(tm->include_mask);
+            tm->include_mask = NULL;
+        }
+
+        if (tm->include_negated_mask != NULL) {
+            free(tm->include_negated_mask);
+            tm->include_negated_mask = NULL;
+        }
+
+        if (tm->X_packed != NULL) {
+            free(tm->X_packed);
+            tm->X_packed = NULL;
+        }
+
+        if (tm->clause_output_packed != NULL) {
+            free(tm->clause_output_packed);
+            tm->clause_output_packed = NULL;
+        }
         
         free(tm);
     }
@@ -451,21 +607,28 @@ void tm_initialize(struct TsetlinMachine *tm) {
     tm->mid_state = (tm->max_state + tm->min_state) / 2;
     tm->s_inv = 1.0f / tm->s;
     tm->s_min1_inv = (tm->s - 1.0f) / tm->s;
+    tm->s_inv_threshold = prng_mask_threshold(tm->s_inv);
+    tm->s_inv_geometric_scale = prng_geometric_scale(tm->s_inv);
 
     // Initialize clauses (TA states making up the clauses)
     // pairs of positive and negative literals randomly (-1, 0) or (0, -1) if mid_state is 0
-    for (uint32_t clause_id = 0; clause_id < tm->num_clauses; clause_id++) {				
+    // Plane padding is held at min_state: never included, and feedback can't lower it further
+    for (uint32_t clause_id = 0; clause_id < tm->num_clauses; clause_id++) {
+        int8_t *positive = tm->ta_state + ((size_t)clause_id * 2 * tm->ta_plane_size);
+        int8_t *negated = positive + tm->ta_plane_size;
         for (uint32_t literal_id = 0; literal_id < tm->num_literals; literal_id++) {
             if (prng_next_float(&(tm->rng)) <= 0.5) {
                 // positive literal
-                tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2) + 0] = tm->mid_state - 1;
+                positive[literal_id] = tm->mid_state - 1;
                 // negative literal
-                tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2) + 1] = tm->mid_state;
+                negated[literal_id] = tm->mid_state;
             } else {
-                tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2) + 0] = tm->mid_state;
-                tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2) + 1] = tm->mid_state - 1;
+                positive[literal_id] = tm->mid_state;
+                negated[literal_id] = tm->mid_state - 1;
             }
         }
+        memset(positive + tm->num_literals, tm->min_state, tm->ta_plane_size - tm->num_literals);
+        memset(negated + tm->num_literals, tm->min_state, tm->ta_plane_size - tm->num_literals);
     }
     
     // Init weights randomly to -1 or 1
@@ -474,6 +637,8 @@ void tm_initialize(struct TsetlinMachine *tm) {
             tm->weights[(clause_id * tm->num_classes) + class_id] = 1 - 2*(prng_next_float(&(tm->rng)) <= 0.5);
         }
     }
+
+    tm_update_include_masks(tm);
 }
 
 // Translates automaton state to action - 0 or 1
@@ -481,69 +646,217 @@ static inline uint8_t action(int8_t state, int8_t mid_state) {
     return state >= mid_state;
 }
 
+// Pack one row of input literals (0 or 1 per uint8_t) into bits, padding bits stay 0
+static inline void pack_input(const uint8_t *X, uint32_t num_literals, uint32_t mask_row_size, uint64_t *X_packed) {
+    for (uint32_t word_id = 0; word_id < mask_row_size; word_id++) {
+        uint32_t literal_start = word_id * 64;
+        uint32_t literal_end = min(literal_start + 64, num_literals);
+        uint64_t word = 0;
+
+        for (uint32_t literal_id = literal_start; literal_id < literal_end; literal_id++) {
+            word |= (uint64_t)(X[literal_id] == 1) << (literal_id - literal_start);
+        }
+
+        X_packed[word_id] = word;
+    }
+}
+
 // Calculate the output of each clause using the actions of each Tsetlin Automaton
 // Meaning: which clauses are active for given input
 // Output is stored inside an internal output array clause_output
-static inline void calculate_clause_output(struct TsetlinMachine *tm, const uint8_t *X, uint8_t skip_empty) {
-    // For each clause, check if it is "active" - all necessary literals have the right value
-    for (uint32_t clause_id = 0; clause_id < tm->num_clauses; clause_id++) {
-        tm->clause_output[clause_id] = 1;
-        uint8_t empty_clause = 1;
+// clause_include_count and the packed include masks must be up to date (see tm_update_include_masks),
+// feedback keeps them in sync during training, so 64 literals are checked at a time
+// Only clauses clause_start .. clause_end - 1 are evaluated
+static inline void calculate_clause_output_range(
+    struct TsetlinMachine *tm, const uint8_t *X, uint8_t skip_empty, uint32_t clause_start, uint32_t clause_end
+) {
+    pack_input(X, tm->num_literals, tm->mask_row_size, tm->X_packed);
 
+    // For each clause, check if it is "active" - all necessary literals have the right value
+    for (uint32_t clause_id = clause_start; clause_id < clause_end; clause_id++) {
         // Clause is active if:
         // - it's not empty (unless skip_empty is unset as should be the case for training)
         // - each literal present in the clause has the right value (same as the input X)
-        for (uint32_t literal_id = 0; literal_id < tm->num_literals; literal_id++) {
-            uint8_t action_include = action(tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2) + 0], tm->mid_state);
-            uint8_t action_include_negated = action(tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2) + 1], tm->mid_state);
-            
-            empty_clause = (empty_clause && !(action_include || action_include_negated));
+        if (tm->clause_include_count[clause_id] == 0) {
+            // Nothing to check
+            tm->clause_output[clause_id] = !skip_empty;
+            continue;
+        }
 
-            if ((action_include == 1 && X[literal_id] == 0) || (action_include_negated == 1 && X[literal_id] == 1)) {
+        const uint64_t *include = tm->include_mask + (clause_id * tm->mask_row_size);
+        const uint64_t *include_negated = tm->include_negated_mask + (clause_id * tm->mask_row_size);
+        tm->clause_output[clause_id] = 1;
+        for (uint32_t word_id = 0; word_id < tm->mask_row_size; word_id++) {
+            // Falsified by an included literal that is 0 or an included negated literal that is 1
+            if ((include[word_id] & ~tm->X_packed[word_id]) | (include_negated[word_id] & tm->X_packed[word_id])) {
                 tm->clause_output[clause_id] = 0;
                 break;
             }
         }
+    }
+}
 
-        if (empty_clause && skip_empty) {
-            tm->clause_output[clause_id] = 0;
+// Same for all clauses
+static inline void calculate_clause_output(struct TsetlinMachine *tm, const uint8_t *X, uint8_t skip_empty) {
+    calculate_clause_output_range(tm, X, skip_empty, 0, tm->num_clauses);
+}
+
+
+// Pack the actions of all Tsetlin Automata into per-clause bitmasks
+// Bit (literal_id % 64) of word (literal_id / 64) is set if the positive (include_mask)
+// or negative (include_negated_mask) literal is included in the clause, padding bits stay 0
+// Also recounts clause_include_count
+void tm_update_include_masks(struct TsetlinMachine *tm) {
+    for (uint32_t clause_id = 0; clause_id < tm->num_clauses; clause_id++) {
+        const int8_t *positive = tm->ta_state + ((size_t)clause_id * 2 * tm->ta_plane_size);
+        const int8_t *negated = positive + tm->ta_plane_size;
+        uint64_t *include = tm->include_mask + (clause_id * tm->mask_row_size);
+        uint64_t *include_negated = tm->include_negated_mask + (clause_id * tm->mask_row_size);
+        uint32_t include_count = 0;
+
+        for (uint32_t word_id = 0; word_id < tm->mask_row_size; word_id++) {
+            uint32_t literal_start = word_id * 64;
+            uint32_t literal_end = min(literal_start + 64, tm->num_literals);
+            uint64_t include_word = 0, include_negated_word = 0;
+
+            for (uint32_t literal_id = literal_start; literal_id < literal_end; literal_id++) {
+                include_word |= (uint64_t)action(positive[literal_id], tm->mid_state) << (literal_id - literal_start);
+                include_negated_word |= (uint64_t)action(negated[literal_id], tm->mid_state) << (literal_id - literal_start);
+            }
+
+            include[word_id] = include_word;
+            include_negated[word_id] = include_negated_word;
+            include_count += __builtin_popcountll(include_word) + __builtin_popcountll(include_negated_word);
         }
+
+        tm->clause_include_count[clause_id] = include_count;
     }
 }
 
+// Same as calculate_clause_output with skip_empty set, but on packed masks and packed input (tm->X_packed)
+// Output is stored as a bitmap in clause_output_packed
+// A clause is falsified by an included literal that is 0 or an included negated literal that is 1
+static inline void calculate_clause_output_packed(struct TsetlinMachine *tm) {
+    simd_kernels.packed_clause_output(
+        tm->include_mask, tm->include_negated_mask, tm->clause_include_count, tm->X_packed,
+        tm->num_clauses, tm->mask_row_size, tm->clause_output_packed
+    );
+}
+
 
 // Sum up the votes of each clause for each class
 static inline void sum_votes(struct TsetlinMachine *tm) {
-    memset(tm->votes, 0, tm->num_classes*sizeof(int32_t));
-    
     // Simple sum of votes for each class, then clip them to the threshold
-    for (uint32_t clause_id = 0; clause_id < tm->num_clauses; clause_id++) {
-        if (tm->clause_output[clause_id] == 0) {
-            continue;
-        }
-        
-        for (uint32_t class_id = 0; class_id < tm->num_classes; class_id++) {
-            tm->votes[class_id] += tm->weights[(clause_id * tm->num_classes) + class_id];
+    simd_kernels.sum_votes(tm->clause_output, tm->weights, tm->num_clauses, tm->num_classes, (int32_t)tm->threshold, tm->votes);
+}
+
+
+// Pass the votes through the output activation function
+// best_class comes from the vote kernels, so the default tm_oa_class_idx doesn't have to scan the votes again
+static inline void activate_output(struct TsetlinMachine *tm, uint32_t best_class, void *y_pred_row) {
+    if (tm->output_activation == tm_oa_class_idx && tm->y_size == 1) {
+        *(uint32_t *)y_pred_row = best_class;
+    }
+    else {
+        tm->output_activation(tm, y_pred_row);
+    }
+}
+
+
+// Expand a training row into one bit per TA (same layout as ta_state within a clause), padding bits stay 0
+// X_ta_packed[0] has a TA's bit set if its literal is true (X for a positive, !X for a negated literal), X_ta_packed[1] if false
+// With one plane per polarity, that's just the packed row and its complement
+// Done once per row, later calls with the same row return immediately
+static inline void pack_feedback_row(struct TsetlinMachine *tm, const uint8_t *X) {
+    if (tm->X_ta_row == X) {
+        return;
+    }
+
+    uint64_t *literal_true = tm->X_ta_packed;
+    uint64_t *literal_false = tm->X_ta_packed + tm->ta_mask_size;
+    pack_input(X, tm->num_literals, tm->mask_row_size, literal_true);
+    for (uint32_t word_id = 0; word_id < tm->mask_row_size; word_id++) {
+        uint32_t valid_bits = min(tm->num_literals - (word_id * 64), 64u);
+        uint64_t valid = valid_bits == 64 ? UINT64_MAX : ((uint64_t)1 << valid_bits) - 1;
+
+        literal_true[tm->mask_row_size + word_id] = ~literal_true[word_id] & valid;
+        literal_false[word_id] = literal_true[tm->mask_row_size + word_id];
+        literal_false[tm->mask_row_size + word_id] = literal_true[word_id];
+    }
+    tm->X_ta_row = X;
+}
+
+
+// Position of the first TA hit by a 1/s event, starting at ta_pos, UINT32_MAX if there is none
+// Events may land on plane padding, which is at min_state and never changes
+static inline uint32_t next_s_inv_event(struct TsetlinMachine *tm, uint32_t ta_pos) {
+    return prng_next_event(&(tm->rng), tm->s_inv_geometric_scale, ta_pos);
+}
+
+// Fill a clause TA bitmap with bits set independently with probability 1/s
+// For large s, only the set bits are drawn, jumping over the gaps between them (prng_next_mask is cheaper otherwise)
+static inline void fill_s_inv_mask(struct TsetlinMachine *tm, uint64_t *mask) {
+    if (tm->s_inv >= PRNG_SKIP_SAMPLING_MAX_P) {
+        for (uint32_t word_id = 0; word_id < tm->ta_mask_size; word_id++) {
+            mask[word_id] = prng_next_mask(&(tm->rng), tm->s_inv_threshold);
         }
+        return;
     }
-    
-    for (uint32_t class_id = 0; class_id < tm->num_classes; class_id++) {
-        tm->votes[class_id] = clip(tm->votes[class_id], (int32_t)tm->threshold);
+
+    memset(mask, 0, tm->ta_mask_size * sizeof(uint64_t));
+    uint32_t num_tas = 2 * tm->ta_plane_size;
+    for (uint32_t ta_pos = next_s_inv_event(tm, 0); ta_pos < num_tas; ta_pos = next_s_inv_event(tm, ta_pos + 1)) {
+        mask[ta_pos / 64] |= (uint64_t)1 << (ta_pos % 64);
+    }
+}
+
+
+// Set the packed include mask bit of the TA at position ta_pos of clause clause_id (see ta_state) to its action
+// Both planes of a clause line up with its two mask rows
+static inline void set_include_bit(struct TsetlinMachine *tm, uint32_t clause_id, uint32_t ta_pos, uint8_t included) {
+    uint32_t literal_id = ta_pos % tm->ta_plane_size;
+    uint64_t *masks = ta_pos < tm->ta_plane_size ? tm->include_mask : tm->include_negated_mask;
+    uint64_t *word = masks + (clause_id * tm->mask_row_size) + (literal_id / 64);
+    uint64_t bit = (uint64_t)1 << (literal_id % 64);
+    *word = included ? *word | bit : *word & ~bit;
+}
+
+// Patch the packed include masks of a clause after a feedback step, only TAs whose action flipped are visited
+// Bits are set from ta_state rather than toggled, so a racing hogwild update can't leave them inverted
+static inline void apply_action_flips(struct TsetlinMachine *tm, uint32_t clause_id, const uint64_t *flipped) {
+    const int8_t *clause_state = tm->ta_state + ((size_t)clause_id * 2 * tm->ta_plane_size);
+    for (uint32_t word_id = 0; word_id < tm->ta_mask_size; word_id++) {
+        for (uint64_t bits = flipped[word_id]; bits != 0; bits &= bits - 1) {
+            uint32_t ta_pos = (word_id * 64) + __builtin_ctzll(bits);
+            set_include_bit(tm, clause_id, ta_pos, action(clause_state[ta_pos], tm->mid_state));
+        }
     }
 }
 
+// Apply one update_states step to a clause, keeping clause_include_count and the packed include masks in sync
+static inline void update_clause_states(
+    struct TsetlinMachine *tm, uint32_t clause_id, const uint64_t *increment, const uint64_t *decrement,
+    int8_t increment_below, int8_t decrement_above
+) {
+    uint64_t *flipped = tm->feedback_mask + (2 * tm->ta_mask_size);
+    tm->clause_include_count[clause_id] = simd_kernels.update_states(
+        tm->ta_state + ((size_t)clause_id * 2 * tm->ta_plane_size), increment, decrement, 2 * tm->ta_plane_size,
+        increment_below, decrement_above, tm->mid_state, flipped
+    );
+    apply_action_flips(tm, clause_id, flipped);
+}
+
 
 // Type I Feedback
 // Applied if clause at clause_id voted correctly for class at class_id
+// TAs are updated 64 at a time: one random bitmap (fill_s_inv_mask) decides which TAs get a 1/s probability step,
+// the rest get the (s-1)/s step, then the update_states kernel applies them and recounts the included TAs
 
 // Type I a - Clause is active for literals X (clause_output == 1)
 // Meaning: it's active and voted correctly
 // Action: reinforce the clause TAs and weights
 // Intuition: so that it continues to vote for the same class
 static inline void type_1a_feedback(struct TsetlinMachine *tm, const uint8_t *X, uint32_t clause_id, uint32_t class_id) {
-    // float s_inv = 1.0f / tm->s;
-    // float s_min1_inv = (tm->s - 1.0f) / tm->s;
-
     uint8_t feedback_strength = 1;
 
     // Reinforce the clause weight (away from mid_state)
@@ -553,32 +866,31 @@ static inline void type_1a_feedback(struct TsetlinMachine *tm, const uint8_t *X,
     else {
         tm->weights[clause_id * tm->num_classes + class_id] -= min(feedback_strength, -(SHRT_MIN - tm->weights[clause_id * tm->num_classes + class_id]));
     }
-    
-    // Reinforce the Tsetlin Automata states
-    for (uint32_t literal_id = 0; literal_id < tm->num_literals; literal_id++) {
-        if (X[literal_id] == 1) {
-            // True positive
-            tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2)] +=
-				min(tm->max_state - tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2)], feedback_strength) * (
-                (tm->boost_true_positive_feedback == 1 || prng_next_float(&(tm->rng)) <= tm->s_min1_inv));
 
-            // False negative
-            tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2) + 1] -=
-				min(-(tm->min_state - tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2) + 1]), feedback_strength) * (
-                (prng_next_float(&(tm->rng)) <= tm->s_inv));
+    pack_feedback_row(tm, X);
+    const uint64_t *literal_true = tm->X_ta_packed;
+    const uint64_t *literal_false = tm->X_ta_packed + tm->ta_mask_size;
+    uint64_t *increment = tm->feedback_mask;
+    uint64_t *decrement = tm->feedback_mask + tm->ta_mask_size;
+
+    // Positive literal TAs (first plane) are always rewarded for true positives if boosted
+    uint64_t boost = tm->boost_true_positive_feedback == 1 ? UINT64_MAX : 0;
 
-        } else {
-            // True negative
-            tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2) + 1] +=
-				min(tm->max_state - tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2) + 1], feedback_strength) * (
-                (prng_next_float(&(tm->rng)) <= tm->s_min1_inv));
-            
-            // False positive
-            tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2)] -=
-				min(-(tm->min_state - tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2)]), feedback_strength) * (
-                (prng_next_float(&(tm->rng)) <= tm->s_inv));
+    // Reinforce the Tsetlin Automata states
+    fill_s_inv_mask(tm, decrement);
+    for (uint32_t word_id = 0; word_id < tm->ta_mask_size; word_id++) {
+        uint64_t random = decrement[word_id];
+        if (word_id == tm->mask_row_size) {
+            boost = 0;
         }
+
+        // True positive / true negative (literal is true): reward with probability (s-1)/s
+        increment[word_id] = literal_true[word_id] & (~random | boost);
+        // False negative / false positive (literal is false): punish with probability 1/s
+        decrement[word_id] = literal_false[word_id] & random;
     }
+
+    update_clause_states(tm, clause_id, increment, decrement, tm->max_state, tm->min_state);
 }
 
 
@@ -587,20 +899,30 @@ static inline void type_1a_feedback(struct TsetlinMachine *tm, const uint8_t *X,
 // Action: lower the clause TAs, both positive and negative, towards exclusion
 // Intuition: so that it "finds something else to do", "countering force"
 static inline void type_1b_feedback(struct TsetlinMachine *tm, uint32_t clause_id) {
-    // float s_inv = 1.0f / tm->s;
-
-    uint8_t feedback_strength = 1;
-
-    // Penalize the clause TAs (towards min_state - exclusion)
-    for (uint32_t literal_id = 0; literal_id < tm->num_literals; literal_id++) {
-        tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2)] -=
-			min(-(tm->min_state - tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2)]), feedback_strength) * (
-            (prng_next_float(&(tm->rng)) <= tm->s_inv));
+    uint64_t *decrement = tm->feedback_mask + tm->ta_mask_size;
+
+    // Penalize the clause TAs (towards min_state - exclusion) with probability 1/s
+    if (tm->s_inv < PRNG_SKIP_SAMPLING_MAX_P) {
+        // Only a few TAs change, update them in place instead of passing over the whole clause
+        int8_t *ta_state = tm->ta_state + ((size_t)clause_id * 2 * tm->ta_plane_size);
+        uint32_t num_tas = 2 * tm->ta_plane_size;
+        for (uint32_t ta_pos = next_s_inv_event(tm, 0); ta_pos < num_tas; ta_pos = next_s_inv_event(tm, ta_pos + 1)) {
+            if (ta_state[ta_pos] > tm->min_state) {
+                ta_state[ta_pos]--;
+                if (ta_state[ta_pos] == tm->mid_state - 1) {
+                    tm->clause_include_count[clause_id]--;
+                    set_include_bit(tm, clause_id, ta_pos, 0);
+                }
+            }
+        }
+        return;
+    }
 
-        tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2) + 1] -=
-			min(-(tm->min_state - tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2) + 1]), feedback_strength) * (
-            (prng_next_float(&(tm->rng)) <= tm->s_inv));
+    for (uint32_t word_id = 0; word_id < tm->ta_mask_size; word_id++) {
+        decrement[word_id] = prng_next_mask(&(tm->rng), tm->s_inv_threshold);
     }
+
+    update_clause_states(tm, clause_id, NULL, decrement, tm->max_state, tm->min_state);
 }
 
 
@@ -617,23 +939,25 @@ static inline void type_2_feedback(struct TsetlinMachine *tm, const uint8_t *X,
     tm->weights[clause_id * tm->num_classes + class_id] +=
         tm->weights[clause_id * tm->num_classes + class_id] >= 0 ? -feedback_strength : feedback_strength;
 
-    for (uint32_t literal_id = 0; literal_id < tm->num_literals; literal_id++) {
-        tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2)] +=
-			min(tm->max_state - tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2)], feedback_strength) * (
-            0 == action(tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2)], tm->mid_state) &&
-            0 == X[literal_id]);
-
-        tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2) + 1] +=
-			min(tm->max_state - tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2) + 1], feedback_strength) * (
-            0 == action(tm->ta_state[(((clause_id * tm->num_literals) + literal_id) * 2) + 1], tm->mid_state) &&
-            1 == X[literal_id]);
-    }
+    // Raise the TAs of false literals, only while excluded (below mid_state)
+    pack_feedback_row(tm, X);
+    update_clause_states(tm, clause_id, tm->X_ta_packed + tm->ta_mask_size, NULL, tm->mid_state, tm->min_state);
 }
 
 
-void tm_train(struct TsetlinMachine *tm, const uint8_t *X, const void *y, uint32_t rows, uint32_t epochs) {
+// Train on rows row_ids[0..rows) (0..rows in storage order if row_ids is NULL), clause_include_count must be up to date
+// If shuffle is set, row_ids is shuffled in place with the model's PRNG before every epoch
+static void train_rows(
+    struct TsetlinMachine *tm, const uint8_t *X, const void *y, uint32_t *row_ids, uint32_t rows, uint32_t epochs, uint8_t shuffle
+) {
     for (uint32_t epoch = 0; epoch < epochs; epoch++) {
-		for (uint32_t row = 0; row < rows; row++) {
+        if (shuffle) {
+            prng_shuffle(&(tm->rng), row_ids, rows);
+        }
+
+		for (uint32_t i = 0; i < rows; i++) {
+            // size_t offsets, large datasets exceed 4 GB
+            size_t row = row_ids != NULL ? row_ids[i] : i;
 			const uint8_t *X_row = X + (row * tm->num_literals);
 			void *y_row = (void *)((uint8_t *)y + (row * tm->y_size * tm->y_element_size));
 
@@ -650,25 +974,329 @@ void tm_train(struct TsetlinMachine *tm, const uint8_t *X, const void *y, uint32
     }
 }
 
+void tm_train(struct TsetlinMachine *tm, const uint8_t *X, const void *y, uint32_t rows, uint32_t epochs) {
+    // ta_state may have been modified directly since the last call, feedback keeps the counts and masks in sync from here on
+    tm_update_include_masks(tm);
+    // Rows are cached by address, which may hold different data since the last call
+    tm->X_ta_row = NULL;
+
+    train_rows(tm, X, y, NULL, rows, epochs, 0);
+}
+
+void tm_train_indexed(
+    struct TsetlinMachine *tm, const uint8_t *X, const void *y, uint32_t *row_ids, uint32_t num_row_ids, uint32_t epochs, uint8_t shuffle
+) {
+    // Same as tm_train, only the row order differs
+    tm_update_include_masks(tm);
+    tm->X_ta_row = NULL;
+
+    train_rows(tm, X, y, row_ids, num_row_ids, epochs, shuffle);
+}
+
+
+// One worker of tm_train_parallel
+// Its view shares ta_state, weights and clause_include_count with the model, everything else written per row is its own
+struct TMTrainJob {
+    struct TsetlinMachine view;
+    const uint8_t *X;
+    const void *y;
+    uint32_t rows, epochs;
+};
+
+static void tm_train_job(void *arg) {
+    struct TMTrainJob *job = (struct TMTrainJob *)arg;
+    train_rows(&job->view, job->X, job->y, NULL, job->rows, job->epochs, 0);
+}
+
+static void tm_train_job_free(struct TMTrainJob *job) {
+    free(job->view.clause_output);
+    free(job->view.votes);
+    free(job->view.X_ta_packed);
+    free(job->view.feedback_mask);
+    free(job->view.X_packed);
+}
+
+// Hogwild training, see header
+void tm_train_parallel(struct TsetlinMachine *tm, const uint8_t *X, const void *y, uint32_t rows, uint32_t epochs, uint32_t num_threads) {
+    if (num_threads == 0) {
+        num_threads = default_num_threads();
+    }
+    if (num_threads > rows) {
+        num_threads = rows;
+    }
+    if (num_threads <= 1) {
+        tm_train(tm, X, y, rows, epochs);
+        return;
+    }
+
+    struct TMTrainJob *jobs = (struct TMTrainJob *)calloc(num_threads, sizeof(struct TMTrainJob));
+    if (jobs == NULL) {
+        perror("Memory allocation failed");
+        tm_train(tm, X, y, rows, epochs);
+        return;
+    }
+
+    // Same starting point as tm_train
+    tm_update_include_masks(tm);
+
+    // Split rows evenly, the first (rows % num_threads) jobs get one extra row
+    uint32_t row_start = 0;
+    uint32_t jobs_ready = 0;
+    for (; jobs_ready < num_threads; jobs_ready++) {
+        struct TMTrainJob *job = jobs + jobs_ready;
+        uint32_t job_rows = rows / num_threads + (jobs_ready < rows % num_threads);
+
+        job->view = *tm;
+        prng_seed(&(job->view.rng), prng_next_uint32(&(tm->rng)));
+        job->view.X_ta_row = NULL;
+        job->view.clause_output = (uint8_t *)malloc(tm->num_clauses * sizeof(uint8_t));  // shape: (num_clauses)
+        job->view.votes = (int32_t *)malloc(tm->num_classes * sizeof(int32_t));  // shape: (num_classes)
+        job->view.X_ta_packed = (uint64_t *)malloc(2 * tm->ta_mask_size * sizeof(uint64_t));  // shape: flat (2, ta_mask_size)
+        job->view.feedback_mask = (uint64_t *)malloc(3 * tm->ta_mask_size * sizeof(uint64_t));  // shape: flat (3, ta_mask_size)
+        job->view.X_packed = (uint64_t *)malloc(tm->mask_row_size * sizeof(uint64_t));  // shape: (mask_row_size)
+        job->X = X + ((size_t)row_start * tm->num_literals);
+        job->y = (const void *)((const uint8_t *)y + ((size_t)row_start * tm->y_size * tm->y_element_size));
+        job->rows = job_rows;
+        job->epochs = epochs;
+        row_start += job_rows;
+
+        if (job->view.clause_output == NULL || job->view.votes == NULL || job->view.X_ta_packed == NULL ||
+                job->view.feedback_mask == NULL || job->view.X_packed == NULL) {
+            tm_train_job_free(job);
+            break;
+        }
+    }
+    if (jobs_ready < num_threads) {
+        // Not enough memory for every worker, fall back to serial training
+        perror("Memory allocation failed");
+        for (uint32_t job_id = 0; job_id < jobs_ready; job_id++) {
+            tm_train_job_free(jobs + job_id);
+        }
+        free(jobs);
+        tm_train(tm, X, y, rows, epochs);
+        return;
+    }
+
+    run_parallel_jobs(tm_train_job, jobs, sizeof(struct TMTrainJob), num_threads);
+
+    for (uint32_t job_id = 0; job_id < num_threads; job_id++) {
+        tm_train_job_free(jobs + job_id);
+    }
+    free(jobs);
+
+    // Racing feedback may have left some counts stale, recount them along with the packed include masks
+    tm_update_include_masks(tm);
+}
+
+
+// Predict blocks of 64 rows at once, the packed include masks must be up to date
+// Each clause is tested against the whole block by ANDing the bit-slices of its included literals
+// Returns 0 if scratch memory couldn't be allocated (nothing predicted)
+static uint8_t predict_rows_bitsliced(struct TsetlinMachine *tm, const uint8_t *X, void *y_pred, uint32_t rows) {
+    uint64_t *slices = (uint64_t *)malloc(tm->num_literals * sizeof(uint64_t));  // shape: (num_literals)
+    int32_t *block_votes = (int32_t *)malloc(64 * tm->num_classes * sizeof(int32_t));  // shape: flat (64, num_classes)
+    if (slices == NULL || block_votes == NULL) {
+        free(slices);
+        free(block_votes);
+        return 0;
+    }
+
+    for (uint32_t block_start = 0; block_start < rows; block_start += 64) {
+        uint32_t block_rows = min(rows - block_start, (uint32_t)64);
+        uint64_t block_mask = block_rows == 64 ? UINT64_MAX : (((uint64_t)1 << block_rows) - 1);
+
+        bit_slice_rows(X + ((size_t)block_start * tm->num_literals), block_rows, tm->num_literals, slices);
+        memset(block_votes, 0, 64 * tm->num_classes * sizeof(int32_t));
+
+        for (uint32_t clause_id = 0; clause_id < tm->num_clauses; clause_id++) {
+            // Empty clauses are inactive during inference
+            if (tm->clause_include_count[clause_id] == 0) {
+                continue;
+            }
+
+            const uint64_t *include = tm->include_mask + (clause_id * tm->mask_row_size);
+            const uint64_t *include_negated = tm->include_negated_mask + (clause_id * tm->mask_row_size);
+            uint64_t output = block_mask;  // bit per row of the block
+
+            for (uint32_t word_id = 0; word_id < tm->mask_row_size && output != 0; word_id++) {
+                const uint64_t *word_slices = slices + (word_id * 64);
+                uint64_t bits = include[word_id];
+                while (bits != 0 && output != 0) {
+                    output &= word_slices[__builtin_ctzll(bits)];
+                    bits &= bits - 1;
+                }
+                bits = include_negated[word_id];
+                while (bits != 0 && output != 0) {
+                    output &= ~word_slices[__builtin_ctzll(bits)];
+                    bits &= bits - 1;
+                }
+            }
+
+            const int16_t *clause_weights = tm->weights + (clause_id * tm->num_classes);
+            while (output != 0) {
+                simd_kernels.add_weights(block_votes + (__builtin_ctzll(output) * tm->num_classes), clause_weights, tm->num_classes);
+                output &= output - 1;
+            }
+        }
+
+        for (uint32_t row = 0; row < block_rows; row++) {
+            void *y_pred_row = (void *)(((uint8_t *)y_pred) + ((size_t)(block_start + row) * tm->y_size * tm->y_element_size));
+            memcpy(tm->votes, block_votes + (row * tm->num_classes), tm->num_classes * sizeof(int32_t));
+            uint32_t best_class = simd_kernels.clip_votes(tm->votes, tm->num_classes, (int32_t)tm->threshold);
+            activate_output(tm, best_class, y_pred_row);
+        }
+    }
+
+    free(slices);
+    free(block_votes);
+    return 1;
+}
+
+// Predict rows one by one (or bit-sliced in blocks for large batches), the packed include masks must be up to date
+static void predict_rows(struct TsetlinMachine *tm, const uint8_t *X, void *y_pred, uint32_t rows) {
+    if (rows >= BITSLICE_MIN_ROWS && predict_rows_bitsliced(tm, X, y_pred, rows)) {
+        return;
+    }
 
-// Inference
-// y_pred should be allocated like: void *y_pred = malloc(rows * tm->y_size * tm->y_element_size);
-void tm_predict(struct TsetlinMachine *tm, const uint8_t *X, void *y_pred, uint32_t rows) {
     for (uint32_t row = 0; row < rows; row++) {
-    	const uint8_t* X_row = X + (row * tm->num_literals);
-        void *y_pred_row = (void *)(((uint8_t *)y_pred) + (row * tm->y_size * tm->y_element_size));
+    	const uint8_t* X_row = X + ((size_t)row * tm->num_literals);
+        void *y_pred_row = (void *)(((uint8_t *)y_pred) + ((size_t)row * tm->y_size * tm->y_element_size));
 
         // Calculate clause output - which clauses are active for this row of input
-        calculate_clause_output(tm, X_row, 1);
+        pack_input(X_row, tm->num_literals, tm->mask_row_size, tm->X_packed);
+        calculate_clause_output_packed(tm);
 
-        // Sum up clause votes for each class
-        sum_votes(tm);
+        // Sum up clause votes for each class, visiting active clauses only
+        uint32_t best_class = simd_kernels.sum_votes_bitmap(
+            tm->clause_output_packed, tm->weights, tm->num_clauses, tm->num_classes, (int32_t)tm->threshold, tm->votes
+        );
 
         // Pass through output activation function to get output in desired format
-        tm->output_activation(tm, y_pred_row);
+        activate_output(tm, best_class, y_pred_row);
     }
 }
 
+// Inference
+// y_pred should be allocated like: void *y_pred = malloc(rows * tm->y_size * tm->y_element_size);
+void tm_predict(struct TsetlinMachine *tm, const uint8_t *X, void *y_pred, uint32_t rows) {
+    predict_rows(tm, X, y_pred, rows);
+}
+
+
+// Create a per-caller inference context for tm
+struct TsetlinMachineContext *tm_context_create(const struct TsetlinMachine *tm) {
+    struct TsetlinMachineContext *ctx = (struct TsetlinMachineContext *)calloc(1, sizeof(struct TsetlinMachineContext));
+    if (ctx == NULL) {
+        perror("Memory allocation failed");
+        return NULL;
+    }
+
+    ctx->votes = (int32_t *)malloc(tm->num_classes * sizeof(int32_t));  // shape: (num_classes)
+    ctx->X_packed = (uint64_t *)malloc(tm->mask_row_size * sizeof(uint64_t));  // shape: (mask_row_size)
+    ctx->clause_output_packed = (uint64_t *)malloc(((tm->num_clauses - 1) / 64 + 1) * sizeof(uint64_t));  // shape: ((num_clauses - 1) / 64 + 1)
+    if (ctx->votes == NULL || ctx->X_packed == NULL || ctx->clause_output_packed == NULL) {
+        perror("Memory allocation failed");
+        tm_context_free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+// Free the context and its scratch buffers
+void tm_context_free(struct TsetlinMachineContext *ctx) {
+    if (ctx != NULL) {
+        free(ctx->votes);
+        free(ctx->X_packed);
+        free(ctx->clause_output_packed);
+        free(ctx);
+    }
+}
+
+// Reentrant inference
+// Only reads tm, all per-row state is written to ctx
+void tm_predict_context(const struct TsetlinMachine *tm, struct TsetlinMachineContext *ctx, const uint8_t *X, void *y_pred, uint32_t rows) {
+    // Refresh the view every call, so that later changes to tm (e.g., output_activation) are picked up
+    ctx->view = *tm;
+    ctx->view.votes = ctx->votes;
+    ctx->view.X_packed = ctx->X_packed;
+    ctx->view.clause_output_packed = ctx->clause_output_packed;
+
+    predict_rows(&ctx->view, X, y_pred, rows);
+}
+
+
+// One worker of tm_predict_parallel
+struct TMPredictJob {
+    const struct TsetlinMachine *tm;
+    struct TsetlinMachineContext *ctx;
+    const uint8_t *X;
+    void *y_pred;
+    uint32_t rows;
+};
+
+static void tm_predict_job(void *arg) {
+    struct TMPredictJob *job = (struct TMPredictJob *)arg;
+    tm_predict_context(job->tm, job->ctx, job->X, job->y_pred, job->rows);
+}
+
+// Parallel inference
+// y_pred should be allocated like: void *y_pred = malloc(rows * tm->y_size * tm->y_element_size);
+void tm_predict_parallel(struct TsetlinMachine *tm, const uint8_t *X, void *y_pred, uint32_t rows, uint32_t num_threads) {
+    if (num_threads == 0) {
+        num_threads = default_num_threads();
+    }
+    if (num_threads > rows) {
+        num_threads = rows;
+    }
+    if (num_threads <= 1) {
+        tm_predict(tm, X, y_pred, rows);
+        return;
+    }
+
+    struct TMPredictJob *jobs = (struct TMPredictJob *)calloc(num_threads, sizeof(struct TMPredictJob));
+    if (jobs == NULL) {
+        perror("Memory allocation failed");
+        tm_predict(tm, X, y_pred, rows);
+        return;
+    }
+
+    // Split rows evenly, the first (rows % num_threads) jobs get one extra row
+    uint32_t row_start = 0;
+    uint32_t jobs_ready = 0;
+    for (; jobs_ready < num_threads; jobs_ready++) {
+        struct TMPredictJob *job = jobs + jobs_ready;
+        uint32_t job_rows = rows / num_threads + (jobs_ready < rows % num_threads);
+
+        job->tm = tm;
+        job->ctx = tm_context_create(tm);
+        job->X = X + ((size_t)row_start * tm->num_literals);
+        job->y_pred = (void *)(((uint8_t *)y_pred) + ((size_t)row_start * tm->y_size * tm->y_element_size));
+        job->rows = job_rows;
+        row_start += job_rows;
+
+        if (job->ctx == NULL) {
+            break;
+        }
+    }
+    if (jobs_ready < num_threads) {
+        // Not enough memory for every worker, fall back to serial inference
+        for (uint32_t job_id = 0; job_id < jobs_ready; job_id++) {
+            tm_context_free(jobs[job_id].ctx);
+        }
+        free(jobs);
+        predict_rows(tm, X, y_pred, rows);
+        return;
+    }
+
+    run_parallel_jobs(tm_predict_job, jobs, sizeof(struct TMPredictJob), num_threads);
+
+    for (uint32_t job_id = 0; job_id < num_threads; job_id++) {
+        tm_context_free(jobs[job_id].ctx);
+    }
+    free(jobs);
+}
+
 
 // Example evaluation function
 // Compares predicted labels with true labels and prints accuracy
@@ -766,65 +1394,62 @@ void tm_apply_feedback(struct TsetlinMachine *tm, uint32_t clause_id, uint32_t c
 
 // --- calculate_feedback ---
 // Calculate clause-class feedback
+// Split in two: classes and update probabilities are picked once per row (FeedbackPlan),
+// then every clause is updated independently, so clause ranges can be updated in parallel (see tm_train_clause_parallel)
 
-void tm_feedback_class_idx(struct TsetlinMachine *tm, const uint8_t *X, const void *y) {
+struct FeedbackPlan {
+    uint8_t apply_positive, apply_negative;
+    uint32_t positive_class, negative_class;
+    float update_probability_positive, update_probability_negative;
+};
+
+static void plan_feedback_class_idx(struct TsetlinMachine *tm, const void *y, struct FeedbackPlan *plan) {
     // Pick positive and negative classes based on the label:
     // Positive class is the one that matches the label,
     // negative is randomly chosen from the rest, weighted by votes
     const uint32_t *label_ptr = (const uint32_t *)y;
-    const uint32_t positive_class = *label_ptr;
-    uint32_t negative_class = 0;
+    plan->positive_class = *label_ptr;
+    plan->negative_class = 0;
 
     // Calculate class update probabilities:
     // Positive class is inversely proportional to the votes for it, (avoiding overfitting)
     // Negative class is proportional to the votes for it (more sure it should not be chosen)
-    int32_t votes_clipped_positive = clip(tm->votes[positive_class], (int32_t)tm->threshold);
-    float update_probability_positive = ((float)tm->threshold - (float)votes_clipped_positive) / (float)(2 * tm->threshold);
-
-    // Apply feedback to: chosen classes - every clause
-    for (uint32_t clause_id = 0; clause_id < tm->num_clauses; clause_id++) {
-    	if (prng_next_float(&(tm->rng)) <= update_probability_positive) {
-    		tm_apply_feedback(tm, clause_id, positive_class, 1, X);
-    	}
-    }
+    int32_t votes_clipped_positive = clip(tm->votes[plan->positive_class], (int32_t)tm->threshold);
+    plan->update_probability_positive = ((float)tm->threshold - (float)votes_clipped_positive) / (float)(2 * tm->threshold);
+    plan->apply_positive = 1;
 
     // Continue for negative class
     int32_t sum_votes_clipped_negative = 0;
     for (uint32_t class_id = 0; class_id < tm->num_classes; class_id++) {
-        if (class_id != positive_class) {
+        if (class_id != plan->positive_class) {
             sum_votes_clipped_negative += clip(tm->votes[class_id], (int32_t)tm->threshold) + (int32_t)tm->threshold;
         }
     }
-    if (sum_votes_clipped_negative == 0) return;
+    plan->apply_negative = sum_votes_clipped_negative != 0;
+    if (!plan->apply_negative) return;
     int32_t random_vote_negative = prng_next_uint32(&(tm->rng)) % sum_votes_clipped_negative;
     int32_t accumulated_votes = 0;
     for (uint32_t class_id = 0; class_id < tm->num_classes; class_id++) {
-        if (class_id != positive_class) {
+        if (class_id != plan->positive_class) {
             accumulated_votes += clip(tm->votes[class_id], (int32_t)tm->threshold) + (int32_t)tm->threshold;
             if (accumulated_votes >= random_vote_negative) {
-                negative_class = class_id;
+                plan->negative_class = class_id;
                 break;
             }
         }
     }
 
-    int32_t votes_clipped_negative = clip(tm->votes[negative_class], (int32_t)tm->threshold);
-    float update_probability_negative = ((float)votes_clipped_negative + (float)tm->threshold) / (float)(2 * tm->threshold);
-
-    for (uint32_t clause_id = 0; clause_id < tm->num_clauses; clause_id++) {
-		if (prng_next_float(&(tm->rng)) <= update_probability_negative) {
-			tm_apply_feedback(tm, clause_id, negative_class, 0, X);
-		}
-    }
+    int32_t votes_clipped_negative = clip(tm->votes[plan->negative_class], (int32_t)tm->threshold);
+    plan->update_probability_negative = ((float)votes_clipped_negative + (float)tm->threshold) / (float)(2 * tm->threshold);
 }
 
-void tm_feedback_bin_vector(struct TsetlinMachine *tm, const uint8_t *X, const void *y) {
+static void plan_feedback_bin_vector(struct TsetlinMachine *tm, const void *y, struct FeedbackPlan *plan) {
     // Pick positive and negative classes based on the label:
     // Positive is randomly chosen from the ones that matches the label, weighted by votes,
     // negative is randomly chosen from the rest, weighted by votes
     const uint8_t *label_arr = (const uint8_t *)y;
-    uint32_t positive_class = 0;
-    uint32_t negative_class = 0;
+    plan->positive_class = 0;
+    plan->negative_class = 0;
 
     int32_t sum_votes_clipped_positive = 0;
 	for (uint32_t class_id = 0; class_id < tm->num_classes; class_id++) {
@@ -832,62 +1457,274 @@ void tm_feedback_bin_vector(struct TsetlinMachine *tm, const uint8_t *X, const v
 			sum_votes_clipped_positive += clip(tm->votes[class_id], (int32_t)tm->threshold) + (int32_t)tm->threshold;
 		}
 	}
-	if (sum_votes_clipped_positive == 0) goto negative_feedback;
-	int32_t random_vote_positive = prng_next_uint32(&(tm->rng)) % sum_votes_clipped_positive;
-	int32_t accumulated_votes_positive = 0;
-	for (uint32_t class_id = 0; class_id < tm->num_classes; class_id++) {
-		if (label_arr[class_id]) {
-			accumulated_votes_positive += clip(tm->votes[class_id], (int32_t)tm->threshold) + (int32_t)tm->threshold;
-			if (accumulated_votes_positive >= random_vote_positive) {
-				positive_class = class_id;
-				break;
+	plan->apply_positive = sum_votes_clipped_positive != 0;
+	if (plan->apply_positive) {
+		int32_t random_vote_positive = prng_next_uint32(&(tm->rng)) % sum_votes_clipped_positive;
+		int32_t accumulated_votes_positive = 0;
+		for (uint32_t class_id = 0; class_id < tm->num_classes; class_id++) {
+			if (label_arr[class_id]) {
+				accumulated_votes_positive += clip(tm->votes[class_id], (int32_t)tm->threshold) + (int32_t)tm->threshold;
+				if (accumulated_votes_positive >= random_vote_positive) {
+					plan->positive_class = class_id;
+					break;
+				}
 			}
 		}
-	}
 
-    // Calculate class update probabilities:
-    // Positive class is inversely proportional to the votes for it, (avoiding overfitting)
-    // Negative class is proportional to the votes for it (more sure it should not be chosen)
-	int32_t votes_clipped_positive = clip(tm->votes[negative_class], (int32_t)tm->threshold);
-	float update_probability_positive = ((float)tm->threshold - (float)votes_clipped_positive) / (float)(2 * tm->threshold);
-
-    // Apply feedback to: chosen classes - every clause
-	for (uint32_t clause_id = 0; clause_id < tm->num_clauses; clause_id++) {
-		if (prng_next_float(&(tm->rng)) <= update_probability_positive) {
-			tm_apply_feedback(tm, clause_id, positive_class, 1, X);
-		}
+		// Calculate class update probabilities:
+		// Positive class is inversely proportional to the votes for it, (avoiding overfitting)
+		// Negative class is proportional to the votes for it (more sure it should not be chosen)
+		int32_t votes_clipped_positive = clip(tm->votes[plan->negative_class], (int32_t)tm->threshold);
+		plan->update_probability_positive = ((float)tm->threshold - (float)votes_clipped_positive) / (float)(2 * tm->threshold);
 	}
 
     // Continue for negative class
-negative_feedback:
-
     int32_t sum_votes_clipped_negative = 0;
 	for (uint32_t class_id = 0; class_id < tm->num_classes; class_id++) {
 		if (!label_arr[class_id]) {
 			sum_votes_clipped_negative += clip(tm->votes[class_id], (int32_t)tm->threshold) + (int32_t)tm->threshold;
 		}
 	}
-	if (sum_votes_clipped_negative == 0) return;
+	plan->apply_negative = sum_votes_clipped_negative != 0;
+	if (!plan->apply_negative) return;
 	int32_t random_vote_negative = prng_next_uint32(&(tm->rng)) % sum_votes_clipped_negative;
 	int32_t accumulated_votes_negative = 0;
 	for (uint32_t class_id = 0; class_id < tm->num_classes; class_id++) {
 		if (!label_arr[class_id]) {
 			accumulated_votes_negative += clip(tm->votes[class_id], (int32_t)tm->threshold) + (int32_t)tm->threshold;
 			if (accumulated_votes_negative >= random_vote_negative) {
-				negative_class = class_id;
+				plan->negative_class = class_id;
 				break;
 			}
 		}
 	}
 
-	int32_t votes_clipped_negative = clip(tm->votes[negative_class], (int32_t)tm->threshold);
-	float update_probability_negative = ((float)votes_clipped_negative + (float)tm->threshold) / (float)(2 * tm->threshold);
+	int32_t votes_clipped_negative = clip(tm->votes[plan->negative_class], (int32_t)tm->threshold);
+	plan->update_probability_negative = ((float)votes_clipped_negative + (float)tm->threshold) / (float)(2 * tm->threshold);
+}
 
-    for (uint32_t clause_id = 0; clause_id < tm->num_clauses; clause_id++) {
-		if (prng_next_float(&(tm->rng)) <= update_probability_negative) {
-			tm_apply_feedback(tm, clause_id, negative_class, 0, X);
-		}
+// Apply feedback to each of the clauses clause_start .. clause_end - 1 independently with probability update_probability
+// A well-fitted row has a small probability, then only the chosen clauses are drawn (skipping the gaps between them),
+// so its cost follows the number of updated clauses rather than num_clauses
+static inline void apply_feedback_sampled(
+    struct TsetlinMachine *tm, const uint8_t *X, uint32_t class_id, uint8_t is_class_positive, float update_probability,
+    uint32_t clause_start, uint32_t clause_end
+) {
+    if (update_probability <= 0.0f) {
+        return;
+    }
+
+    if (update_probability >= PRNG_SKIP_SAMPLING_MAX_P) {
+        for (uint32_t clause_id = clause_start; clause_id < clause_end; clause_id++) {
+            if (prng_next_float(&(tm->rng)) <= update_probability) {
+                tm_apply_feedback(tm, clause_id, class_id, is_class_positive, X);
+            }
+        }
+        return;
+    }
+
+    float scale = prng_geometric_scale(update_probability);
+    for (uint32_t clause_id = prng_next_event(&(tm->rng), scale, clause_start); clause_id < clause_end;
+            clause_id = prng_next_event(&(tm->rng), scale, clause_id + 1)) {
+        tm_apply_feedback(tm, clause_id, class_id, is_class_positive, X);
+    }
+}
+
+// Apply the planned feedback to clauses clause_start .. clause_end - 1
+// Touches only the state, weights and counts of those clauses, randomness comes from tm->rng
+static void apply_feedback_plan(
+    struct TsetlinMachine *tm, const uint8_t *X, const struct FeedbackPlan *plan, uint32_t clause_start, uint32_t clause_end
+) {
+    // Apply feedback to: chosen classes - every clause
+    if (plan->apply_positive) {
+        apply_feedback_sampled(tm, X, plan->positive_class, 1, plan->update_probability_positive, clause_start, clause_end);
+    }
+
+    if (plan->apply_negative) {
+        apply_feedback_sampled(tm, X, plan->negative_class, 0, plan->update_probability_negative, clause_start, clause_end);
+    }
+}
+
+void tm_feedback_class_idx(struct TsetlinMachine *tm, const uint8_t *X, const void *y) {
+    struct FeedbackPlan plan;
+    plan_feedback_class_idx(tm, y, &plan);
+    apply_feedback_plan(tm, X, &plan, 0, tm->num_clauses);
+}
+
+void tm_feedback_bin_vector(struct TsetlinMachine *tm, const uint8_t *X, const void *y) {
+    struct FeedbackPlan plan;
+    plan_feedback_bin_vector(tm, y, &plan);
+    apply_feedback_plan(tm, X, &plan, 0, tm->num_clauses);
+}
+
+
+// --- Clause-parallel training ---
+
+// Shared by all workers of one tm_train_clause_parallel call
+struct TMTrainClauseShared {
+    struct TsetlinMachine *tm;
+    const uint8_t *X;
+    const void *y;
+    uint32_t rows, epochs;
+    void (*plan_feedback)(struct TsetlinMachine *tm, const void *y, struct FeedbackPlan *plan);
+    struct FeedbackPlan plan;  // current row, written by the first worker between the two barriers
+
+    // Workers wait for the go signal, so that clause ranges are split only among threads that actually started
+    pthread_mutex_t start_lock;
+    pthread_cond_t start_cond;
+    uint8_t start;
+    pthread_barrier_t barrier;
+};
+
+// One worker of tm_train_clause_parallel, owns clauses clause_start .. clause_end - 1
+struct TMTrainClauseJob {
+    pthread_t thread;
+    uint8_t thread_started;
+    struct TsetlinMachine view;  // shallow copy of the model, with its own rng, feedback_mask and X_packed
+    uint32_t clause_start, clause_end;
+    uint8_t is_first;
+    struct TMTrainClauseShared *shared;
+};
+
+static void *tm_train_clause_job(void *arg) {
+    struct TMTrainClauseJob *job = (struct TMTrainClauseJob *)arg;
+    struct TMTrainClauseShared *shared = job->shared;
+    struct TsetlinMachine *tm = shared->tm;
+
+    pthread_mutex_lock(&shared->start_lock);
+    while (!shared->start) {
+        pthread_cond_wait(&shared->start_cond, &shared->start_lock);
+    }
+    pthread_mutex_unlock(&shared->start_lock);
+
+    for (uint32_t epoch = 0; epoch < shared->epochs; epoch++) {
+        for (uint32_t row = 0; row < shared->rows; row++) {
+            const uint8_t *X_row = shared->X + ((size_t)row * tm->num_literals);
+            const void *y_row = (const void *)((const uint8_t *)shared->y + ((size_t)row * tm->y_size * tm->y_element_size));
+
+            // Each worker only reads and writes the state of its own clauses, until the votes are needed
+            calculate_clause_output_range(&job->view, X_row, 0, job->clause_start, job->clause_end);
+            pthread_barrier_wait(&shared->barrier);
+
+            if (job->is_first) {
+                sum_votes(tm);
+                pack_feedback_row(tm, X_row);
+                shared->plan_feedback(tm, y_row, &shared->plan);
+            }
+            pthread_barrier_wait(&shared->barrier);
+
+            // Row was packed into the shared X_ta_packed by the first worker
+            job->view.X_ta_row = X_row;
+            apply_feedback_plan(&job->view, X_row, &shared->plan, job->clause_start, job->clause_end);
+        }
+    }
+    return NULL;
+}
+
+void tm_train_clause_parallel(
+    struct TsetlinMachine *tm, const uint8_t *X, const void *y, uint32_t rows, uint32_t epochs, uint32_t num_threads
+) {
+    void (*plan_feedback)(struct TsetlinMachine *tm, const void *y, struct FeedbackPlan *plan) = NULL;
+    if (tm->calculate_feedback == tm_feedback_class_idx) {
+        plan_feedback = plan_feedback_class_idx;
+    }
+    else if (tm->calculate_feedback == tm_feedback_bin_vector) {
+        plan_feedback = plan_feedback_bin_vector;
+    }
+
+    if (num_threads == 0) {
+        num_threads = default_num_threads();
+    }
+    if (num_threads > tm->num_clauses) {
+        num_threads = tm->num_clauses;
+    }
+    if (num_threads <= 1 || plan_feedback == NULL || rows == 0) {
+        tm_train(tm, X, y, rows, epochs);
+        return;
+    }
+
+    struct TMTrainClauseJob *jobs = (struct TMTrainClauseJob *)calloc(num_threads, sizeof(struct TMTrainClauseJob));
+    if (jobs == NULL) {
+        perror("Memory allocation failed");
+        tm_train(tm, X, y, rows, epochs);
+        return;
+    }
+
+    // Same starting point as tm_train
+    tm_update_include_masks(tm);
+    tm->X_ta_row = NULL;
+
+    struct TMTrainClauseShared shared = {
+        .tm = tm, .X = X, .y = y, .rows = rows, .epochs = epochs, .plan_feedback = plan_feedback, .start = 0,
+    };
+    pthread_mutex_init(&shared.start_lock, NULL);
+    pthread_cond_init(&shared.start_cond, NULL);
+
+    uint32_t jobs_ready = 0;
+    for (; jobs_ready < num_threads; jobs_ready++) {
+        struct TMTrainClauseJob *job = jobs + jobs_ready;
+        job->shared = &shared;
+        job->is_first = jobs_ready == 0;
+        job->view = *tm;
+        prng_seed(&(job->view.rng), prng_next_uint32(&(tm->rng)));
+        job->view.feedback_mask = (uint64_t *)malloc(3 * tm->ta_mask_size * sizeof(uint64_t));  // shape: flat (3, ta_mask_size)
+        job->view.X_packed = (uint64_t *)malloc(tm->mask_row_size * sizeof(uint64_t));  // shape: (mask_row_size)
+        if (job->view.feedback_mask == NULL || job->view.X_packed == NULL) {
+            free(job->view.feedback_mask);
+            free(job->view.X_packed);
+            break;
+        }
+    }
+    if (jobs_ready < num_threads) {
+        // Not enough memory for every worker, fall back to serial training
+        perror("Memory allocation failed");
+        for (uint32_t job_id = 0; job_id < jobs_ready; job_id++) {
+            free(jobs[job_id].view.feedback_mask);
+            free(jobs[job_id].view.X_packed);
+        }
+        free(jobs);
+        pthread_mutex_destroy(&shared.start_lock);
+        pthread_cond_destroy(&shared.start_cond);
+        tm_train(tm, X, y, rows, epochs);
+        return;
+    }
+
+    // The calling thread is the first worker, stop at the first thread that can't be started
+    uint32_t num_workers = 1;
+    for (; num_workers < num_threads; num_workers++) {
+        jobs[num_workers].thread_started = 0 == pthread_create(&jobs[num_workers].thread, NULL, tm_train_clause_job, jobs + num_workers);
+        if (!jobs[num_workers].thread_started) {
+            break;
+        }
+    }
+
+    // Split clauses evenly among the workers that run, the first (num_clauses % num_workers) get one extra clause
+    uint32_t clause_start = 0;
+    for (uint32_t job_id = 0; job_id < num_workers; job_id++) {
+        jobs[job_id].clause_start = clause_start;
+        clause_start += tm->num_clauses / num_workers + (job_id < tm->num_clauses % num_workers);
+        jobs[job_id].clause_end = clause_start;
+    }
+    pthread_barrier_init(&shared.barrier, NULL, num_workers);
+
+    pthread_mutex_lock(&shared.start_lock);
+    shared.start = 1;
+    pthread_cond_broadcast(&shared.start_cond);
+    pthread_mutex_unlock(&shared.start_lock);
+
+    tm_train_clause_job(jobs);
+    for (uint32_t job_id = 1; job_id < num_workers; job_id++) {
+        pthread_join(jobs[job_id].thread, NULL);
+    }
+
+    for (uint32_t job_id = 0; job_id < num_threads; job_id++) {
+        free(jobs[job_id].view.feedback_mask);
+        free(jobs[job_id].view.X_packed);
     }
+    free(jobs);
+    pthread_barrier_destroy(&shared.barrier);
+    pthread_mutex_destroy(&shared.start_lock);
+    pthread_cond_destroy(&shared.start_cond);
 }
 
 
@@ -4,118 +4,432 @@
 
 
 #include "../../src/c/src/sparse_tsetlin_machine.c"
+#include "../../src/c/src/posting_lists.c"
+
+// Checks list holds exactly the given (ta_id, ta_state) pairs, in order
+static void assert_list_equals(const struct TAStateList *list, const uint32_t *ta_ids, const int8_t *ta_states, uint32_t size, uint8_t node_size) {
+	TEST_ASSERT_EQUAL_UINT32(size, list->size);
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(list->capacity, list->size);
+	for (uint32_t node_id = 0; node_id < size; node_id++) {
+		TEST_ASSERT_EQUAL_UINT32(ta_ids[node_id], ta_state_get(list, node_id, node_size).ta_id);
+		TEST_ASSERT_EQUAL_INT8(ta_states[node_id], ta_state_get(list, node_id, node_size).ta_state);
+	}
+}
+
+// Inserts of one node type, max_ta_id is the largest ta_id it holds
+static void insert_nodes_of_size(uint8_t node_size, uint32_t max_ta_id) {
+	struct TAStateList list = {NULL, 0, 0};
+
+	ta_state_insert(&list, 0, 2, 4, node_size);
+	TEST_ASSERT_NOT_EQUAL(NULL, list.nodes);
+	assert_list_equals(&list, (uint32_t[]){2}, (int8_t[]){4}, 1, node_size);
+//	printf("Inserted at the start.  IDs: 2  States: 4\n");
+
+	ta_state_insert(&list, 0, 0, 5, node_size);
+	assert_list_equals(&list, (uint32_t[]){0, 2}, (int8_t[]){5, 4}, 2, node_size);
+//	printf("Inserted at the start.  IDs: 02  States: 54\n");
+
+	ta_state_insert(&list, 2, 3, 6, node_size);
+	assert_list_equals(&list, (uint32_t[]){0, 2, 3}, (int8_t[]){5, 4, 6}, 3, node_size);
+//	printf("Inserted at the end.  IDs: 023  States: 546\n");
+
+	ta_state_insert(&list, 1, 1, -7, node_size);
+	assert_list_equals(&list, (uint32_t[]){0, 1, 2, 3}, (int8_t[]){5, -7, 4, 6}, 4, node_size);
+//	printf("Inserted in the middle.  IDs: 0123  States: 5746\n");
+
+	// Growing past the capacity keeps the nodes
+	for (uint32_t ta_id = 4; ta_id < 100; ta_id++) {
+		ta_state_insert(&list, list.size, ta_id, (int8_t)ta_id, node_size);
+	}
+	TEST_ASSERT_EQUAL_UINT32(100, list.size);
+	for (uint32_t node_id = 0; node_id < list.size; node_id++) {
+		TEST_ASSERT_EQUAL_UINT32(node_id, ta_state_get(&list, node_id, node_size).ta_id);
+	}
+
+	// The largest ta_id and negative states survive
+	ta_state_insert(&list, list.size, max_ta_id, -127, node_size);
+	TEST_ASSERT_EQUAL_UINT32(max_ta_id, ta_state_get(&list, 100, node_size).ta_id);
+	TEST_ASSERT_EQUAL_INT8(-127, ta_state_get(&list, 100, node_size).ta_state);
+
+	free(list.nodes);
+}
 
 void insert_nodes(void) {
-	struct TAStateNode *head = NULL;
-	struct TAStateNode **head_ptr = &head;
-
-	ta_state_insert(head_ptr, NULL, 2, 4, NULL);
-	TEST_ASSERT_NOT_EQUAL(NULL, head);
-	TEST_ASSERT_EQUAL(2, head->ta_id);
-	TEST_ASSERT_EQUAL(4, head->ta_state);
-	TEST_ASSERT_EQUAL(NULL, head->next);
-//	printf("Appended at the start.  IDs: 2  States: 4\n");
-
-	ta_state_insert(head_ptr, NULL, 0, 5, NULL);
-	TEST_ASSERT_NOT_EQUAL(NULL, head);
-	TEST_ASSERT_EQUAL(0, head->ta_id);
-	TEST_ASSERT_EQUAL(5, head->ta_state);
-	TEST_ASSERT_NOT_EQUAL(NULL, head->next);
-	struct TAStateNode *second = head->next;
-	TEST_ASSERT_NOT_EQUAL(NULL, second);
-	TEST_ASSERT_EQUAL(2, second->ta_id);
-	TEST_ASSERT_EQUAL(4, second->ta_state);
-	TEST_ASSERT_EQUAL(NULL, second->next);
-//	printf("Appended at the start.  IDs: 02  States: 54\n");
-
-	ta_state_insert(head_ptr, head->next, 3, 6, NULL);
-	TEST_ASSERT_NOT_EQUAL(NULL, head);
-	TEST_ASSERT_EQUAL(0, head->ta_id);
-	TEST_ASSERT_EQUAL(5, head->ta_state);
-	TEST_ASSERT_NOT_EQUAL(NULL, head->next);
-	TEST_ASSERT_NOT_EQUAL(NULL, second);
-	TEST_ASSERT_EQUAL(2, second->ta_id);
-	TEST_ASSERT_EQUAL(4, second->ta_state);
-	TEST_ASSERT_NOT_EQUAL(NULL, second->next);
-	struct TAStateNode *third = second->next;
-	TEST_ASSERT_NOT_EQUAL(NULL, third);
-	TEST_ASSERT_EQUAL(3, third->ta_id);
-	TEST_ASSERT_EQUAL(6, third->ta_state);
-	TEST_ASSERT_EQUAL(NULL, third->next);
-//	printf("Appended at the end.  IDs: 023  States: 546\n");
-
-	ta_state_insert(head_ptr, head, 1, 7, NULL);
-	TEST_ASSERT_NOT_EQUAL(NULL, head);
-	TEST_ASSERT_EQUAL(0, head->ta_id);
-	TEST_ASSERT_EQUAL(5, head->ta_state);
-	TEST_ASSERT_NOT_EQUAL(NULL, head->next);
-	TEST_ASSERT_NOT_EQUAL(NULL, second);
-	TEST_ASSERT_EQUAL(2, second->ta_id);
-	TEST_ASSERT_EQUAL(4, second->ta_state);
-	TEST_ASSERT_NOT_EQUAL(NULL, second->next);
-	TEST_ASSERT_NOT_EQUAL(NULL, third);
-	TEST_ASSERT_EQUAL(3, third->ta_id);
-	TEST_ASSERT_EQUAL(6, third->ta_state);
-	TEST_ASSERT_EQUAL(NULL, third->next);
-	struct TAStateNode *first = head->next;
-	TEST_ASSERT_NOT_EQUAL(NULL, first);
-	TEST_ASSERT_EQUAL(1, first->ta_id);
-	TEST_ASSERT_EQUAL(7, first->ta_state);
-	TEST_ASSERT_NOT_EQUAL(NULL, first->next);
-//	printf("Appended in the middle.  IDs: 0123  States: 5746\n");
+	// ta_id and ta_state are packed into one word
+	TEST_ASSERT_EQUAL_UINT32(4, sizeof(struct TAStateNode));
+	insert_nodes_of_size(sizeof(struct TAStateNode), STM_MAX_TA_ID);
+	insert_nodes_of_size(sizeof(struct TAStateNodeWide), UINT32_MAX - 1);
 }
 
-void remove_nodes(void) {
-	struct TAStateNode *head = NULL;
-	struct TAStateNode **head_ptr = &head;
-	ta_state_insert(head_ptr, NULL, 2, 4, NULL);
-	ta_state_insert(head_ptr, NULL, 0, 5, NULL);
-	ta_state_insert(head_ptr, head->next, 3, 6, NULL);
-	ta_state_insert(head_ptr, head, 1, 7, NULL);
-	struct TAStateNode *first = head->next;
-	struct TAStateNode *second = first->next;
-	struct TAStateNode *third = second->next;
+// Removals of one node type
+static void remove_nodes_of_size(uint8_t node_size) {
+	struct TAStateList list = {NULL, 0, 0};
+	ta_state_insert(&list, 0, 2, 4, node_size);
+	ta_state_insert(&list, 0, 0, 5, node_size);
+	ta_state_insert(&list, 2, 3, 6, node_size);
+	ta_state_insert(&list, 1, 1, 7, node_size);
+	uint32_t capacity = list.capacity;
 //	printf("Start.  IDs: 0123  States: 5746\n");
 
-	ta_state_remove(head_ptr, head, NULL);
-	TEST_ASSERT_NOT_EQUAL(NULL, head);
-	TEST_ASSERT_EQUAL(0, head->ta_id);
-	TEST_ASSERT_EQUAL(5, head->ta_state);
-	TEST_ASSERT_NOT_EQUAL(NULL, head->next);
-	TEST_ASSERT_NOT_EQUAL(NULL, second);
-	TEST_ASSERT_EQUAL(2, second->ta_id);
-	TEST_ASSERT_EQUAL(4, second->ta_state);
-	TEST_ASSERT_NOT_EQUAL(NULL, second->next);
-	TEST_ASSERT_NOT_EQUAL(NULL, third);
-	TEST_ASSERT_EQUAL(3, third->ta_id);
-	TEST_ASSERT_EQUAL(6, third->ta_state);
-	TEST_ASSERT_EQUAL(NULL, third->next);
+	ta_state_remove(&list, 1, node_size);
+	assert_list_equals(&list, (uint32_t[]){0, 2, 3}, (int8_t[]){5, 4, 6}, 3, node_size);
 //	printf("Removed in the middle.  IDs: 023  States: 546\n");
 
-	ta_state_remove(head_ptr, head->next, NULL);
-	TEST_ASSERT_NOT_EQUAL(NULL, head);
-	TEST_ASSERT_EQUAL(0, head->ta_id);
-	TEST_ASSERT_EQUAL(5, head->ta_state);
-	TEST_ASSERT_NOT_EQUAL(NULL, head->next);
-	TEST_ASSERT_NOT_EQUAL(NULL, second);
-	TEST_ASSERT_EQUAL(2, second->ta_id);
-	TEST_ASSERT_EQUAL(4, second->ta_state);
-	TEST_ASSERT_EQUAL(NULL, second->next);
-//	printf("Appended at the end.  IDs: 02  States: 54\n");
-
-	ta_state_remove(head_ptr, NULL, NULL);
-	TEST_ASSERT_NOT_EQUAL(NULL, head);
-	TEST_ASSERT_EQUAL(2, head->ta_id);
-	TEST_ASSERT_EQUAL(4, head->ta_state);
-	TEST_ASSERT_EQUAL(NULL, head->next);
-//	printf("Appended at the start.  IDs: 2  States: 4\n");
-
-	ta_state_remove(head_ptr, NULL, NULL);
-	TEST_ASSERT_EQUAL(NULL, head);
-//	printf("Appended at the start.  IDs: -  States: -\n");
+	ta_state_remove(&list, 2, node_size);
+	assert_list_equals(&list, (uint32_t[]){0, 2}, (int8_t[]){5, 4}, 2, node_size);
+//	printf("Removed at the end.  IDs: 02  States: 54\n");
+
+	// Past the last node, nothing happens
+	ta_state_remove(&list, 2, node_size);
+	assert_list_equals(&list, (uint32_t[]){0, 2}, (int8_t[]){5, 4}, 2, node_size);
+
+	ta_state_remove(&list, 0, node_size);
+	assert_list_equals(&list, (uint32_t[]){2}, (int8_t[]){4}, 1, node_size);
+//	printf("Removed at the start.  IDs: 2  States: 4\n");
+
+	ta_state_remove(&list, 0, node_size);
+	TEST_ASSERT_EQUAL_UINT32(0, list.size);
+	// Memory is kept for later inserts
+	TEST_ASSERT_EQUAL_UINT32(capacity, list.capacity);
+//	printf("Removed at the start.  IDs: -  States: -\n");
+
+	free(list.nodes);
+}
+
+void remove_nodes(void) {
+	remove_nodes_of_size(sizeof(struct TAStateNode));
+	remove_nodes_of_size(sizeof(struct TAStateNodeWide));
+}
+
+void wide_nodes_above_max_ta_id(void) {
+	// Largest model of packed nodes, and the smallest one past it
+	struct SparseTsetlinMachine *stm = stm_create(2, 10, (STM_MAX_TA_ID + 1) / 2, 2, 127, -127, 1, 1, sizeof(uint32_t), 3.f, 42);
+	TEST_ASSERT_NOT_NULL(stm);
+	TEST_ASSERT_EQUAL_UINT8(sizeof(struct TAStateNode), stm->node_size);
+	stm_free(stm);
+	stm = stm_create(2, 10, (STM_MAX_TA_ID + 1) / 2 + 1, 4, 127, -127, 1, 1, sizeof(uint32_t), 3.f, 42);
+	TEST_ASSERT_NOT_NULL(stm);
+	TEST_ASSERT_EQUAL_UINT8(sizeof(struct TAStateNodeWide), stm->node_size);
+	TEST_ASSERT_NULL(stm_create(2, 10, UINT32_MAX / 2 + 1, 2, 127, -127, 1, 1, sizeof(uint32_t), 3.f, 42));
+
+	// Only the last literals carry the class, so training has to reach ta_ids past STM_MAX_TA_ID
+	struct FastPRNG rng;
+	prng_seed(&rng, 47);
+	uint32_t rows = 4;
+	uint8_t *X = calloc((size_t)rows * stm->num_literals, sizeof(uint8_t));
+	uint32_t y[] = {0, 1, 0, 1};
+	for (uint32_t row = 0; row < rows; row++) {
+		X[(size_t)row * stm->num_literals + stm->num_literals - 1] = y[row];
+		X[(size_t)row * stm->num_literals + stm->num_literals - 2] = prng_next_float(&rng) < 0.5f;
+	}
+	stm_train(stm, X, y, rows, 30);
+
+	uint32_t num_wide_ids = 0;
+	for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
+		const struct TAStateList *list = stm->ta_state + clause_id;
+		for (uint32_t node_id = 0; node_id < list->size; node_id++) {
+			TEST_ASSERT_TRUE(node_id + 1 == list->size || ta_state_get(list, node_id, stm->node_size).ta_id < ta_state_get(list, node_id + 1, stm->node_size).ta_id);
+			num_wide_ids += ta_state_get(list, node_id, stm->node_size).ta_id > STM_MAX_TA_ID;
+		}
+	}
+	TEST_ASSERT_GREATER_THAN_UINT32(0, num_wide_ids);
+
+	uint32_t y_pred[4];
+	stm_predict(stm, X, y_pred, rows);
+	TEST_ASSERT_EQUAL_UINT32_ARRAY(y, y_pred, rows);
+
+	stm_free(stm);
+	free(X);
+}
+
+void include_count_tracks_feedback(void) {
+	struct SparseTsetlinMachine *stm = stm_create(3, 20, 40, 30, 127, -127, 1, 1, sizeof(uint32_t), 3.f, 42);
+	struct FastPRNG rng;
+	prng_seed(&rng, 17);
+
+	// Start with nodes right around mid_state, so actions flip often
+	for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
+		struct TAStateList *list = stm->ta_state + clause_id;
+		for (uint32_t ta_id = 0; ta_id < stm->num_literals * 2; ta_id++) {
+			if (prng_next_float(&rng) < 0.2f) {
+				ta_state_insert(list, list->size, ta_id, (int8_t)(stm->mid_state - (prng_next_float(&rng) < 0.5f)), stm->node_size);
+			}
+		}
+	}
+	stm_update_include_counts(stm);
+
+	uint32_t rows = 40;
+	uint8_t *X = malloc(rows * stm->num_literals * sizeof(uint8_t));
+	uint32_t *y = malloc(rows * sizeof(uint32_t));
+	for (uint32_t row = 0; row < rows; row++) {
+		for (uint32_t literal_id = 0; literal_id < stm->num_literals; literal_id++) {
+			X[row * stm->num_literals + literal_id] = prng_next_float(&rng) < 0.5f;
+		}
+		y[row] = prng_next_uint32(&rng) % stm->num_classes;
+	}
+
+	// Same steps as stm_train, checking the counts after every row
+	for (uint32_t row = 0; row < rows; row++) {
+		calculate_clause_output(stm, X + row * stm->num_literals, 0);
+		sum_votes(stm);
+		stm->calculate_feedback(stm, X + row * stm->num_literals, y + row);
+		for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
+			const struct TAStateList *list = stm->ta_state + clause_id;
+			uint32_t include_count = 0;
+			for (uint32_t node_id = 0; node_id < list->size; node_id++) {
+				TEST_ASSERT_TRUE(node_id + 1 == list->size || ta_state_get(list, node_id, stm->node_size).ta_id < ta_state_get(list, node_id + 1, stm->node_size).ta_id);
+				TEST_ASSERT_TRUE(ta_state_get(list, node_id, stm->node_size).ta_state >= stm->sparse_min_state);
+				include_count += action(ta_state_get(list, node_id, stm->node_size).ta_state, stm->mid_state);
+			}
+			TEST_ASSERT_EQUAL_UINT32(include_count, stm->clause_include_count[clause_id]);
+		}
+	}
+
+	stm_free(stm);
+	free(X);
+	free(y);
+}
+
+void train_parallel_learns(void) {
+	struct SparseTsetlinMachine *stm = stm_create(3, 20, 40, 50, 127, -127, 1, 1, sizeof(uint32_t), 3.f, 42);
+	struct FastPRNG rng;
+	prng_seed(&rng, 29);
+
+	uint32_t rows = 90;
+	uint8_t *X = malloc(rows * stm->num_literals * sizeof(uint8_t));
+	uint32_t *y = malloc(rows * sizeof(uint32_t));
+	for (uint32_t row = 0; row < rows; row++) {
+		y[row] = prng_next_uint32(&rng) % stm->num_classes;
+		for (uint32_t literal_id = 0; literal_id < stm->num_literals; literal_id++) {
+			// Literals 0..2 give the class away
+			X[row * stm->num_literals + literal_id] = literal_id < 3 ? literal_id == y[row] : prng_next_float(&rng) < 0.5f;
+		}
+	}
+
+	stm_train_parallel(stm, X, y, rows, 20, 4);
+	TEST_ASSERT_NULL(stm->clause_locks);
+
+	// Lists stay sorted and consistent with the counts
+	for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
+		const struct TAStateList *list = stm->ta_state + clause_id;
+		uint32_t include_count = 0;
+		for (uint32_t node_id = 0; node_id < list->size; node_id++) {
+			TEST_ASSERT_TRUE(node_id + 1 == list->size || ta_state_get(list, node_id, stm->node_size).ta_id < ta_state_get(list, node_id + 1, stm->node_size).ta_id);
+			include_count += action(ta_state_get(list, node_id, stm->node_size).ta_state, stm->mid_state);
+		}
+		TEST_ASSERT_EQUAL_UINT32(include_count, stm->clause_include_count[clause_id]);
+	}
+
+	uint32_t *y_pred = malloc(rows * sizeof(uint32_t));
+	stm_predict(stm, X, y_pred, rows);
+	uint32_t correct = 0;
+	for (uint32_t row = 0; row < rows; row++) {
+		correct += y_pred[row] == y[row];
+	}
+	TEST_ASSERT_GREATER_OR_EQUAL_UINT32(rows * 9 / 10, correct);
+
+	stm_free(stm);
+	free(X);
+	free(y);
+	free(y_pred);
+}
+
+void train_indexed_matches_train(void) {
+	struct SparseTsetlinMachine *stm_a = stm_create(3, 20, 40, 30, 127, -127, 1, 1, sizeof(uint32_t), 3.f, 42);
+	struct SparseTsetlinMachine *stm_b = stm_create(3, 20, 40, 30, 127, -127, 1, 1, sizeof(uint32_t), 3.f, 42);
+	struct FastPRNG rng;
+	prng_seed(&rng, 31);
+
+	uint32_t rows = 50;
+	uint8_t *X = malloc(rows * stm_a->num_literals * sizeof(uint8_t));
+	uint32_t *y = malloc(rows * sizeof(uint32_t));
+	uint32_t *row_ids = malloc(rows * sizeof(uint32_t));
+	for (uint32_t row = 0; row < rows; row++) {
+		y[row] = prng_next_uint32(&rng) % stm_a->num_classes;
+		for (uint32_t literal_id = 0; literal_id < stm_a->num_literals; literal_id++) {
+			X[row * stm_a->num_literals + literal_id] = prng_next_float(&rng) < 0.5f;
+		}
+		row_ids[row] = row;
+	}
+
+	// Rows in storage order give the same model as stm_train
+	stm_train(stm_a, X, y, rows, 2);
+	stm_train_indexed(stm_b, X, y, row_ids, rows, 2, 0);
+	for (uint32_t clause_id = 0; clause_id < stm_a->num_clauses; clause_id++) {
+		const struct TAStateList *a_list = stm_a->ta_state + clause_id;
+		const struct TAStateList *b_list = stm_b->ta_state + clause_id;
+		TEST_ASSERT_EQUAL_UINT32(a_list->size, b_list->size);
+		for (uint32_t node_id = 0; node_id < a_list->size; node_id++) {
+			TEST_ASSERT_EQUAL_UINT32(ta_state_get(a_list, node_id, stm_a->node_size).ta_id, ta_state_get(b_list, node_id, stm_b->node_size).ta_id);
+			TEST_ASSERT_EQUAL_INT8(ta_state_get(a_list, node_id, stm_a->node_size).ta_state, ta_state_get(b_list, node_id, stm_b->node_size).ta_state);
+		}
+	}
+	TEST_ASSERT_EQUAL_INT16_ARRAY(stm_a->weights, stm_b->weights, stm_a->num_clauses * stm_a->num_classes);
+
+	// Shuffling keeps row_ids a permutation
+	stm_train_indexed(stm_b, X, y, row_ids, rows, 2, 1);
+	uint8_t *seen = calloc(rows, sizeof(uint8_t));
+	for (uint32_t i = 0; i < rows; i++) {
+		TEST_ASSERT_LESS_THAN_UINT32(rows, row_ids[i]);
+		TEST_ASSERT_FALSE(seen[row_ids[i]]);
+		seen[row_ids[i]] = 1;
+	}
+
+	stm_free(stm_a);
+	stm_free(stm_b);
+	free(X);
+	free(y);
+	free(row_ids);
+	free(seen);
+}
+
+void posting_lists_match_list_walk(void) {
+	struct SparseTsetlinMachine *stm = stm_create(3, 20, 400, 30, 127, -127, 1, 1, sizeof(uint32_t), 3.f, 42);
+	struct FastPRNG rng;
+	prng_seed(&rng, 41);
+
+	// Included and excluded nodes, clause 0 is left empty
+	for (uint32_t clause_id = 1; clause_id < stm->num_clauses; clause_id++) {
+		struct TAStateList *list = stm->ta_state + clause_id;
+		for (uint32_t ta_id = 0; ta_id < stm->num_literals * 2; ta_id++) {
+			if (prng_next_float(&rng) < 0.1f) {
+				ta_state_insert(list, list->size, ta_id, prng_next_float(&rng) < 0.5f ? stm->mid_state + 5 : stm->mid_state - 5, stm->node_size);
+			}
+		}
+	}
+	// A clause of a single positive literal, active whenever that literal is set
+	ta_state_insert(stm->ta_state + 1, 0, 0, stm->mid_state, stm->node_size);
+	stm_update_include_counts(stm);
+	stm_update_posting_lists(stm);
+	TEST_ASSERT_NOT_NULL(stm->posting_offsets);
+
+	uint8_t *X = malloc(stm->num_literals * sizeof(uint8_t));
+	uint8_t *expected = malloc(stm->num_clauses * sizeof(uint8_t));
+	uint32_t rows_through_postings = 0;
+	for (uint32_t row = 0; row < 200; row++) {
+		// Mostly sparse rows, a few dense ones that should fall back to walking the lists
+		float density = row % 10 == 0 ? 0.5f : 0.02f;
+		for (uint32_t literal_id = 0; literal_id < stm->num_literals; literal_id++) {
+			X[literal_id] = prng_next_float(&rng) < density;
+		}
+		X[0] = row % 2;
+
+		calculate_clause_output(stm, X, 1);
+		memcpy(expected, stm->clause_output, stm->num_clauses * sizeof(uint8_t));
+		if (calculate_clause_output_postings(stm, X)) {
+			rows_through_postings++;
+			TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, stm->clause_output, stm->num_clauses);
+		}
+		else {
+			TEST_ASSERT_EQUAL_UINT32(0, row % 10);
+		}
+	}
+	TEST_ASSERT_EQUAL_UINT32(180, rows_through_postings);
+
+	// Training changes the lists, the posting lists follow
+	uint32_t y = 1;
+	stm_train(stm, X, &y, 1, 5);
+	for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
+		const struct TAStateList *list = stm->ta_state + clause_id;
+		for (uint32_t node_id = 0; node_id < list->size; node_id++) {
+			uint32_t ta_id = ta_state_get(list, node_id, stm->node_size).ta_id;
+			uint8_t found = 0;
+			for (uint32_t posting_id = stm->posting_offsets[ta_id]; posting_id < stm->posting_offsets[ta_id + 1]; posting_id++) {
+				found |= stm->posting_clauses[posting_id] == clause_id;
+			}
+			TEST_ASSERT_EQUAL_UINT8(action(ta_state_get(list, node_id, stm->node_size).ta_state, stm->mid_state), found);
+		}
+	}
+
+	stm_free(stm);
+	free(X);
+	free(expected);
+}
+
+void feedback_merges_active_literals(void) {
+	// More than 2048 literals (al_row_size above 255), the last active literals word is partial
+	struct SparseTsetlinMachine *stm = stm_create(2, 20, 3001, 2, 127, -127, 1, 1, sizeof(uint32_t), 3.f, 42);
+	uint8_t *X = calloc(stm->num_literals, sizeof(uint8_t));
+	X[63] = 1;
+	X[1000] = 1;
+	X[3000] = 1;
+
+	// Active literals of class 0 at both ends of 64 bit words and of the row
+	uint32_t active[] = {0, 63, 64, 2999, 3000};
+	for (uint32_t i = 0; i < 5; i++) {
+		stm->active_literals[active[i] >> 3] |= 1 << (active[i] & 7);
+	}
+	// Literal 64 (not set) raises its positive TA, literal 2 isn't active and its negated TA (not set) stays
+	struct TAStateList *list = stm->ta_state;
+	ta_state_insert(list, 0, 5, stm->mid_state - 1, stm->node_size);
+	ta_state_insert(list, 1, 128, stm->mid_state - 1, stm->node_size);
+	stm_update_include_counts(stm);
+
+	// Positive TAs of every active literal, negated ones only for the literals set in X
+	type_2_feedback(stm, X, 0, 0);
+	int8_t init = stm->sparse_init_state;
+	int8_t mid = stm->mid_state;
+	assert_list_equals(
+		list,
+		(uint32_t[]){0, 5, 126, 127, 128, 5998, 6000, 6001},
+		(int8_t[]){init, mid - 1, init, init, mid, init, init, init},
+		8, stm->node_size
+	);
+	TEST_ASSERT_EQUAL_UINT32(1, stm->clause_include_count[0]);
+
+	// Set literals become active for class 1, except where the clause has their positive TA (126, 6000)
+	type_1a_feedback(stm, X, 0, 1);
+	const uint8_t *class_active_literals = stm->active_literals + stm->al_row_size;
+	for (uint32_t literal_id = 0; literal_id < stm->num_literals; literal_id++) {
+		TEST_ASSERT_EQUAL_UINT8(literal_id == 1000, (class_active_literals[literal_id >> 3] >> (literal_id & 7)) & 1);
+	}
+
+	stm_free(stm);
+	free(X);
+}
+
+void narrow_state_range_stays_in_bounds(void) {
+	// sparse_min_state (mid_state - 40) is below min_state here, so feedback alone has to keep states in range
+	struct SparseTsetlinMachine *stm = stm_create(2, 10, 16, 20, 20, -20, 1, 1, sizeof(uint32_t), 2.f, 42);
+	TEST_ASSERT_LESS_THAN_INT8(stm->min_state, stm->sparse_min_state);
+
+	struct FastPRNG rng;
+	prng_seed(&rng, 43);
+	uint32_t rows = 100;
+	uint8_t *X = malloc(rows * stm->num_literals * sizeof(uint8_t));
+	uint32_t *y = malloc(rows * sizeof(uint32_t));
+	for (uint32_t row = 0; row < rows; row++) {
+		y[row] = prng_next_uint32(&rng) % 2;
+		for (uint32_t literal_id = 0; literal_id < stm->num_literals; literal_id++) {
+			X[row * stm->num_literals + literal_id] = prng_next_float(&rng) < (literal_id % 2 == y[row] ? 0.8f : 0.2f);
+		}
+	}
+	stm_train(stm, X, y, rows, 20);
+
+	uint32_t num_nodes = 0;
+	for (uint32_t clause_id = 0; clause_id < stm->num_clauses; clause_id++) {
+		const struct TAStateList *list = stm->ta_state + clause_id;
+		for (uint32_t node_id = 0; node_id < list->size; node_id++) {
+			TEST_ASSERT_GREATER_OR_EQUAL_INT8(stm->min_state, ta_state_get(list, node_id, stm->node_size).ta_state);
+			TEST_ASSERT_LESS_OR_EQUAL_INT8(stm->max_state, ta_state_get(list, node_id, stm->node_size).ta_state);
+		}
+		num_nodes += list->size;
+	}
+	TEST_ASSERT_GREATER_THAN_UINT32(0, num_nodes);
+
+	stm_free(stm);
+	free(X);
+	free(y);
 }
 
 void test_linked_list_run_all(void) {
 	RUN_TEST(insert_nodes);
 	RUN_TEST(remove_nodes);
+	RUN_TEST(wide_nodes_above_max_ta_id);
+	RUN_TEST(include_count_tracks_feedback);
+	RUN_TEST(train_parallel_learns);
+	RUN_TEST(train_indexed_matches_train);
+	RUN_TEST(posting_lists_match_list_walk);
+	RUN_TEST(feedback_merges_active_literals);
+	RUN_TEST(narrow_state_range_stays_in_bounds);
 }
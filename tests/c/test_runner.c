@@ -19,6 +19,8 @@ void tearDown(void) {}
 
 extern void test_tsetlin_machine_run_all(void);
 extern void test_linked_list_run_all(void);
+extern void test_simd_kernels_run_all(void);
+extern void test_stateless_tsetlin_machine_run_all(void);
 
 
 int main(void) {
@@ -26,6 +28,8 @@ int main(void) {
 
     test_tsetlin_machine_run_all();
     test_linked_list_run_all();
+    test_simd_kernels_run_all();
+    test_stateless_tsetlin_machine_run_all();
 
     return UNITY_END();
 }
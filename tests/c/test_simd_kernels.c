@@ -0,0 +1,258 @@
+#include "simd_kernels.h"
+#include "unity/unity.h"
+#include "stdlib.h"
+
+
+#include "../../src/c/src/simd_kernels.c"
+
+// Odd sizes, so that every kernel runs both its vector loop and its tail
+#define TEST_NUM_CLAUSES 37
+#define TEST_MASK_ROW_SIZE 13
+#define TEST_NUM_CLASSES 21
+#define TEST_CLAUSE_WORDS ((TEST_NUM_CLAUSES - 1) / 64 + 1)
+
+static uint64_t random_word(void) {
+	return ((uint64_t)rand() << 42) ^ ((uint64_t)rand() << 21) ^ (uint64_t)rand();
+}
+
+void packed_clause_output_levels_match(void) {
+	uint64_t include[TEST_NUM_CLAUSES * TEST_MASK_ROW_SIZE];
+	uint64_t include_negated[TEST_NUM_CLAUSES * TEST_MASK_ROW_SIZE];
+	uint32_t include_count[TEST_NUM_CLAUSES] = {0};
+	uint64_t X_packed[TEST_MASK_ROW_SIZE];
+	uint64_t expected[TEST_CLAUSE_WORDS];
+	uint64_t output[TEST_CLAUSE_WORDS];
+
+	for (uint32_t i = 0; i < TEST_MASK_ROW_SIZE; i++) {
+		X_packed[i] = random_word();
+	}
+	// Clauses include literals consistent with X (active), plus a few random ones (mostly inactive),
+	// and every fifth clause is empty
+	for (uint32_t clause_id = 0; clause_id < TEST_NUM_CLAUSES; clause_id++) {
+		for (uint32_t i = 0; i < TEST_MASK_ROW_SIZE; i++) {
+			uint64_t pick = random_word() & random_word() & random_word();
+			uint64_t noise = clause_id % 3 == 0 ? (random_word() & random_word() & random_word() & random_word()) : 0;
+			include[clause_id * TEST_MASK_ROW_SIZE + i] = clause_id % 5 == 0 ? 0 : (pick & X_packed[i]) | noise;
+			include_negated[clause_id * TEST_MASK_ROW_SIZE + i] = clause_id % 5 == 0 ? 0 : pick & ~X_packed[i];
+			include_count[clause_id] += __builtin_popcountll(include[clause_id * TEST_MASK_ROW_SIZE + i]);
+			include_count[clause_id] += __builtin_popcountll(include_negated[clause_id * TEST_MASK_ROW_SIZE + i]);
+		}
+	}
+
+	TEST_ASSERT_EQUAL(1, simd_set_level(SIMD_SCALAR));
+	simd_kernels.packed_clause_output(include, include_negated, include_count, X_packed, TEST_NUM_CLAUSES, TEST_MASK_ROW_SIZE, expected);
+	TEST_ASSERT_EQUAL(0, expected[0] & 1);
+	TEST_ASSERT_EQUAL(2, expected[0] & 2);
+	TEST_ASSERT_EQUAL(0, expected[TEST_CLAUSE_WORDS - 1] >> (TEST_NUM_CLAUSES % 64));
+
+	for (int level = SIMD_AVX2; level <= (int)simd_detect_level(); level++) {
+		TEST_ASSERT_EQUAL(1, simd_set_level((enum SimdLevel)level));
+		simd_kernels.packed_clause_output(include, include_negated, include_count, X_packed, TEST_NUM_CLAUSES, TEST_MASK_ROW_SIZE, output);
+		TEST_ASSERT_EQUAL_HEX64_ARRAY(expected, output, TEST_CLAUSE_WORDS);
+	}
+
+	simd_set_level(simd_detect_level());
+}
+
+// TA id of literal literal_id that holds for X, or that is falsified by it
+static uint32_t clause_ta_id_for(const uint8_t *X, uint32_t literal_id, uint8_t falsified) {
+	return 2 * literal_id + (falsified ? X[literal_id] : !X[literal_id]);
+}
+
+void id_clause_output_levels_match(void) {
+	// Few literals, so that the last ones (checked outside the gathers) come up often
+	uint32_t num_literals = 45;
+	uint8_t *X = malloc(num_literals * sizeof(uint8_t));  // exact size, so reads past the end show up under ASan
+	for (uint32_t literal_id = 0; literal_id < num_literals; literal_id++) {
+		X[literal_id] = rand() % 2;
+	}
+
+	// Clauses of 0 .. 36 TAs, every third one has a falsified TA at a random position
+	uint32_t clause_offsets[TEST_NUM_CLAUSES + 1] = {0};
+	uint32_t ta_ids[TEST_NUM_CLAUSES * TEST_NUM_CLAUSES];
+	uint16_t ta_ids_16[TEST_NUM_CLAUSES * TEST_NUM_CLAUSES];
+	uint64_t expected[TEST_CLAUSE_WORDS] = {0};
+	uint64_t output[TEST_CLAUSE_WORDS];
+	for (uint32_t clause_id = 0; clause_id < TEST_NUM_CLAUSES; clause_id++) {
+		uint32_t start = clause_offsets[clause_id];
+		uint32_t length = clause_id;
+		uint32_t falsified_pos = clause_id % 3 == 0 && length > 0 ? (uint32_t)rand() % length : UINT32_MAX;
+		for (uint32_t i = 0; i < length; i++) {
+			ta_ids[start + i] = clause_ta_id_for(X, (uint32_t)rand() % num_literals, i == falsified_pos);
+			ta_ids_16[start + i] = (uint16_t)ta_ids[start + i];
+		}
+		clause_offsets[clause_id + 1] = start + length;
+		expected[clause_id / 64] |= (uint64_t)(length > 0 && falsified_pos == UINT32_MAX) << (clause_id % 64);
+	}
+
+	for (int level = SIMD_SCALAR; level <= (int)simd_detect_level(); level++) {
+		TEST_ASSERT_EQUAL(1, simd_set_level((enum SimdLevel)level));
+		simd_kernels.id_clause_output(ta_ids, sizeof(uint32_t), clause_offsets, TEST_NUM_CLAUSES, X, num_literals, output);
+		TEST_ASSERT_EQUAL_HEX64_ARRAY(expected, output, TEST_CLAUSE_WORDS);
+		simd_kernels.id_clause_output(ta_ids_16, sizeof(uint16_t), clause_offsets, TEST_NUM_CLAUSES, X, num_literals, output);
+		TEST_ASSERT_EQUAL_HEX64_ARRAY(expected, output, TEST_CLAUSE_WORDS);
+	}
+
+	simd_set_level(simd_detect_level());
+	free(X);
+}
+
+void node_clause_output_levels_match(void) {
+	uint32_t num_literals = 45;
+	uint8_t *X = malloc(num_literals * sizeof(uint8_t));
+	for (uint32_t literal_id = 0; literal_id < num_literals; literal_id++) {
+		X[literal_id] = rand() % 2;
+	}
+
+	// Packed nodes (ta_id in bits 0 .. 23, ta_state in bits 24 .. 31) around mid_state 0,
+	// falsified TAs only deactivate the clause if they are included
+	uint32_t nodes[TEST_NUM_CLAUSES];
+	const int8_t states[] = {-127, -1, 0, 1, 127};
+	for (uint32_t num_nodes = 0; num_nodes <= TEST_NUM_CLAUSES; num_nodes++) {
+		uint8_t expected = 1;
+		for (uint32_t node_id = 0; node_id < num_nodes; node_id++) {
+			uint8_t falsified = rand() % (2 * TEST_NUM_CLAUSES) == 0;
+			int8_t state = falsified ? states[rand() % 5] : (int8_t)(rand() % 255 - 127);
+			nodes[node_id] = clause_ta_id_for(X, (uint32_t)rand() % num_literals, falsified) | ((uint32_t)(uint8_t)state << 24);
+			expected &= !(falsified && state >= 0);
+		}
+
+		for (int level = SIMD_SCALAR; level <= (int)simd_detect_level(); level++) {
+			TEST_ASSERT_EQUAL(1, simd_set_level((enum SimdLevel)level));
+			TEST_ASSERT_EQUAL_UINT8(expected, simd_kernels.node_clause_output(nodes, num_nodes, X, num_literals, 0));
+		}
+	}
+
+	simd_set_level(simd_detect_level());
+	free(X);
+}
+
+void sum_votes_levels_match(void) {
+	uint8_t clause_output[TEST_NUM_CLAUSES];
+	uint64_t clause_output_bitmap[TEST_CLAUSE_WORDS] = {0};
+	int16_t weights[TEST_NUM_CLAUSES * TEST_NUM_CLASSES];
+	int32_t expected[TEST_NUM_CLASSES];
+	int32_t votes[TEST_NUM_CLASSES];
+
+	for (uint32_t clause_id = 0; clause_id < TEST_NUM_CLAUSES; clause_id++) {
+		clause_output[clause_id] = rand() % 2;
+		clause_output_bitmap[clause_id / 64] |= (uint64_t)clause_output[clause_id] << (clause_id % 64);
+		for (uint32_t class_id = 0; class_id < TEST_NUM_CLASSES; class_id++) {
+			weights[clause_id * TEST_NUM_CLASSES + class_id] = (int16_t)(rand() % 201 - 100);
+		}
+	}
+
+	TEST_ASSERT_EQUAL(1, simd_set_level(SIMD_SCALAR));
+	uint32_t expected_class = simd_kernels.sum_votes(clause_output, weights, TEST_NUM_CLAUSES, TEST_NUM_CLASSES, 150, expected);
+	for (uint32_t class_id = 0; class_id < TEST_NUM_CLASSES; class_id++) {
+		TEST_ASSERT_TRUE(expected[class_id] <= expected[expected_class]);
+		TEST_ASSERT_TRUE(class_id >= expected_class || expected[class_id] < expected[expected_class]);
+	}
+
+	for (int level = SIMD_SCALAR; level <= (int)simd_detect_level(); level++) {
+		TEST_ASSERT_EQUAL(1, simd_set_level((enum SimdLevel)level));
+		TEST_ASSERT_EQUAL_UINT32(expected_class, simd_kernels.sum_votes(clause_output, weights, TEST_NUM_CLAUSES, TEST_NUM_CLASSES, 150, votes));
+		TEST_ASSERT_EQUAL_INT32_ARRAY(expected, votes, TEST_NUM_CLASSES);
+		TEST_ASSERT_EQUAL_UINT32(expected_class, simd_kernels.sum_votes_bitmap(clause_output_bitmap, weights, TEST_NUM_CLAUSES, TEST_NUM_CLASSES, 150, votes));
+		TEST_ASSERT_EQUAL_INT32_ARRAY(expected, votes, TEST_NUM_CLASSES);
+	}
+
+	simd_set_level(simd_detect_level());
+}
+
+void clip_votes_picks_first_highest(void) {
+	int32_t votes[TEST_NUM_CLASSES];
+
+	for (int level = SIMD_SCALAR; level <= (int)simd_detect_level(); level++) {
+		TEST_ASSERT_EQUAL(1, simd_set_level((enum SimdLevel)level));
+
+		// Ties after clipping, the first of them wins, also when it's in the scalar / masked tail
+		for (uint32_t first = 0; first < TEST_NUM_CLASSES; first++) {
+			for (uint32_t class_id = 0; class_id < TEST_NUM_CLASSES; class_id++) {
+				votes[class_id] = -(int32_t)class_id;
+			}
+			votes[first] = 500;
+			votes[TEST_NUM_CLASSES - 1] = 400;
+			TEST_ASSERT_EQUAL_UINT32(first, simd_kernels.clip_votes(votes, TEST_NUM_CLASSES, 100));
+			TEST_ASSERT_EQUAL_INT32(100, votes[first]);
+			TEST_ASSERT_EQUAL_INT32(100, votes[TEST_NUM_CLASSES - 1]);
+		}
+
+		// Weight rows are added without clipping
+		int16_t weights[TEST_NUM_CLASSES];
+		for (uint32_t class_id = 0; class_id < TEST_NUM_CLASSES; class_id++) {
+			votes[class_id] = (int32_t)class_id;
+			weights[class_id] = (int16_t)(-300 * (int32_t)class_id);
+		}
+		simd_kernels.add_weights(votes, weights, TEST_NUM_CLASSES);
+		for (uint32_t class_id = 0; class_id < TEST_NUM_CLASSES; class_id++) {
+			TEST_ASSERT_EQUAL_INT32(-299 * (int32_t)class_id, votes[class_id]);
+		}
+	}
+
+	simd_set_level(simd_detect_level());
+}
+
+void update_states_levels_match(void) {
+	// Not a multiple of 64 or 32, and states at the edges of every limit
+	uint32_t num_tas = 2 * 75;
+	int8_t initial[2 * 75];
+	int8_t expected[2 * 75];
+	int8_t ta_state[2 * 75];
+	uint64_t increment[3];
+	uint64_t decrement[3];
+	uint64_t expected_flipped[3];
+	uint64_t flipped[3];
+	const int8_t edges[] = {-127, -126, -1, 0, 1, 126, 127};
+
+	for (uint32_t ta_id = 0; ta_id < num_tas; ta_id++) {
+		initial[ta_id] = rand() % 2 ? edges[rand() % 7] : (int8_t)(rand() % 255 - 127);
+	}
+	for (uint32_t i = 0; i < 3; i++) {
+		uint64_t bits = random_word();
+		increment[i] = bits & random_word();
+		decrement[i] = bits & ~increment[i];
+	}
+
+	const uint64_t *increments[] = {increment, NULL, increment};
+	const uint64_t *decrements[] = {decrement, decrement, NULL};
+	for (uint32_t step = 0; step < 3; step++) {
+		// Reference, straight from the kernel description
+		uint32_t expected_count = 0;
+		memset(expected_flipped, 0, sizeof(expected_flipped));
+		for (uint32_t ta_id = 0; ta_id < num_tas; ta_id++) {
+			int8_t state = initial[ta_id];
+			if (increments[step] != NULL && ((increments[step][ta_id / 64] >> (ta_id % 64)) & 1) && state < 127) state++;
+			if (decrements[step] != NULL && ((decrements[step][ta_id / 64] >> (ta_id % 64)) & 1) && state > -127) state--;
+			expected[ta_id] = state;
+			expected_count += state >= 0;
+			expected_flipped[ta_id / 64] |= (uint64_t)((initial[ta_id] >= 0) != (state >= 0)) << (ta_id % 64);
+		}
+
+		for (int level = SIMD_SCALAR; level <= (int)simd_detect_level(); level++) {
+			TEST_ASSERT_EQUAL(1, simd_set_level((enum SimdLevel)level));
+			memcpy(ta_state, initial, sizeof(initial));
+			uint32_t count = simd_kernels.update_states(ta_state, increments[step], decrements[step], num_tas, 127, -127, 0, flipped);
+			TEST_ASSERT_EQUAL_INT8_ARRAY(expected, ta_state, num_tas);
+			TEST_ASSERT_EQUAL_UINT32(expected_count, count);
+			TEST_ASSERT_EQUAL_HEX64_ARRAY(expected_flipped, flipped, 3);
+
+			// Same states without reporting flips
+			memcpy(ta_state, initial, sizeof(initial));
+			count = simd_kernels.update_states(ta_state, increments[step], decrements[step], num_tas, 127, -127, 0, NULL);
+			TEST_ASSERT_EQUAL_INT8_ARRAY(expected, ta_state, num_tas);
+			TEST_ASSERT_EQUAL_UINT32(expected_count, count);
+		}
+	}
+
+	simd_set_level(simd_detect_level());
+}
+
+void test_simd_kernels_run_all(void) {
+	RUN_TEST(packed_clause_output_levels_match);
+	RUN_TEST(id_clause_output_levels_match);
+	RUN_TEST(node_clause_output_levels_match);
+	RUN_TEST(sum_votes_levels_match);
+	RUN_TEST(clip_votes_picks_first_highest);
+	RUN_TEST(update_states_levels_match);
+}
@@ -0,0 +1,479 @@
+#include "stateless_tsetlin_machine.h"
+#include "sparse_tsetlin_machine.h"
+#include "tsetlin_machine.h"
+#include "fast_prng.h"
+#include "unity/unity.h"
+#include "stdlib.h"
+
+
+#include "../../src/c/src/stateless_tsetlin_machine.c"
+
+// Stateless model with random clauses (clause 0 left empty) and weights
+static struct StatelessTsetlinMachine *random_sltm(uint32_t num_literals, uint32_t num_clauses, float include_probability, uint32_t seed) {
+    struct StatelessTsetlinMachine *sltm = sltm_create(3, 50, num_literals, num_clauses, 127, -127, 1, 1, sizeof(uint32_t), 10.f);
+    struct FastPRNG rng;
+    prng_seed(&rng, seed);
+    uint32_t *clause_offsets = calloc(num_clauses + 1, sizeof(uint32_t));
+    uint32_t *ta_ids = malloc((size_t)num_clauses * num_literals * 2 * sizeof(uint32_t));
+    uint32_t num_included = 0;
+    for (uint32_t clause_id = 1; clause_id < sltm->num_clauses; clause_id++) {
+        for (uint32_t ta_id = 0; ta_id < sltm->num_literals * 2; ta_id++) {
+            if (prng_next_float(&rng) < include_probability) {
+                ta_ids[num_included++] = ta_id;
+            }
+        }
+        clause_offsets[clause_id + 1] = num_included;
+    }
+    for (uint32_t i = 0; i < sltm->num_clauses * sltm->num_classes; i++) {
+        sltm->weights[i] = (int16_t)(prng_next_uint32(&rng) % 21) - 10;
+    }
+    TEST_ASSERT_TRUE(sltm_set_clauses(sltm, clause_offsets, ta_ids));
+    free(clause_offsets);
+    free(ta_ids);
+    return sltm;
+}
+
+void test_posting_lists_match_list_walk(void) {
+    struct StatelessTsetlinMachine *sltm = random_sltm(500, 40, 0.01f, 51);
+    TEST_ASSERT_NOT_NULL(sltm->posting_offsets);
+    struct FastPRNG rng;
+    prng_seed(&rng, 52);
+
+    uint32_t words = (sltm->num_clauses - 1) / 64 + 1;
+    uint8_t *X = malloc(sltm->num_literals * sizeof(uint8_t));
+    uint64_t *expected = malloc(words * sizeof(uint64_t));
+    for (uint32_t row = 0; row < 100; row++) {
+        for (uint32_t literal_id = 0; literal_id < sltm->num_literals; literal_id++) {
+            X[literal_id] = prng_next_float(&rng) < 0.01f;
+        }
+
+        calculate_clause_output(sltm, X);
+        memcpy(expected, sltm->clause_output, words * sizeof(uint64_t));
+        uint32_t num_row_literals;
+        TEST_ASSERT_TRUE(use_postings(sltm, X, &num_row_literals));
+        calculate_clause_output_postings(sltm, num_row_literals);
+        TEST_ASSERT_EQUAL_HEX64_ARRAY(expected, sltm->clause_output, words);
+        // The empty clause is never active
+        TEST_ASSERT_EQUAL_UINT64(0, sltm->clause_output[0] & 1);
+    }
+
+    sltm_free(sltm);
+    free(X);
+    free(expected);
+}
+
+// Batches take the bit-sliced path for dense rows and the posting lists for sparse ones, predictions stay the same
+void test_predict_batch_matches_rows(void) {
+    struct StatelessTsetlinMachine *sltm = random_sltm(300, 70, 0.01f, 53);
+    struct FastPRNG rng;
+    prng_seed(&rng, 54);
+
+    uint32_t rows = 4 * 64;
+    uint8_t *X = malloc(rows * sltm->num_literals * sizeof(uint8_t));
+    uint32_t *y_expected = malloc(rows * sizeof(uint32_t));
+    uint32_t *y_pred = malloc(rows * sizeof(uint32_t));
+    for (uint32_t row = 0; row < rows; row++) {
+        float density = row < 128 ? 0.01f : 0.5f;
+        for (uint32_t literal_id = 0; literal_id < sltm->num_literals; literal_id++) {
+            X[row * sltm->num_literals + literal_id] = prng_next_float(&rng) < density;
+        }
+    }
+    TEST_ASSERT_TRUE(block_uses_postings(sltm, X, 64));
+    TEST_ASSERT_FALSE(block_uses_postings(sltm, X + 128 * sltm->num_literals, 64));
+
+    for (uint32_t row = 0; row < rows; row++) {
+        calculate_clause_output(sltm, X + row * sltm->num_literals);
+        y_expected[row] = sum_votes(sltm);
+    }
+    sltm_predict(sltm, X, y_pred, rows);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(y_expected, y_pred, rows);
+
+    // Without posting lists, the same predictions from the TA lists
+    sltm_free_posting_lists(sltm);
+    sltm_predict(sltm, X, y_pred, rows);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(y_expected, y_pred, rows);
+
+    sltm_free(sltm);
+    free(X);
+    free(y_expected);
+    free(y_pred);
+}
+
+// Ids are stored in 16 bits while every ta_id fits, in 32 bits otherwise, predictions don't depend on it
+void test_ta_id_size_follows_shape(void) {
+    struct StatelessTsetlinMachine *narrow = random_sltm(32768, 40, 0.0005f, 55);
+    struct StatelessTsetlinMachine *wide = sltm_create(3, 50, 32769, 40, 127, -127, 1, 1, sizeof(uint32_t), 10.f);
+    TEST_ASSERT_EQUAL_UINT8(sizeof(uint16_t), narrow->ta_id_size);
+    TEST_ASSERT_EQUAL_UINT8(sizeof(uint32_t), wide->ta_id_size);
+
+    // Same clauses and weights, the extra literal isn't included anywhere
+    uint32_t num_included = narrow->clause_offsets[narrow->num_clauses];
+    uint32_t *ta_ids = calloc(num_included + 1, sizeof(uint32_t));
+    for (uint32_t pos = 0; pos < num_included; pos++) {
+        ta_ids[pos] = clause_ta_id(narrow, pos);
+        TEST_ASSERT_LESS_THAN_UINT32(narrow->num_literals * 2, ta_ids[pos]);
+    }
+    TEST_ASSERT_TRUE(sltm_set_clauses(wide, narrow->clause_offsets, ta_ids));
+    memcpy(wide->weights, narrow->weights, narrow->num_clauses * narrow->num_classes * sizeof(int16_t));
+    for (uint32_t pos = 0; pos < num_included; pos++) {
+        TEST_ASSERT_EQUAL_UINT32(ta_ids[pos], clause_ta_id(wide, pos));
+    }
+
+    struct FastPRNG rng;
+    prng_seed(&rng, 56);
+    uint32_t rows = 8;
+    uint8_t *X_narrow = malloc(rows * narrow->num_literals * sizeof(uint8_t));
+    uint8_t *X_wide = malloc(rows * wide->num_literals * sizeof(uint8_t));
+    for (uint32_t row = 0; row < rows; row++) {
+        for (uint32_t literal_id = 0; literal_id < wide->num_literals; literal_id++) {
+            uint8_t value = prng_next_float(&rng) < 0.5f;
+            X_wide[row * wide->num_literals + literal_id] = value;
+            if (literal_id < narrow->num_literals) {
+                X_narrow[row * narrow->num_literals + literal_id] = value;
+            }
+        }
+    }
+    uint32_t y_narrow[8], y_wide[8];
+    sltm_predict(narrow, X_narrow, y_narrow, rows);
+    sltm_predict(wide, X_wide, y_wide, rows);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(y_narrow, y_wide, rows);
+
+    sltm_free(narrow);
+    sltm_free(wide);
+    free(ta_ids);
+    free(X_narrow);
+    free(X_wide);
+}
+
+// Duplicates merge (unless their weights would overflow), empty, zero-weight and cancelled out clauses go, votes stay the same
+void test_compact_merges_duplicates(void) {
+    // Threshold high enough that votes are never clipped, so they're compared exactly
+    struct StatelessTsetlinMachine *sltm = sltm_create(3, 100000, 20, 10, 127, -127, 1, 1, sizeof(uint32_t), 10.f);
+    // Clause patterns: P0 empty, P1 {0, 10}, P2 {7}, P3 {2, 4, 6}, P4 {39}
+    uint32_t clause_offsets[11] = {0, 2, 2, 3, 5, 8, 9, 12, 13, 16, 17};
+    uint32_t ta_ids[17] = {
+        0, 10,  // 0: P1
+                // 1: P0
+        7,      // 2: P2, zero weights
+        0, 10,  // 3: P1, merges into 0
+        2, 4, 6,  // 4: P3
+        39,     // 5: P4
+        2, 4, 6,  // 6: P3, would overflow when merged into 4
+        39,     // 7: P4, merges into 5 and cancels it out
+        2, 4, 6,  // 8: P3, merges into 6
+        7,      // 9: P2
+    };
+    int16_t weights[30] = {
+        1, -1, 2,   5, 5, 5,   0, 0, 0,   2, 0, -2,   30000, 1, 0,
+        4, -4, 1,   30000, 0, 0,   -4, 4, -1,   -1, 0, 0,   1, 1, 1,
+    };
+    TEST_ASSERT_TRUE(sltm_set_clauses(sltm, clause_offsets, ta_ids));
+    memcpy(sltm->weights, weights, sizeof(weights));
+
+    struct FastPRNG rng;
+    prng_seed(&rng, 63);
+    uint32_t rows = 300;
+    uint8_t *X = malloc(rows * sltm->num_literals * sizeof(uint8_t));
+    for (uint32_t i = 0; i < rows * sltm->num_literals; i++) {
+        X[i] = prng_next_float(&rng) < 0.5f;
+    }
+    int32_t *votes_expected = malloc(rows * sltm->num_classes * sizeof(int32_t));
+    uint32_t *y_expected = malloc(rows * sizeof(uint32_t));
+    uint32_t *y_pred = malloc(rows * sizeof(uint32_t));
+    for (uint32_t row = 0; row < rows; row++) {
+        sltm_predict(sltm, X + row * sltm->num_literals, y_pred, 1);
+        memcpy(votes_expected + row * sltm->num_classes, sltm->votes, sltm->num_classes * sizeof(int32_t));
+    }
+    sltm_predict(sltm, X, y_expected, rows);
+
+    // A built trie is rebuilt for the new clause ids
+    sltm_update_trie(sltm);
+    TEST_ASSERT_EQUAL_UINT32(6, sltm_compact(sltm));
+    TEST_ASSERT_EQUAL_UINT32(4, sltm->num_clauses);
+    uint32_t offsets_compacted[5] = {0, 2, 5, 8, 9};
+    uint32_t ta_ids_compacted[9] = {0, 10, 2, 4, 6, 2, 4, 6, 7};
+    int16_t weights_compacted[12] = {3, -1, 0,   30000, 1, 0,   29999, 0, 0,   1, 1, 1};
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(offsets_compacted, sltm->clause_offsets, 5);
+    for (uint32_t pos = 0; pos < 9; pos++) {
+        TEST_ASSERT_EQUAL_UINT32(ta_ids_compacted[pos], clause_ta_id(sltm, pos));
+    }
+    TEST_ASSERT_EQUAL_INT16_ARRAY(weights_compacted, sltm->weights, 12);
+    TEST_ASSERT_NOT_NULL(sltm->posting_offsets);
+    TEST_ASSERT_NOT_NULL(sltm->trie_nodes);
+    TEST_ASSERT_EQUAL_UINT32(4, sltm->trie_nodes[sltm->num_trie_nodes].clause_start);
+
+    for (uint32_t row = 0; row < rows; row++) {
+        sltm_predict(sltm, X + row * sltm->num_literals, y_pred, 1);
+        TEST_ASSERT_EQUAL_INT32_ARRAY(votes_expected + row * sltm->num_classes, sltm->votes, sltm->num_classes);
+    }
+    sltm_predict(sltm, X, y_pred, rows);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(y_expected, y_pred, rows);
+
+    // Nothing left to merge
+    TEST_ASSERT_EQUAL_UINT32(0, sltm_compact(sltm));
+    sltm_free(sltm);
+
+    // A model of only empty clauses keeps one
+    sltm = sltm_create(3, 50, 20, 70, 127, -127, 1, 1, sizeof(uint32_t), 10.f);
+    TEST_ASSERT_EQUAL_UINT32(69, sltm_compact(sltm));
+    TEST_ASSERT_EQUAL_UINT32(1, sltm->num_clauses);
+    sltm_predict(sltm, X, y_pred, rows);
+    TEST_ASSERT_EQUAL_UINT32(0, y_pred[rows - 1]);
+
+    sltm_free(sltm);
+    free(X);
+    free(votes_expected);
+    free(y_expected);
+    free(y_pred);
+}
+
+// Clauses over few literals share prefixes (and some are prefixes or copies of others), the trie gives the same outputs
+void test_trie_matches_clause_walk(void) {
+    struct StatelessTsetlinMachine *sltm = random_sltm(12, 300, 0.15f, 64);
+    // Opt-in
+    TEST_ASSERT_NULL(sltm->trie_nodes);
+    sltm_update_trie(sltm);
+    TEST_ASSERT_NOT_NULL(sltm->trie_nodes);
+    TEST_ASSERT_LESS_THAN_UINT32(sltm->clause_offsets[sltm->num_clauses], sltm->num_trie_nodes);
+    // Every non-empty clause ends at exactly one node
+    uint32_t num_non_empty = 0;
+    for (uint32_t clause_id = 0; clause_id < sltm->num_clauses; clause_id++) {
+        num_non_empty += sltm->clause_offsets[clause_id] != sltm->clause_offsets[clause_id + 1];
+    }
+    TEST_ASSERT_EQUAL_UINT32(num_non_empty, sltm->trie_nodes[sltm->num_trie_nodes].clause_start);
+
+    struct FastPRNG rng;
+    prng_seed(&rng, 65);
+    uint32_t rows = 4 * 64 + 7;
+    uint8_t *X = malloc(rows * sltm->num_literals * sizeof(uint8_t));
+    for (uint32_t i = 0; i < rows * sltm->num_literals; i++) {
+        X[i] = prng_next_float(&rng) < 0.5f;
+    }
+
+    uint32_t words = (sltm->num_clauses - 1) / 64 + 1;
+    uint64_t *expected = malloc(words * sizeof(uint64_t));
+    struct StatelessTrieNode *trie_nodes = sltm->trie_nodes;
+    for (uint32_t row = 0; row < rows; row++) {
+        sltm->trie_nodes = NULL;
+        calculate_clause_output(sltm, X + row * sltm->num_literals);
+        memcpy(expected, sltm->clause_output, words * sizeof(uint64_t));
+        sltm->trie_nodes = trie_nodes;
+        calculate_clause_output(sltm, X + row * sltm->num_literals);
+        TEST_ASSERT_EQUAL_HEX64_ARRAY(expected, sltm->clause_output, words);
+    }
+
+    // Bit-sliced blocks (the last one partial) through the trie
+    uint32_t *y_expected = malloc(rows * sizeof(uint32_t));
+    uint32_t *y_pred = malloc(rows * sizeof(uint32_t));
+    sltm->trie_nodes = NULL;
+    sltm_predict(sltm, X, y_expected, rows);
+    sltm->trie_nodes = trie_nodes;
+    sltm_predict(sltm, X, y_pred, rows);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(y_expected, y_pred, rows);
+
+    sltm_free(sltm);
+    free(X);
+    free(expected);
+    free(y_expected);
+    free(y_pred);
+}
+
+// The loaders stream the dense states in chunks, clauses crossing chunk boundaries come out whole
+void test_load_dense_streams_states(void) {
+    // 2 * 1000 * 70 states, more than two chunks, none of them clause aligned
+    struct TsetlinMachine *tm = tm_create(3, 50, 1000, 70, 127, -127, 1, 1, sizeof(uint32_t), 10.f, 42);
+    TEST_ASSERT_GREATER_THAN_UINT32(2 * DENSE_LOAD_CHUNK_SIZE, tm->num_clauses * tm->num_literals * 2);
+    struct FastPRNG rng;
+    prng_seed(&rng, 57);
+    for (uint32_t clause_id = 0; clause_id < tm->num_clauses; clause_id++) {
+        for (uint32_t ta_id = 0; ta_id < tm->num_literals * 2; ta_id++) {
+            // Included at a clause's first and last TA, so boundaries matter
+            uint8_t included = ta_id == 0 || ta_id == tm->num_literals * 2 - 1 || prng_next_float(&rng) < 0.01f;
+            tm->ta_state[tm_ta_state_index(tm, clause_id, ta_id / 2, ta_id % 2)] = included ? tm->mid_state + 3 : tm->mid_state - 3;
+        }
+    }
+    tm_save(tm, "build/test_load_dense.bin");
+
+    struct StatelessTsetlinMachine *sltm = sltm_load_dense("build/test_load_dense.bin", 1, sizeof(uint32_t));
+    struct SparseTsetlinMachine *stm = stm_load_dense("build/test_load_dense.bin", 1, sizeof(uint32_t));
+    TEST_ASSERT_NOT_NULL(sltm);
+    TEST_ASSERT_NOT_NULL(stm);
+    for (uint32_t clause_id = 0; clause_id < tm->num_clauses; clause_id++) {
+        uint32_t pos = sltm->clause_offsets[clause_id];
+        const struct TAStateList *list = stm->ta_state + clause_id;
+        uint32_t node_id = 0;
+        for (uint32_t ta_id = 0; ta_id < tm->num_literals * 2; ta_id++) {
+            int8_t state = tm->ta_state[tm_ta_state_index(tm, clause_id, ta_id / 2, ta_id % 2)];
+            if (state >= tm->mid_state) {
+                TEST_ASSERT_EQUAL_UINT32(ta_id, clause_ta_id(sltm, pos++));
+                TEST_ASSERT_EQUAL_UINT32(ta_id, ta_state_get(list, node_id, stm->node_size).ta_id);
+                TEST_ASSERT_EQUAL_INT8(state, ta_state_get(list, node_id, stm->node_size).ta_state);
+                node_id++;
+            }
+        }
+        TEST_ASSERT_EQUAL_UINT32(sltm->clause_offsets[clause_id + 1], pos);
+        TEST_ASSERT_EQUAL_UINT32(list->size, node_id);
+    }
+
+    remove("build/test_load_dense.bin");
+    sltm_free(sltm);
+    stm_free(stm);
+    tm_free(tm);
+}
+
+void test_conversions_match_loaders(void) {
+    // Briefly trained, so states are spread around mid_state and around sparse_min_state
+    uint32_t rows = 200;
+    struct TsetlinMachine *tm = tm_create(3, 20, 90, 37, 127, -127, 1, 1, sizeof(uint32_t), 3.f, 61);
+    struct FastPRNG rng;
+    prng_seed(&rng, 62);
+    uint8_t *X = malloc(rows * tm->num_literals);
+    uint32_t *y = malloc(rows * sizeof(uint32_t));
+    for (uint32_t row = 0; row < rows; row++) {
+        y[row] = prng_next_uint32(&rng) % 3;
+        for (uint32_t literal_id = 0; literal_id < tm->num_literals; literal_id++) {
+            X[row * tm->num_literals + literal_id] = prng_next_float(&rng) < (literal_id % 3 == y[row] ? 0.8f : 0.2f);
+        }
+    }
+    tm_train(tm, X, y, rows, 3);
+    tm_save(tm, "build/test_conversions.bin");
+    struct StatelessTsetlinMachine *sltm_loaded = sltm_load_dense("build/test_conversions.bin", 1, sizeof(uint32_t));
+    remove("build/test_conversions.bin");
+
+    // Dense -> stateless is the same as the file round trip
+    struct StatelessTsetlinMachine *sltm = sltm_from_dense(tm, 3);
+    TEST_ASSERT_NOT_NULL(sltm);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(sltm_loaded->clause_offsets, sltm->clause_offsets, tm->num_clauses + 1);
+    TEST_ASSERT_EQUAL_MEMORY(sltm_loaded->ta_ids, sltm->ta_ids, sltm->clause_offsets[tm->num_clauses] * sltm->ta_id_size);
+    TEST_ASSERT_EQUAL_INT16_ARRAY(sltm_loaded->weights, sltm->weights, tm->num_clauses * tm->num_classes);
+
+    // Dense -> sparse keeps every TA at or above sparse_min_state, with its state
+    struct SparseTsetlinMachine *stm = stm_from_dense(tm, 4);
+    TEST_ASSERT_NOT_NULL(stm);
+    TEST_ASSERT_EQUAL_INT16_ARRAY(tm->weights, stm->weights, tm->num_clauses * tm->num_classes);
+    uint32_t num_excluded_kept = 0;
+    for (uint32_t clause_id = 0; clause_id < tm->num_clauses; clause_id++) {
+        const struct TAStateList *list = stm->ta_state + clause_id;
+        uint32_t node_id = 0;
+        for (uint32_t ta_id = 0; ta_id < tm->num_literals * 2; ta_id++) {
+            int8_t state = tm->ta_state[tm_ta_state_index(tm, clause_id, ta_id / 2, ta_id % 2)];
+            if (state >= stm->sparse_min_state) {
+                TEST_ASSERT_EQUAL_UINT32(ta_id, ta_state_get(list, node_id, stm->node_size).ta_id);
+                TEST_ASSERT_EQUAL_INT8(state, ta_state_get(list, node_id, stm->node_size).ta_state);
+                num_excluded_kept += state < stm->mid_state;
+                node_id++;
+            }
+        }
+        TEST_ASSERT_EQUAL_UINT32(list->size, node_id);
+        TEST_ASSERT_EQUAL_UINT32(tm->clause_include_count[clause_id], stm->clause_include_count[clause_id]);
+    }
+    TEST_ASSERT_GREATER_THAN_UINT32(0, num_excluded_kept);
+
+    // Sparse -> stateless matches dense -> stateless
+    struct StatelessTsetlinMachine *sltm_sparse = sltm_from_sparse(stm, 2);
+    TEST_ASSERT_NOT_NULL(sltm_sparse);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(sltm->clause_offsets, sltm_sparse->clause_offsets, tm->num_clauses + 1);
+    TEST_ASSERT_EQUAL_MEMORY(sltm->ta_ids, sltm_sparse->ta_ids, sltm->clause_offsets[tm->num_clauses] * sltm->ta_id_size);
+
+    // Sparse -> dense restores the listed states and the include masks, the rest stays excluded below sparse_min_state
+    struct TsetlinMachine *tm_back = stm_to_dense(stm, 0);
+    TEST_ASSERT_NOT_NULL(tm_back);
+    for (uint32_t clause_id = 0; clause_id < tm->num_clauses; clause_id++) {
+        for (uint32_t ta_id = 0; ta_id < tm->num_literals * 2; ta_id++) {
+            size_t index = tm_ta_state_index(tm, clause_id, ta_id / 2, ta_id % 2);
+            int8_t expected = tm->ta_state[index] >= stm->sparse_min_state ? tm->ta_state[index] : stm->sparse_min_state - 1;
+            TEST_ASSERT_EQUAL_INT8(expected, tm_back->ta_state[index]);
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT64_ARRAY(tm->include_mask, tm_back->include_mask, tm->num_clauses * tm->mask_row_size);
+    TEST_ASSERT_EQUAL_UINT64_ARRAY(tm->include_negated_mask, tm_back->include_negated_mask, tm->num_clauses * tm->mask_row_size);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(tm->clause_include_count, tm_back->clause_include_count, tm->num_clauses);
+
+    // All of them predict the same
+    uint32_t *y_pred = malloc(rows * sizeof(uint32_t));
+    uint32_t *y_pred_converted = malloc(rows * sizeof(uint32_t));
+    tm_predict(tm, X, y_pred, rows);
+    tm_predict(tm_back, X, y_pred_converted, rows);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(y_pred, y_pred_converted, rows);
+    stm_predict(stm, X, y_pred_converted, rows);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(y_pred, y_pred_converted, rows);
+    sltm_predict(sltm_sparse, X, y_pred_converted, rows);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(y_pred, y_pred_converted, rows);
+
+    // The converted sparse model keeps training
+    stm_train(stm, X, y, rows, 1);
+
+    free(y_pred);
+    free(y_pred_converted);
+    free(X);
+    free(y);
+    tm_free(tm_back);
+    sltm_free(sltm_sparse);
+    stm_free(stm);
+    sltm_free(sltm);
+    sltm_free(sltm_loaded);
+    tm_free(tm);
+}
+
+// Calibration puts the most frequent falsifiers first, predictions and compaction stay the same
+void test_calibrate_orders_by_falsification(void) {
+    struct StatelessTsetlinMachine *sltm = sltm_create(2, 100, 10, 4, 127, -127, 1, 1, sizeof(uint32_t), 10.f);
+    // Clauses 0 and 1 include positive literals 0..4, clause 2 mixes in negated ones, clause 3 is empty
+    uint32_t clause_offsets[5] = {0, 5, 10, 14, 14};
+    uint32_t ta_ids[14] = {0, 2, 4, 6, 8,   0, 2, 4, 6, 8,   3, 6, 9, 12};
+    int16_t weights[8] = {3, -1,   2, -2,   -4, 5,   1, 1};
+    TEST_ASSERT_TRUE(sltm_set_clauses(sltm, clause_offsets, ta_ids));
+    memcpy(sltm->weights, weights, sizeof(weights));
+    sltm_update_trie(sltm);
+
+    // Skewed input: literal 3 is mostly 0, literal 1 is 0 half of the time, the rest is mostly 1
+    struct FastPRNG rng;
+    prng_seed(&rng, 23);
+    uint32_t rows = BITSLICE_MIN_ROWS + 44;
+    uint8_t *X = malloc(rows * sltm->num_literals * sizeof(uint8_t));
+    for (uint32_t row = 0; row < rows; row++) {
+        for (uint32_t literal_id = 0; literal_id < sltm->num_literals; literal_id++) {
+            float p_zero = literal_id == 3 ? 0.9f : (literal_id == 1 ? 0.5f : 0.05f);
+            X[row * sltm->num_literals + literal_id] = prng_next_float(&rng) >= p_zero;
+        }
+    }
+    uint32_t *y_expected = malloc(rows * sizeof(uint32_t));
+    uint32_t *y_pred = malloc(rows * sizeof(uint32_t));
+    sltm_predict(sltm, X, y_expected, rows);
+
+    sltm_calibrate(sltm, X, rows);
+    TEST_ASSERT_EQUAL_UINT32(2 * 3, clause_ta_id(sltm, 0));
+    TEST_ASSERT_EQUAL_UINT32(2 * 1, clause_ta_id(sltm, 1));
+    for (uint32_t pos = 0; pos < 5; pos++) {
+        TEST_ASSERT_EQUAL_UINT32(clause_ta_id(sltm, pos), clause_ta_id(sltm, 5 + pos));
+    }
+
+    // Same predictions in blocks (through the rebuilt trie) and row by row
+    sltm_predict(sltm, X, y_pred, rows);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(y_expected, y_pred, rows);
+    for (uint32_t row = 0; row < rows; row++) {
+        sltm_predict(sltm, X + row * sltm->num_literals, y_pred + row, 1);
+    }
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(y_expected, y_pred, rows);
+
+    // Clause 1 still merges into clause 0, the empty clause 3 is dropped
+    TEST_ASSERT_EQUAL_UINT32(2, sltm_compact(sltm));
+    sltm_predict(sltm, X, y_pred, rows);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(y_expected, y_pred, rows);
+
+    sltm_free(sltm);
+    free(X);
+    free(y_expected);
+    free(y_pred);
+}
+
+void test_stateless_tsetlin_machine_run_all(void) {
+    RUN_TEST(test_posting_lists_match_list_walk);
+    RUN_TEST(test_predict_batch_matches_rows);
+    RUN_TEST(test_ta_id_size_follows_shape);
+    RUN_TEST(test_load_dense_streams_states);
+    RUN_TEST(test_conversions_match_loaders);
+    RUN_TEST(test_compact_merges_duplicates);
+    RUN_TEST(test_trie_matches_clause_walk);
+    RUN_TEST(test_calibrate_orders_by_falsification);
+}
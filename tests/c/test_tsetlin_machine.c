@@ -3,16 +3,25 @@
 #include "stdlib.h"
 
 #include "../../src/c/src/tsetlin_machine.c"
-#include "../../src/c/src/utility.c"
 #include "../../src/c/src/fast_prng.c"
+#include "../../src/c/src/parallel_jobs.c"
 
 
+// TA ta_id (2 * literal_id + negated) of clause clause_id, with i = clause_id * num_literals * 2 + ta_id
+// as in the interleaved (num_clauses, num_literals, 2) file layout
+static int8_t *ta_state_at(struct TsetlinMachine *tm, uint32_t i) {
+    uint32_t clause_id = i / (tm->num_literals * 2);
+    uint32_t ta_id = i % (tm->num_literals * 2);
+    return tm->ta_state + tm_ta_state_index(tm, clause_id, ta_id / 2, ta_id % 2);
+}
+
 void basic_inference(void) {
     struct TsetlinMachine *tm = tm_create(1, 100, 3, 1, 127, -127, 0, 1, sizeof(uint8_t), 10.f, 42);
     // One clause that "activates" on literal values: 10x where x means any
-    tm->ta_state[0] = 1; tm->ta_state[1] = -1;
-    tm->ta_state[2] = -1; tm->ta_state[3] = 1;
-    tm->ta_state[4] = -1; tm->ta_state[5] = -1;
+    *ta_state_at(tm, 0) = 1; *ta_state_at(tm, 1) = -1;
+    *ta_state_at(tm, 2) = -1; *ta_state_at(tm, 3) = 1;
+    *ta_state_at(tm, 4) = -1; *ta_state_at(tm, 5) = -1;
+    tm_update_include_masks(tm);
     // And its vote has weight 1
     tm->weights[0] = 1;
     // Set output_activation to binary vector, instead of default class argmax
@@ -44,9 +53,10 @@ void basic_inference(void) {
 void basic_training(void) {
     struct TsetlinMachine *tm = tm_create(1, 100, 3, 1, 127, -127, 0, 1, sizeof(uint8_t), 10.f, 42);
     // One clause that "activates" on literal values: 10x where x means any
-    tm->ta_state[0] = 1; tm->ta_state[1] = -1;
-    tm->ta_state[2] = -1; tm->ta_state[3] = 1;
-    tm->ta_state[4] = -1; tm->ta_state[5] = -1;
+    *ta_state_at(tm, 0) = 1; *ta_state_at(tm, 1) = -1;
+    *ta_state_at(tm, 2) = -1; *ta_state_at(tm, 3) = 1;
+    *ta_state_at(tm, 4) = -1; *ta_state_at(tm, 5) = -1;
+    tm_update_include_masks(tm);
     // And its vote has weight 1
     tm->weights[0] = 1;
     // Set output_activation to binary vector, instead of default class argmax
@@ -78,14 +88,16 @@ void basic_training(void) {
 
 void test_calculate_clause_output(void) {
     struct TsetlinMachine *tm = tm_create(1, 50, 2, 2, 127, -127, 0, 1, sizeof(uint8_t), 10.f, 42);
-    tm->ta_state[0] = 100;
-    tm->ta_state[1] = -100;
-    tm->ta_state[2] = 100;
-    tm->ta_state[3] = -100;
-    tm->ta_state[4] = -100;
-    tm->ta_state[5] = 100;
-    tm->ta_state[6] = -100;
-    tm->ta_state[7] = 100;
+    *ta_state_at(tm, 0) = 100;
+    *ta_state_at(tm, 1) = -100;
+    *ta_state_at(tm, 2) = 100;
+    *ta_state_at(tm, 3) = -100;
+    *ta_state_at(tm, 4) = -100;
+    *ta_state_at(tm, 5) = 100;
+    *ta_state_at(tm, 6) = -100;
+    *ta_state_at(tm, 7) = 100;
+
+    tm_update_include_masks(tm);
 
     uint8_t X[] = {1, 1};
 
@@ -115,12 +127,137 @@ void test_sum_votes(void) {
     tm_free(tm);
 }
 
+void test_packed_predict_matches_scalar(void) {
+    // 130 literals to cover a partially filled last mask word
+    struct TsetlinMachine *tm = tm_create(3, 100, 130, 64, 127, -127, 0, 1, sizeof(uint8_t), 10.f, 42);
+    struct FastPRNG rng;
+    prng_seed(&rng, 7);
+    // Few included literals per clause, so that some clauses stay active (and some are empty)
+    for (uint32_t i = 0; i < tm->num_clauses * tm->num_literals * 2; i++) {
+        *ta_state_at(tm, i) = prng_next_float(&rng) < 0.01f ? 10 : -10;
+    }
+    tm_update_include_masks(tm);
+    tm_set_output_activation(tm, tm_oa_bin_vector);
+    tm->y_size = tm->num_classes;
+
+    uint8_t X[130];
+    uint8_t y_pred[3];
+    int32_t votes_expected[3];
+    for (uint32_t row = 0; row < 200; row++) {
+        for (uint32_t literal_id = 0; literal_id < tm->num_literals; literal_id++) {
+            X[literal_id] = prng_next_float(&rng) < 0.5f;
+        }
+
+        calculate_clause_output(tm, X, 1);
+        sum_votes(tm);
+        memcpy(votes_expected, tm->votes, sizeof(votes_expected));
+
+        tm_predict(tm, X, y_pred, 1);
+        TEST_ASSERT_EQUAL_INT32_ARRAY(votes_expected, tm->votes, 3);
+    }
+
+    tm_free(tm);
+}
+
+void test_predict_parallel_matches_serial(void) {
+    struct TsetlinMachine *tm = tm_create(4, 100, 70, 40, 127, -127, 0, 1, sizeof(uint32_t), 10.f, 42);
+    struct FastPRNG rng;
+    prng_seed(&rng, 11);
+    for (uint32_t i = 0; i < tm->num_clauses * tm->num_literals * 2; i++) {
+        *ta_state_at(tm, i) = prng_next_float(&rng) < 0.02f ? 10 : -10;
+    }
+    tm_update_include_masks(tm);
+
+    // Row count not divisible by the thread count
+    uint32_t rows = 101;
+    uint8_t *X = malloc(rows * tm->num_literals * sizeof(uint8_t));
+    uint32_t *y_serial = malloc(rows * sizeof(uint32_t));
+    uint32_t *y_parallel = malloc(rows * sizeof(uint32_t));
+    for (uint32_t i = 0; i < rows * tm->num_literals; i++) {
+        X[i] = prng_next_float(&rng) < 0.5f;
+    }
+
+    tm_predict(tm, X, y_serial, rows);
+    tm_predict_parallel(tm, X, y_parallel, rows, 4);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(y_serial, y_parallel, rows);
+
+    tm_free(tm);
+    free(X);
+    free(y_serial);
+    free(y_parallel);
+}
+
+void test_predict_context_matches_predict(void) {
+    struct TsetlinMachine *tm = tm_create(3, 100, 40, 30, 127, -127, 0, 1, sizeof(uint32_t), 10.f, 42);
+    struct FastPRNG rng;
+    prng_seed(&rng, 5);
+    for (uint32_t i = 0; i < tm->num_clauses * tm->num_literals * 2; i++) {
+        *ta_state_at(tm, i) = prng_next_float(&rng) < 0.03f ? 10 : -10;
+    }
+    tm_update_include_masks(tm);
+
+    uint32_t rows = 50;
+    uint8_t *X = malloc(rows * tm->num_literals * sizeof(uint8_t));
+    uint32_t y_expected[50], y_first[50], y_second[50];
+    for (uint32_t i = 0; i < rows * tm->num_literals; i++) {
+        X[i] = prng_next_float(&rng) < 0.5f;
+    }
+
+    tm_predict(tm, X, y_expected, rows);
+
+    // Two contexts sharing one const model
+    const struct TsetlinMachine *shared = tm;
+    struct TsetlinMachineContext *first = tm_context_create(shared);
+    struct TsetlinMachineContext *second = tm_context_create(shared);
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_NOT_NULL(second);
+    tm_predict_context(shared, first, X, y_first, rows);
+    tm_predict_context(shared, second, X, y_second, rows);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(y_expected, y_first, rows);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(y_expected, y_second, rows);
+
+    tm_context_free(first);
+    tm_context_free(second);
+    tm_free(tm);
+    free(X);
+}
+
+void test_bitsliced_predict_matches_row_by_row(void) {
+    struct TsetlinMachine *tm = tm_create(5, 100, 90, 50, 127, -127, 0, 1, sizeof(uint32_t), 10.f, 42);
+    struct FastPRNG rng;
+    prng_seed(&rng, 13);
+    for (uint32_t i = 0; i < tm->num_clauses * tm->num_literals * 2; i++) {
+        *ta_state_at(tm, i) = prng_next_float(&rng) < 0.02f ? 10 : -10;
+    }
+    tm_update_include_masks(tm);
+
+    // Enough rows for the bit-sliced path, with a partial last block
+    uint32_t rows = BITSLICE_MIN_ROWS + 37;
+    uint8_t *X = malloc(rows * tm->num_literals * sizeof(uint8_t));
+    uint32_t *y_batch = malloc(rows * sizeof(uint32_t));
+    uint32_t *y_single = malloc(rows * sizeof(uint32_t));
+    for (uint32_t i = 0; i < rows * tm->num_literals; i++) {
+        X[i] = prng_next_float(&rng) < 0.5f;
+    }
+
+    tm_predict(tm, X, y_batch, rows);
+    for (uint32_t row = 0; row < rows; row++) {
+        tm_predict(tm, X + row * tm->num_literals, y_single + row, 1);
+    }
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(y_single, y_batch, rows);
+
+    tm_free(tm);
+    free(X);
+    free(y_batch);
+    free(y_single);
+}
+
 
 void test_type_1a_feedback(void) {
     struct TsetlinMachine *tm = tm_create(1, 100, 3, 1, 127, -127, 1, 1, sizeof(uint8_t), 10.f, 42);
-    tm->ta_state[0] = 1; tm->ta_state[1] = -1;
-    tm->ta_state[2] = -1; tm->ta_state[3] = 1;
-    tm->ta_state[4] = -1; tm->ta_state[5] = -1;
+    *ta_state_at(tm, 0) = 1; *ta_state_at(tm, 1) = -1;
+    *ta_state_at(tm, 2) = -1; *ta_state_at(tm, 3) = 1;
+    *ta_state_at(tm, 4) = -1; *ta_state_at(tm, 5) = -1;
 
     tm->weights[0] = 1;
 
@@ -130,13 +267,13 @@ void test_type_1a_feedback(void) {
 
     TEST_ASSERT_EQUAL_INT(2, tm->weights[0]);
 
-    TEST_ASSERT_EQUAL_INT(2, tm->ta_state[0]);
-    TEST_ASSERT_EQUAL_INT(2, tm->ta_state[3]);
-    TEST_ASSERT_EQUAL_INT(0, tm->ta_state[5]);
+    TEST_ASSERT_EQUAL_INT(2, *ta_state_at(tm, 0));
+    TEST_ASSERT_EQUAL_INT(2, *ta_state_at(tm, 3));
+    TEST_ASSERT_EQUAL_INT(0, *ta_state_at(tm, 5));
 
-    TEST_ASSERT_EQUAL_INT(-1, tm->ta_state[1]);
-    TEST_ASSERT_EQUAL_INT(-1, tm->ta_state[2]);
-    TEST_ASSERT_EQUAL_INT(-1, tm->ta_state[4]);
+    TEST_ASSERT_EQUAL_INT(-1, *ta_state_at(tm, 1));
+    TEST_ASSERT_EQUAL_INT(-1, *ta_state_at(tm, 2));
+    TEST_ASSERT_EQUAL_INT(-1, *ta_state_at(tm, 4));
 
     tm_free(tm);
 }
@@ -144,18 +281,18 @@ void test_type_1a_feedback(void) {
 void test_type_1b_feedback(void) {
     struct TsetlinMachine *tm = tm_create(1, 100, 3, 1, 127, -127, 1, 1, sizeof(uint8_t), 1.f, 42);
 
-    tm->ta_state[0] = 1; tm->ta_state[1] = -1;
-    tm->ta_state[2] = -1; tm->ta_state[3] = 1;
-    tm->ta_state[4] = -1; tm->ta_state[5] = -1;
+    *ta_state_at(tm, 0) = 1; *ta_state_at(tm, 1) = -1;
+    *ta_state_at(tm, 2) = -1; *ta_state_at(tm, 3) = 1;
+    *ta_state_at(tm, 4) = -1; *ta_state_at(tm, 5) = -1;
 
     type_1b_feedback(tm, 0);
 
-    TEST_ASSERT_EQUAL_INT(0, tm->ta_state[0]);
-    TEST_ASSERT_EQUAL_INT(-2, tm->ta_state[1]);
-    TEST_ASSERT_EQUAL_INT(-2, tm->ta_state[2]);
-    TEST_ASSERT_EQUAL_INT(0, tm->ta_state[3]);
-    TEST_ASSERT_EQUAL_INT(-2, tm->ta_state[4]);
-    TEST_ASSERT_EQUAL_INT(-2, tm->ta_state[5]);
+    TEST_ASSERT_EQUAL_INT(0, *ta_state_at(tm, 0));
+    TEST_ASSERT_EQUAL_INT(-2, *ta_state_at(tm, 1));
+    TEST_ASSERT_EQUAL_INT(-2, *ta_state_at(tm, 2));
+    TEST_ASSERT_EQUAL_INT(0, *ta_state_at(tm, 3));
+    TEST_ASSERT_EQUAL_INT(-2, *ta_state_at(tm, 4));
+    TEST_ASSERT_EQUAL_INT(-2, *ta_state_at(tm, 5));
 
     tm_free(tm);
 }
@@ -163,23 +300,344 @@ void test_type_1b_feedback(void) {
 void test_type_2_feedback(void) {
     struct TsetlinMachine *tm = tm_create(1, 100, 3, 1, 127, -127, 1, 1, sizeof(uint8_t), 1.f, 42);
 
-    tm->ta_state[0] = 1; tm->ta_state[1] = -1;
-    tm->ta_state[2] = -1; tm->ta_state[3] = 1;
-    tm->ta_state[4] = -1; tm->ta_state[5] = -1;
+    *ta_state_at(tm, 0) = 1; *ta_state_at(tm, 1) = -1;
+    *ta_state_at(tm, 2) = -1; *ta_state_at(tm, 3) = 1;
+    *ta_state_at(tm, 4) = -1; *ta_state_at(tm, 5) = -1;
 
     uint8_t X[] = {1, 0, 1};
 
     type_2_feedback(tm, X, 0, 0);
 
-    TEST_ASSERT_EQUAL_INT(1, tm->ta_state[0]);
-    TEST_ASSERT_EQUAL_INT(1, tm->ta_state[3]);
-    TEST_ASSERT_EQUAL_INT(-1, tm->ta_state[4]);
+    TEST_ASSERT_EQUAL_INT(1, *ta_state_at(tm, 0));
+    TEST_ASSERT_EQUAL_INT(1, *ta_state_at(tm, 3));
+    TEST_ASSERT_EQUAL_INT(-1, *ta_state_at(tm, 4));
+
+    TEST_ASSERT_EQUAL_INT(0, *ta_state_at(tm, 1));
+    TEST_ASSERT_EQUAL_INT(0, *ta_state_at(tm, 2));
+    TEST_ASSERT_EQUAL_INT(0, *ta_state_at(tm, 5));
+
+    tm_free(tm);
+}
+
+static void check_include_count_tracks_feedback(float s) {
+    struct TsetlinMachine *tm = tm_create(3, 20, 40, 30, 127, -127, 1, 1, sizeof(uint32_t), s, 42);
+    struct FastPRNG rng;
+    prng_seed(&rng, 17);
+
+    uint32_t rows = 40;
+    uint8_t *X = malloc(rows * tm->num_literals * sizeof(uint8_t));
+    uint32_t *y = malloc(rows * sizeof(uint32_t));
+    for (uint32_t row = 0; row < rows; row++) {
+        for (uint32_t literal_id = 0; literal_id < tm->num_literals; literal_id++) {
+            X[row * tm->num_literals + literal_id] = prng_next_float(&rng) < 0.5f;
+        }
+        y[row] = prng_next_uint32(&rng) % tm->num_classes;
+    }
+
+    // Same steps as tm_train, checking the counts and packed masks after every row
+    // States stay close to mid_state early on, so actions flip often
+    uint32_t mask_size = tm->num_clauses * tm->mask_row_size;
+    uint64_t *include = malloc(mask_size * sizeof(uint64_t));
+    uint64_t *include_negated = malloc(mask_size * sizeof(uint64_t));
+    tm_update_include_masks(tm);
+    for (uint32_t row = 0; row < rows; row++) {
+        calculate_clause_output(tm, X + row * tm->num_literals, 0);
+        sum_votes(tm);
+        tm->calculate_feedback(tm, X + row * tm->num_literals, y + row);
+        for (uint32_t clause_id = 0; clause_id < tm->num_clauses; clause_id++) {
+            uint32_t include_count = 0;
+            for (uint32_t ta_id = 0; ta_id < tm->num_literals * 2; ta_id++) {
+                include_count += action(*ta_state_at(tm, clause_id * tm->num_literals * 2 + ta_id), tm->mid_state);
+            }
+            TEST_ASSERT_EQUAL_UINT32(include_count, tm->clause_include_count[clause_id]);
+        }
+
+        memcpy(include, tm->include_mask, mask_size * sizeof(uint64_t));
+        memcpy(include_negated, tm->include_negated_mask, mask_size * sizeof(uint64_t));
+        tm_update_include_masks(tm);
+        TEST_ASSERT_EQUAL_HEX64_ARRAY(tm->include_mask, include, mask_size);
+        TEST_ASSERT_EQUAL_HEX64_ARRAY(tm->include_negated_mask, include_negated, mask_size);
+    }
+
+    tm_free(tm);
+    free(X);
+    free(y);
+    free(include);
+    free(include_negated);
+}
+
+void test_include_count_tracks_feedback(void) {
+    // Small s uses the random bitmaps, large s the skip-sampled updates
+    check_include_count_tracks_feedback(3.f);
+    check_include_count_tracks_feedback(25.f);
+}
+
+void test_prng_next_mask_probability(void) {
+    struct FastPRNG rng;
+    prng_seed(&rng, 5);
+
+    TEST_ASSERT_EQUAL_HEX64(UINT64_MAX, prng_next_mask(&rng, prng_mask_threshold(1.0f)));
+    TEST_ASSERT_EQUAL_HEX64(0, prng_next_mask(&rng, prng_mask_threshold(0.0f)) & prng_next_mask(&rng, prng_mask_threshold(0.0f)));
+
+    const float probabilities[] = {0.01f, 0.1f, 0.5f, 0.75f, 0.99f};
+    for (uint32_t i = 0; i < sizeof(probabilities) / sizeof(probabilities[0]); i++) {
+        uint32_t threshold = prng_mask_threshold(probabilities[i]);
+        uint32_t words = 4096;
+        uint32_t set_bits = 0;
+        for (uint32_t word_id = 0; word_id < words; word_id++) {
+            set_bits += __builtin_popcountll(prng_next_mask(&rng, threshold));
+        }
+        // 262144 samples, the standard deviation of the mean is below 0.001
+        TEST_ASSERT_FLOAT_WITHIN(0.005f, probabilities[i], (float)set_bits / (float)(words * 64));
+    }
+}
 
-    TEST_ASSERT_EQUAL_INT(0, tm->ta_state[1]);
-    TEST_ASSERT_EQUAL_INT(0, tm->ta_state[2]);
-    TEST_ASSERT_EQUAL_INT(0, tm->ta_state[5]);
+void test_prng_next_geometric_mean(void) {
+    struct FastPRNG rng;
+    prng_seed(&rng, 9);
+
+    TEST_ASSERT_EQUAL_UINT32(0, prng_next_geometric(&rng, prng_geometric_scale(1.0f)));
+    TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, prng_next_geometric(&rng, prng_geometric_scale(0.0f)));
+
+    const float probabilities[] = {0.001f, 0.05f, 0.1f, 0.5f};
+    for (uint32_t i = 0; i < sizeof(probabilities) / sizeof(probabilities[0]); i++) {
+        float scale = prng_geometric_scale(probabilities[i]);
+        uint32_t samples = 100000;
+        double sum = 0.0;
+        for (uint32_t sample = 0; sample < samples; sample++) {
+            sum += prng_next_geometric(&rng, scale);
+        }
+        // Mean number of failures before a success is (1 - p) / p, the standard deviation of the sample mean is below 0.4%
+        float expected = (1.0f - probabilities[i]) / probabilities[i];
+        TEST_ASSERT_FLOAT_WITHIN(0.02f * expected, expected, (float)(sum / samples));
+    }
+}
+
+void test_prng_next_event_rate(void) {
+    struct FastPRNG rng;
+    prng_seed(&rng, 11);
+
+    TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, prng_next_event(&rng, prng_geometric_scale(0.0f), 5));
+    TEST_ASSERT_EQUAL_UINT32(5, prng_next_event(&rng, prng_geometric_scale(1.0f), 5));
+    TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, prng_next_event(&rng, prng_geometric_scale(0.5f), UINT32_MAX));
+
+    // Events in [start, end) are Bernoulli(p) trials, as in the per-clause loops they replace
+    const float probabilities[] = {0.002f, 0.03f};
+    for (uint32_t i = 0; i < sizeof(probabilities) / sizeof(probabilities[0]); i++) {
+        float scale = prng_geometric_scale(probabilities[i]);
+        uint32_t start = 1000, end = 1000 + 2000000;
+        uint32_t events = 0, last = 0;
+        for (uint32_t pos = prng_next_event(&rng, scale, start); pos < end; pos = prng_next_event(&rng, scale, pos + 1)) {
+            TEST_ASSERT_TRUE(pos >= start && (events == 0 || pos > last));
+            last = pos;
+            events++;
+        }
+        float expected = probabilities[i] * (end - start);
+        TEST_ASSERT_FLOAT_WITHIN(0.05f * expected, expected, (float)events);
+    }
+}
+
+void test_train_indexed(void) {
+    struct TsetlinMachine *tm_a = tm_create(3, 20, 40, 30, 127, -127, 1, 1, sizeof(uint32_t), 3.f, 42);
+    struct TsetlinMachine *tm_b = tm_create(3, 20, 40, 30, 127, -127, 1, 1, sizeof(uint32_t), 3.f, 42);
+    struct FastPRNG rng;
+    prng_seed(&rng, 37);
+
+    uint32_t rows = 50;
+    uint8_t *X = malloc(rows * tm_a->num_literals * sizeof(uint8_t));
+    uint32_t *y = malloc(rows * sizeof(uint32_t));
+    uint32_t *row_ids = malloc(rows * sizeof(uint32_t));
+    for (uint32_t row = 0; row < rows; row++) {
+        y[row] = prng_next_uint32(&rng) % tm_a->num_classes;
+        for (uint32_t literal_id = 0; literal_id < tm_a->num_literals; literal_id++) {
+            X[row * tm_a->num_literals + literal_id] = prng_next_float(&rng) < 0.5f;
+        }
+        row_ids[row] = row;
+    }
+
+    // Rows in storage order give the same model as tm_train
+    tm_train(tm_a, X, y, rows, 2);
+    tm_train_indexed(tm_b, X, y, row_ids, rows, 2, 0);
+    TEST_ASSERT_EQUAL_INT8_ARRAY(tm_a->ta_state, tm_b->ta_state, tm_a->num_clauses * 2 * tm_a->ta_plane_size);
+    TEST_ASSERT_EQUAL_INT16_ARRAY(tm_a->weights, tm_b->weights, tm_a->num_clauses * tm_a->num_classes);
+
+    // Shuffling is reproducible and keeps row_ids a permutation
+    uint32_t *row_ids_b = malloc(rows * sizeof(uint32_t));
+    memcpy(row_ids_b, row_ids, rows * sizeof(uint32_t));
+    tm_train_indexed(tm_a, X, y, row_ids, rows, 2, 1);
+    tm_train_indexed(tm_b, X, y, row_ids_b, rows, 2, 1);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(row_ids, row_ids_b, rows);
+    TEST_ASSERT_EQUAL_INT8_ARRAY(tm_a->ta_state, tm_b->ta_state, tm_a->num_clauses * 2 * tm_a->ta_plane_size);
+
+    uint8_t *seen = calloc(rows, sizeof(uint8_t));
+    for (uint32_t i = 0; i < rows; i++) {
+        TEST_ASSERT_LESS_THAN_UINT32(rows, row_ids[i]);
+        TEST_ASSERT_FALSE(seen[row_ids[i]]);
+        seen[row_ids[i]] = 1;
+    }
+
+    tm_free(tm_a);
+    tm_free(tm_b);
+    free(X);
+    free(y);
+    free(row_ids);
+    free(row_ids_b);
+    free(seen);
+}
 
+void test_save_load_keeps_file_layout(void) {
+    // 70 literals, so the planes carry padding
+    struct TsetlinMachine *tm = tm_create(3, 100, 70, 5, 127, -127, 0, 1, sizeof(uint32_t), 10.f, 42);
+    for (uint32_t i = 0; i < tm->num_clauses * tm->num_literals * 2; i++) {
+        *ta_state_at(tm, i) = (int8_t)(i % 251 - 125);
+    }
+
+    // The bin file stores the states interleaved, after the header and weights
+    tm_save(tm, "build/test_layout.bin");
+    FILE *file = fopen("build/test_layout.bin", "rb");
+    TEST_ASSERT_NOT_NULL(file);
+    uint32_t num_states = tm->num_clauses * tm->num_literals * 2;
+    int8_t *states = malloc(num_states * sizeof(int8_t));
+    fseek(file, -(long)num_states, SEEK_END);
+    TEST_ASSERT_EQUAL_UINT32(num_states, fread(states, sizeof(int8_t), num_states, file));
+    fclose(file);
+    for (uint32_t i = 0; i < num_states; i++) {
+        TEST_ASSERT_EQUAL_INT8((int8_t)(i % 251 - 125), states[i]);
+    }
+
+    struct TsetlinMachine *loaded = tm_load("build/test_layout.bin", 1, sizeof(uint32_t));
+    TEST_ASSERT_NOT_NULL(loaded);
+    TEST_ASSERT_EQUAL_INT8_ARRAY(tm->ta_state, loaded->ta_state, tm->num_clauses * 2 * tm->ta_plane_size);
+    tm_free(loaded);
+
+    tm_save_fbs(tm, "build/test_layout.fbs");
+    loaded = tm_load_fbs("build/test_layout.fbs", 1, sizeof(uint32_t));
+    TEST_ASSERT_NOT_NULL(loaded);
+    TEST_ASSERT_EQUAL_INT8_ARRAY(tm->ta_state, loaded->ta_state, tm->num_clauses * 2 * tm->ta_plane_size);
+    tm_free(loaded);
+
+    remove("build/test_layout.bin");
+    remove("build/test_layout.fbs");
     tm_free(tm);
+    free(states);
+}
+
+void test_train_clause_parallel_deterministic(void) {
+    struct TsetlinMachine *tm_a = tm_create(3, 20, 40, 50, 127, -127, 1, 1, sizeof(uint32_t), 3.f, 42);
+    struct TsetlinMachine *tm_b = tm_create(3, 20, 40, 50, 127, -127, 1, 1, sizeof(uint32_t), 3.f, 42);
+    struct FastPRNG rng;
+    prng_seed(&rng, 23);
+
+    uint32_t rows = 60;
+    uint8_t *X = malloc(rows * tm_a->num_literals * sizeof(uint8_t));
+    uint32_t *y = malloc(rows * sizeof(uint32_t));
+    for (uint32_t row = 0; row < rows; row++) {
+        y[row] = prng_next_uint32(&rng) % tm_a->num_classes;
+        for (uint32_t literal_id = 0; literal_id < tm_a->num_literals; literal_id++) {
+            // Literals 0..2 give the class away
+            X[row * tm_a->num_literals + literal_id] = literal_id < 3 ? literal_id == y[row] : prng_next_float(&rng) < 0.5f;
+        }
+    }
+
+    // Uneven clause split across workers, same seed and thread count give the same model
+    tm_train_clause_parallel(tm_a, X, y, rows, 5, 3);
+    tm_train_clause_parallel(tm_b, X, y, rows, 5, 3);
+    TEST_ASSERT_EQUAL_INT8_ARRAY(tm_a->ta_state, tm_b->ta_state, tm_a->num_clauses * 2 * tm_a->ta_plane_size);
+    TEST_ASSERT_EQUAL_INT16_ARRAY(tm_a->weights, tm_b->weights, tm_a->num_clauses * tm_a->num_classes);
+
+    // Counts were kept in sync by the workers
+    for (uint32_t clause_id = 0; clause_id < tm_a->num_clauses; clause_id++) {
+        uint32_t include_count = 0;
+        for (uint32_t ta_id = 0; ta_id < tm_a->num_literals * 2; ta_id++) {
+            include_count += action(*ta_state_at(tm_a, clause_id * tm_a->num_literals * 2 + ta_id), tm_a->mid_state);
+        }
+        TEST_ASSERT_EQUAL_UINT32(include_count, tm_a->clause_include_count[clause_id]);
+    }
+
+    // And it learned the task
+    uint32_t *y_pred = malloc(rows * sizeof(uint32_t));
+    tm_predict(tm_a, X, y_pred, rows);
+    uint32_t correct = 0;
+    for (uint32_t row = 0; row < rows; row++) {
+        correct += y_pred[row] == y[row];
+    }
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(rows * 9 / 10, correct);
+
+    tm_free(tm_a);
+    tm_free(tm_b);
+    free(X);
+    free(y);
+    free(y_pred);
+}
+
+void test_train_clause_parallel_workers_overlap(void) {
+    // Enough clauses per worker that all of them are inside the feedback (and drawing random numbers) at once
+    struct TsetlinMachine *tm_a = tm_create(3, 200, 64, 2048, 127, -127, 1, 1, sizeof(uint32_t), 3.f, 42);
+    struct TsetlinMachine *tm_b = tm_create(3, 200, 64, 2048, 127, -127, 1, 1, sizeof(uint32_t), 3.f, 42);
+    struct FastPRNG rng;
+    prng_seed(&rng, 37);
+
+    uint32_t rows = 200;
+    uint8_t *X = malloc(rows * tm_a->num_literals * sizeof(uint8_t));
+    uint32_t *y = malloc(rows * sizeof(uint32_t));
+    for (uint32_t row = 0; row < rows; row++) {
+        y[row] = prng_next_uint32(&rng) % tm_a->num_classes;
+        for (uint32_t literal_id = 0; literal_id < tm_a->num_literals; literal_id++) {
+            X[row * tm_a->num_literals + literal_id] = literal_id < 3 ? literal_id == y[row] : prng_next_float(&rng) < 0.5f;
+        }
+    }
+
+    // Workers share no PRNG state, so the result only depends on the seed and thread count
+    tm_train_clause_parallel(tm_a, X, y, rows, 2, 4);
+    tm_train_clause_parallel(tm_b, X, y, rows, 2, 4);
+    TEST_ASSERT_EQUAL_INT8_ARRAY(tm_a->ta_state, tm_b->ta_state, tm_a->num_clauses * 2 * tm_a->ta_plane_size);
+    TEST_ASSERT_EQUAL_INT16_ARRAY(tm_a->weights, tm_b->weights, tm_a->num_clauses * tm_a->num_classes);
+
+    tm_free(tm_a);
+    tm_free(tm_b);
+    free(X);
+    free(y);
+}
+
+void test_train_parallel_learns(void) {
+    struct TsetlinMachine *tm = tm_create(3, 20, 40, 50, 127, -127, 1, 1, sizeof(uint32_t), 3.f, 42);
+    struct FastPRNG rng;
+    prng_seed(&rng, 29);
+
+    uint32_t rows = 90;
+    uint8_t *X = malloc(rows * tm->num_literals * sizeof(uint8_t));
+    uint32_t *y = malloc(rows * sizeof(uint32_t));
+    for (uint32_t row = 0; row < rows; row++) {
+        y[row] = prng_next_uint32(&rng) % tm->num_classes;
+        for (uint32_t literal_id = 0; literal_id < tm->num_literals; literal_id++) {
+            // Literals 0..2 give the class away
+            X[row * tm->num_literals + literal_id] = literal_id < 3 ? literal_id == y[row] : prng_next_float(&rng) < 0.5f;
+        }
+    }
+
+    tm_train_parallel(tm, X, y, rows, 5, 4);
+
+    // Counts are resynced after the workers are done
+    for (uint32_t clause_id = 0; clause_id < tm->num_clauses; clause_id++) {
+        uint32_t include_count = 0;
+        for (uint32_t ta_id = 0; ta_id < tm->num_literals * 2; ta_id++) {
+            include_count += action(*ta_state_at(tm, clause_id * tm->num_literals * 2 + ta_id), tm->mid_state);
+        }
+        TEST_ASSERT_EQUAL_UINT32(include_count, tm->clause_include_count[clause_id]);
+    }
+
+    uint32_t *y_pred = malloc(rows * sizeof(uint32_t));
+    tm_predict(tm, X, y_pred, rows);
+    uint32_t correct = 0;
+    for (uint32_t row = 0; row < rows; row++) {
+        correct += y_pred[row] == y[row];
+    }
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(rows * 9 / 10, correct);
+
+    tm_free(tm);
+    free(X);
+    free(y);
+    free(y_pred);
 }
 
 void test_tsetlin_machine_run_all(void) {
@@ -187,7 +645,20 @@ void test_tsetlin_machine_run_all(void) {
     RUN_TEST(basic_training);
     RUN_TEST(test_calculate_clause_output);
     RUN_TEST(test_sum_votes);
+    RUN_TEST(test_packed_predict_matches_scalar);
+    RUN_TEST(test_predict_parallel_matches_serial);
+    RUN_TEST(test_predict_context_matches_predict);
+    RUN_TEST(test_bitsliced_predict_matches_row_by_row);
+    RUN_TEST(test_prng_next_mask_probability);
+    RUN_TEST(test_prng_next_geometric_mean);
+    RUN_TEST(test_prng_next_event_rate);
+    RUN_TEST(test_train_clause_parallel_deterministic);
+    RUN_TEST(test_train_clause_parallel_workers_overlap);
+    RUN_TEST(test_train_parallel_learns);
+    RUN_TEST(test_train_indexed);
+    RUN_TEST(test_save_load_keeps_file_layout);
     RUN_TEST(test_type_1a_feedback);
     RUN_TEST(test_type_1b_feedback);
     RUN_TEST(test_type_2_feedback);
+    RUN_TEST(test_include_count_tracks_feedback);
 }